@@ -0,0 +1,35 @@
+#include "host/buffer_pool.h"
+
+namespace cam {
+
+void BufferPool::Release::operator()(std::vector<uint8_t> *buffer) const {
+  std::unique_ptr<std::vector<uint8_t>> owned(buffer);
+  std::lock_guard<std::mutex> guard(free_list->lock);
+  if (free_list->buffers.size() < free_list->max_free) {
+    free_list->buffers.push_back(std::move(owned));
+  }
+}
+
+BufferPool::BufferPool(size_t max_free)
+    : free_list_(std::make_shared<FreeList>()) {
+  free_list_->max_free = max_free;
+}
+
+BufferPool::Buffer BufferPool::Acquire(size_t size) {
+  std::unique_ptr<std::vector<uint8_t>> buffer;
+  {
+    std::lock_guard<std::mutex> guard(free_list_->lock);
+    if (!free_list_->buffers.empty()) {
+      buffer = std::move(free_list_->buffers.back());
+      free_list_->buffers.pop_back();
+    }
+  }
+  if (!buffer) {
+    buffer = std::make_unique<std::vector<uint8_t>>();
+  }
+  // Doesn't reallocate unless this buffer has never been this big.
+  buffer->resize(size);
+  return Buffer(buffer.release(), Release{free_list_});
+}
+
+}  // namespace cam
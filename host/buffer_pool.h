@@ -0,0 +1,47 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cam {
+
+// Recycles byte buffers so that per-frame allocations settle down to none once
+// the pool is warm. Buffers are handed out as unique_ptrs which return
+// themselves to the pool when released. They may safely outlive the pool.
+//
+// This class is threadsafe.
+class BufferPool {
+  private:
+    struct FreeList;
+
+  public:
+    struct Release {
+      std::shared_ptr<FreeList> free_list;
+      void operator()(std::vector<uint8_t> *buffer) const;
+    };
+    using Buffer = std::unique_ptr<std::vector<uint8_t>, Release>;
+
+    // At most |max_free| released buffers are kept around for reuse.
+    explicit BufferPool(size_t max_free = 8);
+
+    BufferPool(const BufferPool &rhs) = delete;
+
+    // Returns a buffer of |size| bytes. Its contents are unspecified.
+    Buffer Acquire(size_t size);
+
+  private:
+    struct FreeList {
+      std::mutex lock;
+      std::vector<std::unique_ptr<std::vector<uint8_t>>> buffers;
+      size_t max_free;
+    };
+    std::shared_ptr<FreeList> free_list_;
+};
+
+}  // namespace cam
+
+#endif // BUFFER_POOL_H
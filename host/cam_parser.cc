@@ -4,13 +4,129 @@
 #include <iostream>
 #include <stdio.h>
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 
 namespace cam {
 
-void CamParser::InsertBinary(const uint8_t *data, size_t len) {
+namespace {
+
+// Returns the length (including the trailing \r\n) of the first complete line
+// in |bytes|, or 0 if there isn't one yet.
+size_t LineLength(ByteSpan bytes) {
+  const uint8_t *iter = bytes.begin();
+  while (true) {
+    iter = std::find(iter, bytes.end(), '\r');
+    if ((iter == bytes.end()) || (iter + 1 == bytes.end())) {
+      return 0;
+    }
+    if (*(iter + 1) == '\n') {
+      return (iter + 2) - bytes.begin();
+    }
+    iter++;
+  }
+}
+
+// Copies |line| into |value| as a null-terminated string so that sscanf can
+// parse it. Overlong lines are truncated.
+template <size_t N>
+void CopyLine(ByteSpan line, std::array<char, N> *value) {
+  const size_t len = std::min(line.size, N - 1);
+  std::memcpy(value->data(), line.data, len);
+  (*value)[len] = '\0';
+}
+
+}  // namespace
+
+CamParser::CamParser(const Options &options)
+    : state_(HTTP_RESPONSE),
+      parsed_{},
+      options_(options),
+      // Enough to recycle every queued frame plus a few being decoded.
+      frame_pool_(options.max_images + 4),
+      in_buffer_(options.buffer_capacity) {}
+
+size_t CamParser::Feed(const uint8_t *data, size_t len) {
+  std::unique_lock<std::mutex> lock(lock_);
+  const size_t images_before = images_parsed_;
+  insert_time_ = FrameTrace::Clock::now();
+  while (len > 0) {
+    const size_t written = in_buffer_.Write(data, len);
+    data += written;
+    len -= written;
+    Advance();
+    if ((written == 0) && (in_buffer_.size() == in_buffer_.capacity())) {
+      if (stalled_) {
+        image_retrieved_.wait(lock, [this]() {
+          return !stalled_ || (in_buffer_.size() < in_buffer_.capacity());
+        });
+        continue;
+      }
+      AbandonStream();
+    }
+  }
+  return images_parsed_ - images_before;
+}
+
+MutableByteSpan CamParser::PrepareInsert(size_t max_len) {
+  std::lock_guard<std::mutex> guard(lock_);
+  MutableByteSpan region = in_buffer_.PrepareWrite(max_len);
+  if ((region.size == 0) && !stalled_) {
+    // Everything parseable was parsed on the last CommitInsert(), so a full
+    // buffer can never drain.
+    AbandonStream();
+    region = in_buffer_.PrepareWrite(max_len);
+  }
+  return region;
+}
+
+size_t CamParser::CommitInsert(size_t len) {
+  std::lock_guard<std::mutex> guard(lock_);
+  const size_t images_before = images_parsed_;
+  insert_time_ = FrameTrace::Clock::now();
+  in_buffer_.CommitWrite(len);
+  Advance();
+  return images_parsed_ - images_before;
+}
+
+bool CamParser::Stalled() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return stalled_;
+}
+
+CamParser::QueueStats CamParser::queue_stats() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return queue_stats_;
+}
+
+bool CamParser::StreamEnded() {
   std::lock_guard<std::mutex> guard(lock_);
-  in_buffer_.insert(in_buffer_.end(), data, data + len);
+  return stream_ended_;
+}
+
+void CamParser::Reset() {
+  std::lock_guard<std::mutex> guard(lock_);
+  in_buffer_.Consume(in_buffer_.size());
+  state_ = HTTP_RESPONSE;
+  parsed_ = {};
+  next_chunk_size_ = -1;
+  chunk_size_ = 0;
+  skip_bytes_ = 0;
+  stream_ended_ = false;
+  stalled_ = false;
+}
+
+void CamParser::AbandonStream() {
+  std::cerr << "Input buffer is full of bytes which can't be parsed. Dropping "
+               "them and ending the stream."
+            << std::endl;
+  in_buffer_.Consume(in_buffer_.size());
+  state_ = HTTP_RESPONSE;
+  next_chunk_size_ = -1;
+  chunk_size_ = 0;
+  skip_bytes_ = 0;
+  stream_ended_ = true;
+  stalled_ = false;
 }
 
 bool CamParser::IsImageAvailable() {
@@ -19,17 +135,13 @@ bool CamParser::IsImageAvailable() {
 }
 
 bool CamParser::HttpResponseConsumed() {
-  std::vector<uint8_t> line;
+  Line line;
   if (!ConsumeHeaderLine(&line)) {
     return false;
   }
 
-  // This is to make sscanf happy -- it needs a null-terminated string.
-  line.push_back('\0');
-
   int status_code = 0;
-  int matched = std::sscanf(reinterpret_cast<const char *>(line.data()),
-                            "HTTP/1.1 %i OK\r\n", &status_code);
+  int matched = std::sscanf(line.data(), "HTTP/1.1 %i OK\r\n", &status_code);
   if ((matched == 0) || (status_code != 200)) {
     // No need to reset parser state since we're already at the beginning.
     return false;
@@ -39,17 +151,13 @@ bool CamParser::HttpResponseConsumed() {
 }
 
 bool CamParser::MultipartConsumed() {
-  std::vector<uint8_t> line;
+  Line line;
   if (!ConsumeHeaderLine(&line)) {
     return false;
   }
 
-  // This is to make sscanf happy -- it needs a null-terminated string.
-  line.push_back('\0');
-
   int matched = std::sscanf(
-      reinterpret_cast<const char *>(line.data()),
-      "Content-Type: multipart/x-mixed-replace;boundary=%255s\r\n",
+      line.data(), "Content-Type: multipart/x-mixed-replace;boundary=%255s\r\n",
       parsed_.boundary);
   if ((matched == 0)) {
     return false;
@@ -58,16 +166,13 @@ bool CamParser::MultipartConsumed() {
 }
 
 bool CamParser::FramerateConsumed() {
-  std::vector<uint8_t> line;
+  Line line;
   if (!ConsumeHeaderLine(&line)) {
     return false;
   }
 
-  // This is to make sscanf happy -- it needs a null-terminated string.
-  line.push_back('\0');
-
-  int matched = std::sscanf(reinterpret_cast<const char *>(line.data()),
-                            "X-Framerate: %i\r\n", &parsed_.frame_rate);
+  int matched =
+      std::sscanf(line.data(), "X-Framerate: %i\r\n", &parsed_.frame_rate);
   if ((matched == 0)) {
     return false;
   }
@@ -75,44 +180,36 @@ bool CamParser::FramerateConsumed() {
 }
 
 bool CamParser::SeparatorConsumed() {
-  std::vector<uint8_t> line;
+  Line line;
   if (!ConsumeLine(&line)) {
     // If there's no more lines available in the current chunk, mark it as
     // invalid and wait for a new chunk.
     std::cerr << "Was looking for separator, but couldn't find in current "
                  "chunk. Waiting for next chunk. This should never happen."
               << std::endl;
-    chunk_.clear();
+    DiscardChunk();
     return false;
   }
 
-  // This is to make sscanf happy -- it needs a null-terminated string.
-  line.push_back('\0');
-
   char boundary[256];
-  int matched = std::sscanf(reinterpret_cast<const char *>(line.data()),
-                            "--%255s\r\n", boundary);
+  int matched = std::sscanf(line.data(), "--%255s\r\n", boundary);
   return ((matched != 0) && (strncmp(boundary, parsed_.boundary, 256) == 0));
 }
 
 bool CamParser::JpegContentTypeConsumed() {
-  std::vector<uint8_t> line;
+  Line line;
   if (!ConsumeLine(&line)) {
     // If there's no more lines available in the current chunk, mark it as
     // invalid and wait for a new chunk.
     std::cerr << "Was looking for JpegContentType, but couldn't find in current "
                  "chunk. Waiting for next chunk. This should never happen."
               << std::endl;
-    chunk_.clear();
+    DiscardChunk();
     return false;
   }
 
-  // This is to make sscanf happy -- it needs a null-terminated string.
-  line.push_back('\0');
-
   char content_type[11];
-  int matched = std::sscanf(reinterpret_cast<const char *>(line.data()),
-                            "Content-Type: %10s\r\n", content_type);
+  int matched = std::sscanf(line.data(), "Content-Type: %10s\r\n", content_type);
   char expected_content_type[] = "image/jpeg";
   if (matched == 0) {
     return false;
@@ -132,22 +229,19 @@ void CamParser::RewindToSeparator() {
 }
 
 bool CamParser::ContentLengthConsumed() {
-  std::vector<uint8_t> line;
+  Line line;
   if (!ConsumeLine(&line)) {
     // If there's no more lines available in the current chunk, mark it as
     // invalid and wait for a new chunk.
     std::cerr << "Was looking for ContentLength, but couldn't find in current "
                  "chunk. Waiting for next chunk. This should never happen."
               << std::endl;
-    chunk_.clear();
+    DiscardChunk();
     return false;
   }
 
-  // This is to make sscanf happy -- it needs a null-terminated string.
-  line.push_back('\0');
-
-  int matched = std::sscanf(reinterpret_cast<const char *>(line.data()),
-                            "Content-Length: %i\r\n", &parsed_.jpeg_length);
+  int matched = std::sscanf(line.data(), "Content-Length: %i\r\n",
+                            &parsed_.jpeg_length);
   if (matched == 0) {
     return false;
   }
@@ -161,88 +255,134 @@ bool CamParser::ContentLengthConsumed() {
 }
 
 bool CamParser::EndOfHeaderConsumed() {
-  std::lock_guard<std::mutex> guard(lock_);
-  std::vector<uint8_t> end_of_header = {0xd, 0xa};
-  auto iter = std::search(in_buffer_.begin(), in_buffer_.end(), end_of_header.begin(), end_of_header.end());
-  if (iter == in_buffer_.end()) {
+  const size_t len = LineLength(in_buffer_.Readable());
+  if (len == 0) {
     return false;
   }
 
-  // Now that we've extracted the bytes, suck them out of in_buffer_.
-  std::string end_of_header_str(in_buffer_.begin(), iter + 4);
-  in_buffer_.erase(in_buffer_.begin(), iter + 2);
+  // Now that we've found the end of the header, suck it out of in_buffer_.
+  in_buffer_.Consume(len);
   return true;
 }
 
 bool CamParser::EndOfMultipartHeaderConsumed() {
-  std::vector<uint8_t> end_of_header = {0xd, 0xa, 0xd, 0xa};
-  auto iter = std::search(chunk_.begin(), chunk_.end(), end_of_header.begin(), end_of_header.end());
-  if (iter == chunk_.end()) {
+  static constexpr uint8_t kEndOfHeader[] = {0xd, 0xa, 0xd, 0xa};
+  const ByteSpan chunk = Chunk();
+  auto iter = std::search(chunk.begin(), chunk.end(), std::begin(kEndOfHeader),
+                          std::end(kEndOfHeader));
+  if (iter == chunk.end()) {
     return false;
   }
 
-  // Now that we've extracted the bytes, suck them out of chunk_.
-  chunk_.erase(chunk_.begin(), iter + 4);
+  // The ESP32 firmware sends the capture time as the last part header line.
+  Line line;
+  CopyLine(chunk.subspan(0, iter - chunk.begin()), &line);
+  int64_t seconds = 0;
+  // The fraction is read as digits, since it isn't necessarily zero-padded:
+  // ".5" is half a second. Digits past microseconds are dropped.
+  char fraction[7] = {};
+  if (std::sscanf(line.data(), "X-Timestamp: %" SCNd64 ".%6[0-9]", &seconds,
+                  fraction) == 2) {
+    int64_t micros = std::strtoll(fraction, nullptr, 10);
+    for (size_t digits = std::strlen(fraction); digits < 6; ++digits) {
+      micros *= 10;
+    }
+    parsed_.capture_timestamp_us = seconds * 1000000 + micros;
+  } else {
+    parsed_.capture_timestamp_us = -1;
+  }
+
+  // Now that we've found the end of the header, suck it out of the chunk.
+  ConsumeChunk((iter + sizeof(kEndOfHeader)) - chunk.begin());
   return true;
 }
 
 bool CamParser::JpegConsumed() {
-  if (chunk_.size() < ((size_t)parsed_.jpeg_length)) {
+  const ByteSpan chunk = Chunk();
+  if (chunk.size < ((size_t)parsed_.jpeg_length)) {
     std::cerr << "Chunk received is much smaller than expected JPEG image. "
                  "This shouldn't really happen. Waiting for next chunk."
               << std::endl;
-    chunk_.clear();
+    DiscardChunk();
     return false;
   }
-  std::lock_guard<std::mutex> guard(lock_);
-  images_.push({.image = {chunk_.begin(), chunk_.begin() + parsed_.jpeg_length},
-                .size = (size_t)parsed_.jpeg_length,
-                .index = 0});
-  chunk_.erase(chunk_.begin(), chunk_.begin() + parsed_.jpeg_length);
+  if (images_.size() >= options_.max_images) {
+    switch (options_.overflow_policy) {
+      case OverflowPolicy::kDropOldest:
+        images_.pop();
+        queue_stats_.dropped_oldest++;
+        break;
+      case OverflowPolicy::kDropNewest:
+        ConsumeChunk(parsed_.jpeg_length);
+        queue_stats_.dropped_newest++;
+        return true;
+      case OverflowPolicy::kBlock:
+        // Leave the JPEG in the input buffer and try again once there's room.
+        if (!stalled_) {
+          queue_stats_.stalls++;
+        }
+        stalled_ = true;
+        return false;
+    }
+  }
+  stalled_ = false;
+  // This is the only copy the JPEG payload takes through the parser.
+  BufferPool::Buffer data = frame_pool_.Acquire(parsed_.jpeg_length);
+  std::memcpy(data->data(), chunk.data, parsed_.jpeg_length);
+  FrameTrace trace;
+  trace.socket_read = frame_start_time_;
+  trace.parsed = FrameTrace::Clock::now();
+  images_.push({.data = std::move(data),
+                .capture_timestamp_us = parsed_.capture_timestamp_us,
+                .trace = trace});
+  ConsumeChunk(parsed_.jpeg_length);
+  images_parsed_++;
   return true;
 }
 
-bool CamParser::ConsumeHeaderLine(std::vector<uint8_t> *value) {
-  // Look for \r.
-  std::lock_guard<std::mutex> guard(lock_);
-  auto iter = std::find(in_buffer_.begin(), in_buffer_.end(), '\r');
-  if (iter == in_buffer_.end()) {
-    return false;
-  }
-  // Look for \n after the \r.
-  iter++;
-  if ((iter == in_buffer_.end()) || (*iter != '\n')) {
+bool CamParser::ConsumeHeaderLine(Line *value) {
+  const ByteSpan bytes = in_buffer_.Readable();
+  const size_t len = LineLength(bytes);
+  if (len == 0) {
     return false;
   }
 
-  // The + 1 at the end is so that the newline gets inserted into value.
-  value->insert(value->end(), in_buffer_.begin(), iter + 1); 
+  // The trailing \r\n gets copied into value.
+  CopyLine(bytes.subspan(0, len), value);
   // Now that we've extracted the bytes, suck them out of in_buffer_.
-  in_buffer_.erase(in_buffer_.begin(), iter + 1);
+  in_buffer_.Consume(len);
   return true;
 }
 
-bool CamParser::ConsumeLine(std::vector<uint8_t> *value) {
-  // Look for \r.
-  auto iter = std::find(chunk_.begin(), chunk_.end(), '\r');
-  if (iter == chunk_.end()) {
-    return false;
-  }
-  // Look for \n after the \r.
-  iter++;
-  if ((iter == chunk_.end()) || (*iter != '\n')) {
+bool CamParser::ConsumeLine(Line *value) {
+  const ByteSpan chunk = Chunk();
+  const size_t len = LineLength(chunk);
+  if (len == 0) {
     return false;
   }
 
-  // The + 1 at the end is so that the newline gets inserted into value.
-  value->insert(value->end(), chunk_.begin(), iter + 1); 
-  // Now that we've extracted the bytes, suck them out of in_buffer_.
-  chunk_.erase(chunk_.begin(), iter + 1);
+  // The trailing \r\n gets copied into value.
+  CopyLine(chunk.subspan(0, len), value);
+  // Now that we've extracted the bytes, suck them out of the chunk.
+  ConsumeChunk(len);
   return true;
 }
 
+ByteSpan CamParser::Chunk() const {
+  return in_buffer_.Readable().subspan(0, chunk_size_);
+}
+
+void CamParser::ConsumeChunk(size_t len) {
+  assert(len <= chunk_size_);
+  in_buffer_.Consume(len);
+  chunk_size_ -= len;
+}
+
+void CamParser::DiscardChunk() {
+  ConsumeChunk(chunk_size_);
+}
+
 bool CamParser::WaitingForChunk() {
-  std::lock_guard<std::mutex> guard(lock_);
   switch (state_) {
     case HTTP_RESPONSE:
     case MULTIPART:
@@ -253,29 +393,42 @@ bool CamParser::WaitingForChunk() {
       break;
   }
 
-  if (next_chunk_size_ != -1) {
-    if (in_buffer_.size() < (size_t)next_chunk_size_) {
-      return true;
-    }
+  if (skip_bytes_ > 0) {
+    const size_t skipped = std::min(skip_bytes_, in_buffer_.size());
+    in_buffer_.Consume(skipped);
+    skip_bytes_ -= skipped;
+    return true;
+  }
 
+  if (next_chunk_size_ != -1) {
     if (next_chunk_size_ == 0) {
       state_ = ZERO_CHUNK_FOUND;
+      next_chunk_size_ = -1;
       return false;
     }
 
-    // Move to chunk_, clear in_buffer_, and return false.
-    chunk_.resize(next_chunk_size_);
-    auto chunk_end = in_buffer_.begin() + next_chunk_size_;
-    std::copy(in_buffer_.begin(), chunk_end, chunk_.begin());
-    in_buffer_.erase(in_buffer_.begin(), chunk_end);
+    if (in_buffer_.size() < (size_t)next_chunk_size_) {
+      return true;
+    }
+
+    // The chunk is now fully buffered. No need to move it anywhere.
+    chunk_size_ = next_chunk_size_;
     next_chunk_size_ = -1;
     return false;
   }
 
+  const ByteSpan bytes = in_buffer_.Readable();
+  if (bytes.empty()) {
+    return true;
+  }
+
   // \r\n is expected at the beginning of all chunks (except the first).
-  auto iter = in_buffer_.begin();
+  auto iter = bytes.begin();
   if (*iter == '\r') {
     iter++;
+    if (iter == bytes.end()) {
+      return true;
+    }
     if (*iter != '\n')  {
       // Invalid byte. Error and drop byte.
       std::cerr << "Invalid byte found at beginning of chunk size. Expected: "
@@ -287,10 +440,10 @@ bool CamParser::WaitingForChunk() {
   }
 
   // Consume chunk size. Interpret in hex.
-  auto end_of_size = std::find(iter, in_buffer_.end(), '\r');
-  if ((end_of_size == in_buffer_.end()) || (end_of_size + 1 == in_buffer_.end())) {
+  auto end_of_size = std::find(iter, bytes.end(), '\r');
+  if ((end_of_size == bytes.end()) || (end_of_size + 1 == bytes.end())) {
     // Not enough bytes yet. Wait for chunk.
-		return true;
+    return true;
   }
   if (*(end_of_size + 1) != '\n') {
     // Log an error,
@@ -299,28 +452,48 @@ bool CamParser::WaitingForChunk() {
                static_cast<char>(*(end_of_size + 1))
         << std::endl;
   }
-	size_t size_of_size = end_of_size - iter;
-  // If the size field is really big, then just fail because that's too much.	
-	assert(size_of_size < 128);
-	std::vector<uint8_t> size_hex({iter, end_of_size});
-  // Add a null byte to make it a proper C string. I wish C++ included a
-  // standard function like strntol so that we didn't need to do this. Instead
-  // all we get is the unsafe strtol, which forces you to use C-strings.
-  size_hex.push_back(0);
-
-  std::string chunk_size_str(size_hex.begin(), size_hex.end());
-  strtol(chunk_size_str.c_str(), nullptr, 16);
-  int chunk_size = strtol(reinterpret_cast<char *>(size_hex.data()), nullptr, 16);
+  size_t size_of_size = end_of_size - iter;
+  // If the size field is really big, then just fail because that's too much.
+  assert(size_of_size < 128);
+  // Copy into a null-terminated buffer. I wish C++ included a standard function
+  // like strntol so that we didn't need to do this. Instead all we get is the
+  // unsafe strtol, which forces you to use C-strings.
+  char size_hex[128];
+  std::memcpy(size_hex, iter, size_of_size);
+  size_hex[size_of_size] = '\0';
+  int chunk_size = strtol(size_hex, nullptr, 16);
+  in_buffer_.Consume((end_of_size + 2) - bytes.begin());
+
+  if ((size_t)chunk_size > in_buffer_.capacity()) {
+    // The chunk could never be fully buffered. Drop it on the floor and resync
+    // on the next separator.
+    std::cerr << "Chunk of " << chunk_size << " bytes doesn't fit in the "
+              << in_buffer_.capacity() << " byte input buffer. Skipping it."
+              << std::endl;
+    skip_bytes_ = chunk_size;
+    RewindToSeparator();
+    return true;
+  }
   next_chunk_size_ = chunk_size;
-  in_buffer_.erase(in_buffer_.begin(), end_of_size + 2);
   return true;
 }
 
-// Call to drive parsing.
-bool CamParser::Poll() {
-  if (chunk_.size() == 0) {
+void CamParser::Advance() {
+  while (Step()) {
+  }
+}
+
+bool CamParser::Step() {
+  const auto state = state_;
+  const size_t buffered = in_buffer_.size();
+  const size_t chunk_size = chunk_size_;
+  const int next_chunk_size = next_chunk_size_;
+
+  if (chunk_size_ == 0) {
     if (WaitingForChunk()) {
-      return true;
+      // Still progress if a chunk size was parsed or bytes were skipped.
+      return (buffered != in_buffer_.size()) ||
+             (next_chunk_size != next_chunk_size_);
     }
   }
   switch (state_) {
@@ -346,8 +519,9 @@ bool CamParser::Poll() {
       break;
     case SEPARATOR:
       if (SeparatorConsumed()) {
+        frame_start_time_ = insert_time_;
         state_ = JPEG_CONTENT_TYPE;
-        chunk_.clear();
+        DiscardChunk();
       }
       break;
     case JPEG_CONTENT_TYPE:
@@ -363,7 +537,7 @@ bool CamParser::Poll() {
     case END_OF_MULTIPART_HEADER:
       if (EndOfMultipartHeaderConsumed())  {
         state_ = CONSUME_JPEG;
-        chunk_.clear();
+        DiscardChunk();
       } else {
         // If there's no more lines available in the current chunk, mark it as
         // invalid and wait for a new chunk.
@@ -371,7 +545,7 @@ bool CamParser::Poll() {
                      "in current chunk. Waiting for next chunk. This should "
                      "never happen."
                   << std::endl;
-        chunk_.clear();
+        DiscardChunk();
       }
       break;
     case CONSUME_JPEG:
@@ -382,30 +556,32 @@ bool CamParser::Poll() {
       break;
     case ZERO_CHUNK_FOUND:
       state_ = HTTP_RESPONSE;
+      stream_ended_ = true;
       std::cerr << "ZERO_CHUNK_FOUND!" << std::endl;
       return false;
   }
-  return true;
+  return (state != state_) || (buffered != in_buffer_.size()) ||
+         (chunk_size != chunk_size_) || (next_chunk_size != next_chunk_size_);
 }
 
-// Must be called until returns a value < len in order to confirm image has
-// been fully retrieved. Image will be in JPEG binary format.
-size_t CamParser::RetrieveJpeg(uint8_t *data, size_t len) {
-  std::lock_guard<std::mutex> guard(lock_);
-  if (images_.size() == 0) {
-    // No image, return false.
-    return 0;
-  }
-  size_t bytes_remaining = images_.front().size - images_.front().index;
-  if (bytes_remaining == 0) {
-    // Clear out this image and return 0.
-    images_.pop();
-    return 0;
-  }
-  size_t bytes = std::min(len, bytes_remaining);
-  memcpy(data, images_.front().image.data() + images_.front().index, bytes);
-  images_.front().index += bytes;
-  return bytes;
+bool CamParser::RetrieveFrame(JpegFrame *frame) {
+  std::unique_lock<std::mutex> lock(lock_);
+  if (images_.empty()) {
+    return false;
+  }
+  *frame = std::move(images_.front());
+  images_.pop();
+  if (!stalled_) {
+    return true;
+  }
+  // There's room for the JPEG parsing stalled on now.
+  Advance();
+  image_retrieved_.notify_one();
+  lock.unlock();
+  if (unstall_callback_) {
+    unstall_callback_();
+  }
+  return true;
 }
 
 }  // namespace cam
@@ -1,37 +1,120 @@
 #ifndef CAM_PARSER_H
 #define CAM_PARSER_H
 
+#include "host/buffer_pool.h"
+#include "host/frame_trace.h"
+#include "host/slab_buffer.h"
+
 #include <algorithm>
-#include <thread>
+#include <array>
+#include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <vector>
 #include <queue>
-#include <deque>
 
 
 namespace cam {
 
-// This class is threadsafe, so you can create another thread in the background
-// which calls Poll() a lot.
+// A complete JPEG handed out by CamParser. The buffer goes back to the parser's
+// pool when the frame is destroyed, and may outlive the parser.
+struct JpegFrame {
+  BufferPool::Buffer data;
+  // Microseconds since the camera booted, from the X-Timestamp part header. -1
+  // if the camera didn't send one.
+  int64_t capture_timestamp_us = -1;
+  // The parser fills in socket_read and parsed. Later stages add their own.
+  FrameTrace trace;
+
+  const uint8_t *bytes() const { return data->data(); }
+  size_t size() const { return data->size(); }
+};
+
+// Push-style parser. Bytes are parsed as far as possible as soon as they're fed
+// in, so there's no need for a thread driving it. Images may be retrieved from
+// a different thread than the one feeding bytes in.
 class CamParser {
   public:
-    CamParser() : state_(HTTP_RESPONSE), parsed_{} {}
+    // What to do with a newly parsed image when the image queue is full.
+    enum class OverflowPolicy {
+      // Drop the oldest queued image to make room.
+      kDropOldest = 0,
+      // Drop the new image.
+      kDropNewest,
+      // Stop parsing until an image is retrieved, which picks parsing back up
+      // on the retrieving thread. Meanwhile the input buffer fills up: Feed()
+      // blocks once it's full, and PrepareInsert() returns an empty region, in
+      // which case the caller should stop reading from the socket so that TCP
+      // flow control pushes back on the camera.
+      kBlock,
+    };
+
+    struct Options {
+      // Large enough to hold a full UXGA JPEG chunk with plenty of headroom.
+      size_t buffer_capacity = 4 * 1024 * 1024;  // 4MB.
+      // Most parsed images kept waiting to be retrieved.
+      size_t max_images = 8;
+      OverflowPolicy overflow_policy = OverflowPolicy::kDropOldest;
+    };
+
+    struct QueueStats {
+      size_t dropped_oldest = 0;
+      size_t dropped_newest = 0;
+      // Times parsing stalled on a full queue under kBlock.
+      size_t stalls = 0;
+    };
+
+    CamParser() : CamParser(Options()) {}
+    explicit CamParser(const Options &options);
 
     CamParser(const CamParser &rhs) = delete;
 
-    void InsertBinary(const uint8_t *data, size_t len);
-    bool IsImageAvailable();
+    // Parses all of |data|. Returns the number of images completed.
+    size_t Feed(const uint8_t *data, size_t len);
+
+    // Zero-copy alternative to Feed(). Returns a region of the input buffer (at
+    // most |max_len| bytes) which the caller may read a socket directly into,
+    // followed by a call to CommitInsert() with the number of bytes actually
+    // written. CommitInsert() parses those bytes and returns the number of
+    // images completed. Only one thread may insert at a time. The region is
+    // only ever empty while Stalled().
+    MutableByteSpan PrepareInsert(size_t max_len);
+    size_t CommitInsert(size_t len);
+
+    // True while parsing is held up by a full image queue under kBlock.
+    bool Stalled();
 
-    // Call to drive parsing.
-    bool Poll();
+    // True once the camera has ended the stream (sent a zero-length chunk), or
+    // sent something the parser couldn't make sense of. The connection should
+    // be re-established and Reset() called.
+    bool StreamEnded();
 
-    // Must be called until returns a value < len in order to confirm image has
-    // been fully retrieved. Image will be in the format RGB.
-    size_t RetrieveJpeg(uint8_t *data, size_t len);
+    // Drops all buffered bytes and returns to waiting for an HTTP response.
+    // Images that were already parsed are kept.
+    void Reset();
+
+    bool IsImageAvailable();
+
+    // Moves the oldest parsed JPEG into |frame|. Returns false if there aren't
+    // any.
+    bool RetrieveFrame(JpegFrame *frame);
 
     size_t ImagesAvailable() const { return images_.size(); }
 
+    QueueStats queue_stats();
+
+    // Called on the retrieving thread whenever retrieving an image unstalls
+    // parsing, so that whoever stopped reading the socket can pick it back up.
+    // Set it before any images are retrieved.
+    void SetUnstallCallback(std::function<void()> callback) {
+      unstall_callback_ = std::move(callback);
+    }
+
   private:
+    // Header lines longer than this are truncated before being matched.
+    static constexpr size_t kMaxLineLength = 512;
+    using Line = std::array<char, kMaxLineLength>;
+
     enum {
       HTTP_RESPONSE = 0,
       MULTIPART,
@@ -53,8 +136,20 @@ class CamParser {
       char boundary[256];
       int frame_rate;
       int jpeg_length;
+      int64_t capture_timestamp_us;
     } parsed_;
 
+    // Everything below expects lock_ to be held.
+
+    // Runs Step() until it stops making progress.
+    void Advance();
+    // Advances the state machine by one state. Returns false if no progress
+    // could be made with the bytes buffered so far.
+    bool Step();
+    // Gives up on the stream after the input buffer filled up with bytes that
+    // couldn't be parsed.
+    void AbandonStream();
+
     bool HttpResponseConsumed();
     bool MultipartConsumed();
     bool FramerateConsumed();
@@ -67,21 +162,39 @@ class CamParser {
 
     bool WaitingForChunk();
 
-    bool ConsumeHeaderLine(std::vector<uint8_t> *value);
-    bool ConsumeLine(std::vector<uint8_t> *value);
+    bool ConsumeHeaderLine(Line *value);
+    bool ConsumeLine(Line *value);
     void RewindToSeparator();
 
-    std::mutex lock_;
-
-    struct Image {
-      std::vector<uint8_t> image;
-      size_t size;
-      size_t index;
-    };
-    std::queue<Image> images_;
+    // The current chunk is always the first chunk_size_ bytes of in_buffer_.
+    // It's a view rather than a copy so that a JPEG only gets copied once, on
+    // its way into a frame buffer.
+    ByteSpan Chunk() const;
+    void ConsumeChunk(size_t len);
+    void DiscardChunk();
 
-    std::deque<uint8_t> in_buffer_;
-    std::vector<uint8_t> chunk_;
+    std::mutex lock_;
+    // Signaled when retrieving an image unstalls parsing, to wake Feed().
+    std::condition_variable image_retrieved_;
+    std::function<void()> unstall_callback_;
+    Options options_;
+    QueueStats queue_stats_;
+
+    BufferPool frame_pool_;
+    std::queue<JpegFrame> images_;
+
+    SlabBuffer in_buffer_;
+    size_t chunk_size_ = 0;
+    // Bytes left to drop from a chunk too large to fit in in_buffer_.
+    size_t skip_bytes_ = 0;
+    bool stream_ended_ = false;
+    // When the bytes being parsed were inserted, and when the current frame's
+    // first bytes were.
+    FrameTrace::Clock::time_point insert_time_;
+    FrameTrace::Clock::time_point frame_start_time_;
+    // Set when a JPEG couldn't be queued under kBlock.
+    bool stalled_ = false;
+    size_t images_parsed_ = 0;
 };
 
 }  // namespace cam
@@ -0,0 +1,57 @@
+// Feeds a synthetic ESP32-style MJPEG-over-chunked-HTTP stream through
+// CamParser on a single thread and reports parser throughput.
+//
+// Usage: cam_parser_benchmark [frames] [jpeg_bytes] [read_bytes]
+
+#include "host/cam_parser.h"
+#include "host/mjpeg_stream.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace {
+
+// Builds the byte stream the ESP32 camera demo firmware sends for |frames|
+// frames of |jpeg_bytes| bytes each.
+std::string BuildStream(int frames, size_t jpeg_bytes) {
+  std::string stream = cam::StreamHeader();
+  const std::string jpeg = cam::RandomPayload(jpeg_bytes);
+  for (int i = 0; i < frames; ++i) {
+    stream += cam::FrameChunks(jpeg, i);
+  }
+  return stream;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int frames = (argc > 1) ? atoi(argv[1]) : 2000;
+  const size_t jpeg_bytes = (argc > 2) ? atoi(argv[2]) : 80 * 1024;
+  const size_t read_bytes = (argc > 3) ? atoi(argv[3]) : 16 * 1024;
+
+  const std::string stream = BuildStream(frames, jpeg_bytes);
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(stream.data());
+
+  cam::CamParser parser;
+  int frames_parsed = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t offset = 0; offset < stream.size();) {
+    const size_t len = std::min(read_bytes, stream.size() - offset);
+    parser.Feed(data + offset, len);
+    offset += len;
+    cam::JpegFrame frame;
+    while (parser.RetrieveFrame(&frame)) {
+      frames_parsed++;
+    }
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  const double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << "Parsed " << frames_parsed << "/" << frames << " frames ("
+            << stream.size() << " bytes) in " << seconds << "s" << std::endl;
+  std::cout << "Throughput: " << stream.size() / seconds / (1024 * 1024)
+            << " MB/s, " << frames_parsed / seconds << " frames/s" << std::endl;
+  return (frames_parsed == frames) ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include "host/camera_config.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace cam {
+
+namespace {
+
+// Parses one of the optional "key=value" fields after the port.
+bool ParseOption(const std::string &option, CameraConfig *camera) {
+  Region region;
+  char trailing;
+  if (std::sscanf(option.c_str(), "roi=%f,%f,%f,%f%c", &region.x, &region.y,
+                  &region.width, &region.height, &trailing) == 4) {
+    if ((region.x < 0) || (region.y < 0) || (region.width <= 0) ||
+        (region.height <= 0) || (region.x + region.width > 1) ||
+        (region.y + region.height > 1)) {
+      return false;
+    }
+    camera->regions.push_back(region);
+    return true;
+  }
+  if (std::sscanf(option.c_str(), "tiles=%dx%d%c", &camera->tiles_x,
+                  &camera->tiles_y, &trailing) == 2) {
+    return (camera->tiles_x > 0) && (camera->tiles_y > 0);
+  }
+  return false;
+}
+
+}  // namespace
+
+std::vector<Region> CameraConfig::DetectionCrops(float tile_overlap) const {
+  std::vector<Region> crops;
+  for (const Region &region :
+       regions.empty() ? std::vector<Region>{Region()} : regions) {
+    for (const Region &tile :
+         TileRegion(region, tiles_x, tiles_y, tile_overlap)) {
+      crops.push_back(tile);
+    }
+  }
+  return crops;
+}
+
+bool LoadCameraConfigs(const std::string &path,
+                       std::vector<CameraConfig> *cameras) {
+  std::ifstream config_file(path.c_str());
+  if (!config_file.good()) {
+    std::cerr << "Invalid camera config file: " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(config_file, line)) {
+    line_number++;
+    std::istringstream fields(line);
+    CameraConfig camera;
+    if (!(fields >> camera.name) || camera.name[0] == '#') {
+      continue;
+    }
+    if (!(fields >> camera.address >> camera.port)) {
+      std::cerr << path << ":" << line_number
+                << ": expected \"name address port\", got: " << line
+                << std::endl;
+      return false;
+    }
+    std::string option;
+    while (fields >> option) {
+      if (!ParseOption(option, &camera)) {
+        std::cerr << path << ":" << line_number << ": invalid option \""
+                  << option << "\"" << std::endl;
+        return false;
+      }
+    }
+    cameras->push_back(camera);
+  }
+  return true;
+}
+
+}  // namespace cam
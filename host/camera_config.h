@@ -0,0 +1,44 @@
+#ifndef CAMERA_CONFIG_H
+#define CAMERA_CONFIG_H
+
+#include "host/region.h"
+
+#include <string>
+#include <vector>
+
+namespace cam {
+
+struct CameraConfig {
+  // Used to label the camera in the UI and in saved file names. May be empty.
+  std::string name;
+  std::string address;
+  int port = 0;
+  // Detection only looks inside these. Empty means the whole frame.
+  std::vector<Region> regions;
+  // Splits each region (or the whole frame) into a grid of tiles, each of
+  // which is run through the network at its full input resolution. Finds
+  // smaller objects, at the cost of a batch slot per tile.
+  int tiles_x = 1;
+  int tiles_y = 1;
+
+  // The crops detection runs on: every region, tiled.
+  std::vector<Region> DetectionCrops(float tile_overlap) const;
+};
+
+// Loads camera configs from a file with one camera per line:
+//
+//   # name  address        port  [options]
+//   kitchen 192.168.1.104  81
+//   hallway 192.168.1.105  81    roi=0.5,0,0.5,0.6 tiles=2x2
+//
+// roi=x,y,width,height (in fractions of the frame) may be given any number of
+// times. tiles=COLUMNSxROWS tiles every region.
+//
+// Blank lines and lines starting with # are ignored. Returns false (and logs
+// why) if the file can't be read or a line is malformed.
+bool LoadCameraConfigs(const std::string &path,
+                       std::vector<CameraConfig> *cameras);
+
+}  // namespace cam
+
+#endif // CAMERA_CONFIG_H
@@ -0,0 +1,409 @@
+#include "host/connection_manager.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace cam {
+
+namespace {
+
+constexpr auto kConnectTimeout = std::chrono::seconds(5);
+// The camera sends frames continuously, so this much silence means the
+// connection is dead even if TCP hasn't noticed yet.
+constexpr auto kIdleTimeout = std::chrono::seconds(10);
+constexpr auto kInitialBackoff = std::chrono::milliseconds(250);
+constexpr auto kMaxBackoff = std::chrono::seconds(8);
+
+constexpr size_t kReadSize = 16 * 1024;  // 16 KB.
+// Bound the reads per wakeup so that one busy camera can't starve the rest.
+// epoll is level-triggered, so whatever's left gets picked up next time.
+constexpr int kMaxReadsPerEvent = 8;
+constexpr int kMaxEvents = 64;
+
+// Identify the eventfds in epoll_event.data, which otherwise holds the camera
+// index.
+constexpr uint64_t kStopToken = ~0ull;
+constexpr uint64_t kResumeToken = ~0ull - 1;
+constexpr uint64_t kResolvedToken = ~0ull - 2;
+
+void Signal(int fd) {
+  const uint64_t one = 1;
+  if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+    std::cerr << "Could not wake connection manager: " << strerror(errno)
+              << std::endl;
+  }
+}
+
+}  // namespace
+
+ConnectionManager::ConnectionManager(std::vector<CameraConfig> cameras,
+                                     const CamParser::Options &parser_options) {
+  for (auto &config : cameras) {
+    Connection connection;
+    connection.config = std::move(config);
+    connection.parser = std::make_unique<CamParser>(parser_options);
+    connection.deadline = Clock::now();
+    connections_.push_back(std::move(connection));
+  }
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  resume_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  resolved_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ((epoll_fd_ == -1) || (stop_fd_ == -1) || (resume_fd_ == -1) ||
+      (resolved_fd_ == -1)) {
+    std::cerr << "Could not create epoll reactor: " << strerror(errno)
+              << std::endl;
+    std::exit(1);
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = kStopToken;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &event);
+  event.data.u64 = kResumeToken;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, resume_fd_, &event);
+  event.data.u64 = kResolvedToken;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, resolved_fd_, &event);
+  for (auto &connection : connections_) {
+    connection.parser->SetUnstallCallback([this]() { Signal(resume_fd_); });
+  }
+  resolver_thread_ = std::thread([this]() { ResolverLoop(); });
+}
+
+ConnectionManager::~ConnectionManager() {
+  {
+    std::lock_guard<std::mutex> guard(resolver_lock_);
+    resolver_done_ = true;
+  }
+  resolve_requested_.notify_one();
+  // Waits out any lookup in progress.
+  resolver_thread_.join();
+  for (auto &connection : connections_) {
+    if (connection.fd != -1) {
+      close(connection.fd);
+    }
+  }
+  close(stop_fd_);
+  close(resume_fd_);
+  close(resolved_fd_);
+  close(epoll_fd_);
+}
+
+void ConnectionManager::Run() {
+  epoll_event events[kMaxEvents];
+  while (true) {
+    const int timeout_ms = HandleDeadlines();
+    const int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+    if (num_events == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+      return;
+    }
+    for (int i = 0; i < num_events; ++i) {
+      if (events[i].data.u64 == kStopToken) {
+        return;
+      }
+      if (events[i].data.u64 == kResumeToken) {
+        uint64_t count;
+        if (read(resume_fd_, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+          std::cerr << "Could not read resume wakeup: " << strerror(errno)
+                    << std::endl;
+        }
+        for (size_t camera = 0; camera < connections_.size(); ++camera) {
+          if (connections_[camera].paused) {
+            TryResume(camera);
+          }
+        }
+        continue;
+      }
+      if (events[i].data.u64 == kResolvedToken) {
+        HandleResolved();
+        continue;
+      }
+      const size_t camera = events[i].data.u64;
+      switch (connections_[camera].state) {
+        case Connection::CONNECTING:
+          FinishConnect(camera);
+          break;
+        case Connection::STREAMING:
+          if (events[i].events & EPOLLIN) {
+            ReadAvailable(camera);
+          } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            Disconnect(camera, "socket error");
+          }
+          break;
+        case Connection::DISCONNECTED:
+        case Connection::RESOLVING:
+          break;
+      }
+    }
+  }
+}
+
+void ConnectionManager::Stop() { Signal(stop_fd_); }
+
+void ConnectionManager::StartConnect(size_t camera) {
+  Connection &connection = connections_[camera];
+  connection.state = Connection::RESOLVING;
+  connection.deadline = Clock::now() + kConnectTimeout;
+  {
+    std::lock_guard<std::mutex> guard(resolver_lock_);
+    // A lookup which timed out may still be waiting its turn.
+    if (std::find(to_resolve_.begin(), to_resolve_.end(), camera) !=
+        to_resolve_.end()) {
+      return;
+    }
+    to_resolve_.push_back(camera);
+  }
+  resolve_requested_.notify_one();
+}
+
+void ConnectionManager::HandleResolved() {
+  uint64_t count;
+  if (read(resolved_fd_, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+    std::cerr << "Could not read resolver wakeup: " << strerror(errno)
+              << std::endl;
+  }
+  std::vector<Resolved> resolved;
+  {
+    std::lock_guard<std::mutex> guard(resolver_lock_);
+    resolved.swap(resolved_);
+  }
+  for (const Resolved &result : resolved) {
+    // Lookups which finished after timing out are stale.
+    if (connections_[result.camera].state != Connection::RESOLVING) {
+      continue;
+    }
+    if (!result.ok) {
+      Disconnect(result.camera, "could not resolve address");
+      continue;
+    }
+    Connect(result.camera, result.address);
+  }
+}
+
+void ConnectionManager::Connect(size_t camera, const sockaddr_in &address) {
+  Connection &connection = connections_[camera];
+  connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (connection.fd == -1) {
+    Disconnect(camera, strerror(errno));
+    return;
+  }
+  const int result =
+      connect(connection.fd, reinterpret_cast<const sockaddr *>(&address),
+              sizeof(address));
+  if ((result == -1) && (errno != EINPROGRESS)) {
+    Disconnect(camera, strerror(errno));
+    return;
+  }
+
+  connection.state = Connection::CONNECTING;
+  connection.deadline = Clock::now() + kConnectTimeout;
+  epoll_event event{};
+  event.events = EPOLLOUT;
+  event.data.u64 = camera;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection.fd, &event);
+}
+
+void ConnectionManager::FinishConnect(size_t camera) {
+  Connection &connection = connections_[camera];
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+  getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+  if (error != 0) {
+    Disconnect(camera, strerror(error));
+    return;
+  }
+
+  const std::string request = "GET /stream HTTP/1.1\r\nHost: " +
+                              connection.config.address + ":" +
+                              std::to_string(connection.config.port) +
+                              "\r\n\r\n";
+  // The request is tiny, so a freshly connected socket always has room for it.
+  if (send(connection.fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+      static_cast<ssize_t>(request.size())) {
+    Disconnect(camera, "could not send request");
+    return;
+  }
+
+  std::cerr << "Connected to camera " << connection.config.name << " ("
+            << connection.config.address << ":" << connection.config.port
+            << ")." << std::endl;
+  connection.parser->Reset();
+  connection.state = Connection::STREAMING;
+  connection.deadline = Clock::now() + kIdleTimeout;
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = camera;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void ConnectionManager::ReadAvailable(size_t camera) {
+  Connection &connection = connections_[camera];
+  size_t images = 0;
+  for (int i = 0; i < kMaxReadsPerEvent; ++i) {
+    const MutableByteSpan region = connection.parser->PrepareInsert(kReadSize);
+    if (region.size == 0) {
+      // The parser is stalled on a full image queue. Leave the bytes in the
+      // socket until it has room.
+      Pause(camera);
+      break;
+    }
+    const ssize_t len = read(connection.fd, region.data, region.size);
+    if (len > 0) {
+      images += connection.parser->CommitInsert(len);
+      connection.deadline = Clock::now() + kIdleTimeout;
+      if (connection.parser->StreamEnded()) {
+        Disconnect(camera, "end of stream");
+        break;
+      }
+      continue;
+    }
+    if (len == 0) {
+      Disconnect(camera, "connection closed");
+    } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+      Disconnect(camera, strerror(errno));
+    }
+    break;
+  }
+  if (images > 0) {
+    connection.failures = 0;
+    if (frame_callback_) {
+      frame_callback_(camera);
+    }
+  }
+}
+
+void ConnectionManager::Disconnect(size_t camera, const char *reason) {
+  Connection &connection = connections_[camera];
+  if (connection.fd != -1) {
+    // Closing the socket also removes it from the epoll set.
+    close(connection.fd);
+    connection.fd = -1;
+  }
+  const auto backoff = std::min<Clock::duration>(
+      kInitialBackoff * (1 << std::min(connection.failures, 8)), kMaxBackoff);
+  connection.failures++;
+  connection.state = Connection::DISCONNECTED;
+  connection.paused = false;
+  connection.deadline = Clock::now() + backoff;
+  std::cerr << "Camera " << connection.config.name << " ("
+            << connection.config.address << ":" << connection.config.port
+            << ") disconnected: " << reason << ". Retrying in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(backoff)
+                   .count()
+            << "ms." << std::endl;
+}
+
+void ConnectionManager::Pause(size_t camera) {
+  Connection &connection = connections_[camera];
+  connection.paused = true;
+  // It's not the camera's fault that nobody's retrieving its images.
+  connection.deadline = Clock::time_point::max();
+  // Keep the socket registered so errors and hangups are still reported.
+  epoll_event event{};
+  event.events = 0;
+  event.data.u64 = camera;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void ConnectionManager::TryResume(size_t camera) {
+  Connection &connection = connections_[camera];
+  if (connection.parser->PrepareInsert(kReadSize).size == 0) {
+    return;
+  }
+  connection.paused = false;
+  connection.deadline = Clock::now() + kIdleTimeout;
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = camera;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event);
+  if (frame_callback_ && connection.parser->IsImageAvailable()) {
+    frame_callback_(camera);
+  }
+}
+
+int ConnectionManager::HandleDeadlines() {
+  const auto now = Clock::now();
+  for (size_t camera = 0; camera < connections_.size(); ++camera) {
+    Connection &connection = connections_[camera];
+    if (connection.deadline > now) {
+      continue;
+    }
+    switch (connection.state) {
+      case Connection::DISCONNECTED:
+        StartConnect(camera);
+        break;
+      case Connection::RESOLVING:
+        Disconnect(camera, "address lookup timed out");
+        break;
+      case Connection::CONNECTING:
+        Disconnect(camera, "connect timed out");
+        break;
+      case Connection::STREAMING:
+        Disconnect(camera, "no data received");
+        break;
+    }
+  }
+
+  auto next_deadline = Clock::time_point::max();
+  for (const auto &connection : connections_) {
+    next_deadline = std::min(next_deadline, connection.deadline);
+  }
+  if (next_deadline == Clock::time_point::max()) {
+    // Nothing but paused cameras, if anything.
+    return -1;
+  }
+  const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+      next_deadline - Clock::now());
+  // Round up so that we don't spin on a deadline that's less than 1ms away.
+  return std::max<int>(0, timeout.count() + 1);
+}
+
+void ConnectionManager::ResolverLoop() {
+  std::unique_lock<std::mutex> lock(resolver_lock_);
+  while (true) {
+    resolve_requested_.wait(
+        lock, [this]() { return resolver_done_ || !to_resolve_.empty(); });
+    if (resolver_done_) {
+      return;
+    }
+    const size_t camera = to_resolve_.front();
+    to_resolve_.erase(to_resolve_.begin());
+    lock.unlock();
+
+    // Configs never change after construction, so they're safe to read here.
+    const CameraConfig &config = connections_[camera].config;
+    const std::string port = std::to_string(config.port);
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *address = nullptr;
+    Resolved result{.camera = camera, .ok = false, .address = {}};
+    if (getaddrinfo(config.address.c_str(), port.c_str(), &hints, &address) ==
+        0) {
+      result.ok = true;
+      std::memcpy(&result.address, address->ai_addr, sizeof(result.address));
+      freeaddrinfo(address);
+    }
+
+    lock.lock();
+    resolved_.push_back(result);
+    Signal(resolved_fd_);
+  }
+}
+
+}  // namespace cam
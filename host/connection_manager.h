@@ -0,0 +1,135 @@
+#ifndef CONNECTION_MANAGER_H
+#define CONNECTION_MANAGER_H
+
+#include "host/cam_parser.h"
+#include "host/camera_config.h"
+
+#include <netinet/in.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cam {
+
+// Keeps a stream open to every camera, multiplexing all of the sockets through
+// a single epoll reactor. Each camera gets its own CamParser, which is fed
+// straight from the socket. Connections which error out, stall, or reach the
+// end of their stream are closed and retried with exponential backoff.
+// Camera addresses are looked up again before every connection, on a thread of
+// their own so that a slow DNS server never holds up the reactor.
+//
+// Run() drives the reactor and should get a thread to itself. Everything else
+// may be called from any thread.
+class ConnectionManager {
+  public:
+    // Called from the reactor thread whenever |camera| has parsed at least one
+    // new image.
+    using FrameCallback = std::function<void(size_t camera)>;
+
+    // Every camera's parser is created with |parser_options|. With the kBlock
+    // overflow policy, a camera whose image queue fills up stops being read
+    // until images are retrieved, so TCP flow control slows the camera down
+    // instead of frames being dropped.
+    explicit ConnectionManager(
+        std::vector<CameraConfig> cameras,
+        const CamParser::Options &parser_options = CamParser::Options());
+    ~ConnectionManager();
+
+    ConnectionManager(const ConnectionManager &rhs) = delete;
+
+    // Must be called before Run().
+    void SetFrameCallback(FrameCallback callback) {
+      frame_callback_ = std::move(callback);
+    }
+
+    // Blocks until Stop() is called.
+    void Run();
+    void Stop();
+
+    size_t num_cameras() const { return connections_.size(); }
+    const CameraConfig &camera(size_t camera) const {
+      return connections_[camera].config;
+    }
+    CamParser &parser(size_t camera) { return *connections_[camera].parser; }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Connection {
+      CameraConfig config;
+      std::unique_ptr<CamParser> parser;
+      int fd = -1;
+      enum {
+        DISCONNECTED = 0,
+        RESOLVING,
+        CONNECTING,
+        STREAMING,
+      } state = DISCONNECTED;
+      // What happens at the deadline depends on the state: a DISCONNECTED
+      // camera is reconnected, and a camera in any other state has timed out.
+      Clock::time_point deadline;
+      // Consecutive failed connections, for backoff.
+      int failures = 0;
+      // A STREAMING camera stops being read while its parser is stalled, until
+      // retrieving an image wakes the reactor up. It has no deadline
+      // meanwhile.
+      bool paused = false;
+    };
+
+    // An address looked up by the resolver thread.
+    struct Resolved {
+      size_t camera;
+      bool ok;
+      sockaddr_in address;
+    };
+
+    // Has the resolver thread look up |camera|'s address.
+    void StartConnect(size_t camera);
+    // Connects to |camera| at the address the resolver found.
+    void Connect(size_t camera, const sockaddr_in &address);
+    // Picks up the resolver thread's results.
+    void HandleResolved();
+    void FinishConnect(size_t camera);
+    void ReadAvailable(size_t camera);
+    void Disconnect(size_t camera, const char *reason);
+    void Pause(size_t camera);
+    // Resumes reading if the parser has room again, otherwise stays paused
+    // until the next unstall.
+    void TryResume(size_t camera);
+
+    // Handles expired deadlines and returns the epoll_wait timeout until the
+    // next one, in milliseconds.
+    int HandleDeadlines();
+
+    void ResolverLoop();
+
+    std::vector<Connection> connections_;
+    FrameCallback frame_callback_;
+    int epoll_fd_ = -1;
+    // Written to by Stop() to wake up the reactor.
+    int stop_fd_ = -1;
+    // Written to by a parser's unstall callback, so that paused cameras are
+    // resumed as soon as there's room.
+    int resume_fd_ = -1;
+    // Written to by the resolver thread whenever it adds to resolved_.
+    int resolved_fd_ = -1;
+
+    std::thread resolver_thread_;
+    std::mutex resolver_lock_;
+    std::condition_variable resolve_requested_;
+    // Guarded by resolver_lock_.
+    bool resolver_done_ = false;
+    // Guarded by resolver_lock_. Cameras to look up, oldest first.
+    std::vector<size_t> to_resolve_;
+    // Guarded by resolver_lock_. Lookups not yet picked up by the reactor.
+    std::vector<Resolved> resolved_;
+};
+
+}  // namespace cam
+
+#endif // CONNECTION_MANAGER_H
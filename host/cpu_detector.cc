@@ -0,0 +1,1260 @@
+#include "host/cpu_detector.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+namespace cam {
+
+namespace {
+
+// The GEMM works on panels of this many output columns at a time, with the
+// matching columns of kKBlock rows of its input packed contiguously so that
+// they stay in cache while every output row is computed. The kernels compute
+// tiles of up to kTileRows rows by kTileColumns columns.
+constexpr int kPanelWidth = 64;
+constexpr int kKBlock = 256;
+constexpr int kTileRows = 6;
+constexpr int kTileColumns = 16;
+// Enough chunks of work per thread to even out the load.
+constexpr size_t kChunksPerThread = 4;
+
+enum class LayerType {
+  kConvolutional,
+  kMaxpool,
+  kRoute,
+  kShortcut,
+  kUpsample,
+  kYolo,
+};
+
+enum class Activation {
+  kLinear,
+  kLeaky,
+  kMish,
+  kLogistic,
+};
+
+struct Section {
+  std::string type;
+  std::map<std::string, std::string> options;
+  int line = 0;
+};
+
+float Logistic(float x) { return 1 / (1 + std::exp(-x)); }
+
+float Activate(Activation activation, float x) {
+  switch (activation) {
+    case Activation::kLinear:
+      return x;
+    case Activation::kLeaky:
+      return (x > 0) ? x : 0.1f * x;
+    case Activation::kMish: {
+      // Same softplus thresholds as darknet.
+      const float softplus = (x > 20)    ? x
+                             : (x < -20) ? std::exp(x)
+                                         : std::log1p(std::exp(x));
+      return x * std::tanh(softplus);
+    }
+    case Activation::kLogistic:
+      return Logistic(x);
+  }
+  return x;
+}
+
+bool ParseActivation(const std::string &name, Activation *activation) {
+  static const std::map<std::string, Activation> kActivations = {
+      {"linear", Activation::kLinear},
+      {"leaky", Activation::kLeaky},
+      {"mish", Activation::kMish},
+      {"logistic", Activation::kLogistic},
+  };
+  const auto found = kActivations.find(name);
+  if (found == kActivations.end()) {
+    return false;
+  }
+  *activation = found->second;
+  return true;
+}
+
+// Reads a darknet .cfg file. Like darknet, ignores whitespace and lines
+// starting with # or ;.
+bool ReadSections(const std::string &path, std::vector<Section> *sections) {
+  std::ifstream file(path.c_str());
+  if (!file.good()) {
+    std::cerr << "Could not open model config " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    line.erase(std::remove_if(line.begin(), line.end(),
+                              [](char c) { return std::isspace(c); }),
+               line.end());
+    if (line.empty() || (line[0] == '#') || (line[0] == ';')) {
+      continue;
+    }
+    if (line[0] == '[') {
+      if (line.back() != ']') {
+        std::cerr << path << ":" << line_number << ": malformed section."
+                  << std::endl;
+        return false;
+      }
+      sections->push_back({.type = line.substr(1, line.size() - 2),
+                           .options = {},
+                           .line = line_number});
+      continue;
+    }
+    const size_t equals = line.find('=');
+    if ((equals == std::string::npos) || sections->empty()) {
+      std::cerr << path << ":" << line_number << ": malformed option."
+                << std::endl;
+      return false;
+    }
+    sections->back().options[line.substr(0, equals)] = line.substr(equals + 1);
+  }
+  return true;
+}
+
+std::vector<float> FloatList(const Section &section, const std::string &key) {
+  std::vector<float> values;
+  const auto found = section.options.find(key);
+  if (found == section.options.end()) {
+    return values;
+  }
+  std::stringstream list(found->second);
+  std::string value;
+  while (std::getline(list, value, ',')) {
+    values.push_back(std::strtof(value.c_str(), nullptr));
+  }
+  return values;
+}
+
+float FloatOption(const Section &section, const std::string &key,
+                  float fallback) {
+  const auto found = section.options.find(key);
+  return (found == section.options.end())
+             ? fallback
+             : std::strtof(found->second.c_str(), nullptr);
+}
+
+int IntOption(const Section &section, const std::string &key, int fallback) {
+  const auto found = section.options.find(key);
+  return (found == section.options.end())
+             ? fallback
+             : std::strtol(found->second.c_str(), nullptr, 10);
+}
+
+// Relative (negative) layer references count back from |layer|.
+int LayerIndex(int reference, int layer) {
+  return (reference < 0) ? layer + reference : reference;
+}
+
+// Rounds half to even, as _mm256_cvtps_epi32 does, so that the scalar and
+// SIMD paths quantize every value the same way.
+int8_t Quantize(float value, float inverse_scale) {
+  return static_cast<int8_t>(
+      std::clamp(std::nearbyint(value * inverse_scale), -127.0f, 127.0f));
+}
+
+// Float GEMM kernels. Compute a |rows| x kTileColumns tile of C += A * B over
+// |depth| steps, where A is row-major with stride |lda| and B is a packed
+// panel with stride kPanelWidth. If |accumulate| is false, C starts at zero.
+
+void FloatKernelScalar(int rows, int depth, const float *a, int lda,
+                       const float *b, float *c, int ldc, bool accumulate) {
+  for (int r = 0; r < rows; ++r) {
+    float tile[kTileColumns];
+    for (int x = 0; x < kTileColumns; ++x) {
+      tile[x] = accumulate ? c[r * ldc + x] : 0;
+    }
+    for (int k = 0; k < depth; ++k) {
+      const float weight = a[r * lda + k];
+      for (int x = 0; x < kTileColumns; ++x) {
+        tile[x] += weight * b[k * kPanelWidth + x];
+      }
+    }
+    std::memcpy(c + r * ldc, tile, sizeof(tile));
+  }
+}
+
+// The int8 kernels work on pairs of depth steps. A holds the weights as int16,
+// and B packs each pair of rows interleaved, so that one multiply-add of
+// int16 pairs covers two steps. |depth| must be even.
+
+void Int8KernelScalar(int rows, int depth, const int16_t *a, int lda,
+                      const int16_t *b, int32_t *c, int ldc, bool accumulate) {
+  for (int r = 0; r < rows; ++r) {
+    int32_t tile[kTileColumns];
+    for (int x = 0; x < kTileColumns; ++x) {
+      tile[x] = accumulate ? c[r * ldc + x] : 0;
+    }
+    for (int k = 0; k < depth; k += 2) {
+      const int16_t *pairs = b + k * kPanelWidth;
+      for (int x = 0; x < kTileColumns; ++x) {
+        tile[x] += a[r * lda + k] * pairs[2 * x] +
+                   a[r * lda + k + 1] * pairs[2 * x + 1];
+      }
+    }
+    std::memcpy(c + r * ldc, tile, sizeof(tile));
+  }
+}
+
+void QuantizePairsScalar(const float *low, const float *high, size_t count,
+                         float inverse_scale, int16_t *out) {
+  for (size_t i = 0; i < count; ++i) {
+    out[2 * i] = Quantize(low[i], inverse_scale);
+    out[2 * i + 1] = high ? Quantize(high[i], inverse_scale) : 0;
+  }
+}
+
+float MaxAbsScalar(const float *values, size_t count) {
+  float max_abs = 0;
+  for (size_t i = 0; i < count; ++i) {
+    max_abs = std::max(max_abs, std::abs(values[i]));
+  }
+  return max_abs;
+}
+
+#ifdef HAVE_X86_SIMD
+
+// The kernels below unroll their loops over rows explicitly. Otherwise GCC
+// keeps spilling the accumulator tiles to the stack on every step.
+
+// Quantizes 8 floats to int32s in [-127, 127].
+__attribute__((target("avx2"))) inline __m256i Quantize8(const float *values,
+                                                         __m256 scale) {
+  const __m256i rounded =
+      _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(values), scale));
+  return _mm256_min_epi32(_mm256_max_epi32(rounded, _mm256_set1_epi32(-127)),
+                          _mm256_set1_epi32(127));
+}
+
+__attribute__((target("avx2"))) void QuantizePairsAvx2(const float *low,
+                                                       const float *high,
+                                                       size_t count,
+                                                       float inverse_scale,
+                                                       int16_t *out) {
+  const __m256 scale = _mm256_set1_ps(inverse_scale);
+  const __m256i low_half = _mm256_set1_epi32(0xffff);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    // Each 32-bit lane holds one (low, high) pair of int16s.
+    const __m256i lows = _mm256_and_si256(Quantize8(low + i, scale), low_half);
+    const __m256i highs = high ? _mm256_slli_epi32(Quantize8(high + i, scale), 16)
+                               : _mm256_setzero_si256();
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i),
+                        _mm256_or_si256(lows, highs));
+  }
+  QuantizePairsScalar(low + i, high ? high + i : nullptr, count - i,
+                      inverse_scale, out + 2 * i);
+}
+
+__attribute__((target("avx2"))) float MaxAbsAvx2(const float *values,
+                                                 size_t count) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 max_abs = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    max_abs = _mm256_max_ps(max_abs,
+                            _mm256_andnot_ps(sign, _mm256_loadu_ps(values + i)));
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, max_abs);
+  return std::max(*std::max_element(lanes, lanes + 8),
+                  MaxAbsScalar(values + i, count - i));
+}
+
+template <int kRows>
+__attribute__((target("avx2,fma"))) void FloatKernelAvx2(
+    int depth, const float *a, int lda, const float *b, float *c, int ldc,
+    bool accumulate) {
+  __m256 tile[kRows][2];
+  #pragma GCC unroll 8
+  for (int r = 0; r < kRows; ++r) {
+    tile[r][0] = accumulate ? _mm256_loadu_ps(c + r * ldc) : _mm256_setzero_ps();
+    tile[r][1] =
+        accumulate ? _mm256_loadu_ps(c + r * ldc + 8) : _mm256_setzero_ps();
+  }
+  for (int k = 0; k < depth; ++k) {
+    const __m256 b0 = _mm256_loadu_ps(b + k * kPanelWidth);
+    const __m256 b1 = _mm256_loadu_ps(b + k * kPanelWidth + 8);
+    #pragma GCC unroll 8
+    for (int r = 0; r < kRows; ++r) {
+      const __m256 weight = _mm256_broadcast_ss(a + r * lda + k);
+      tile[r][0] = _mm256_fmadd_ps(weight, b0, tile[r][0]);
+      tile[r][1] = _mm256_fmadd_ps(weight, b1, tile[r][1]);
+    }
+  }
+  #pragma GCC unroll 8
+  for (int r = 0; r < kRows; ++r) {
+    _mm256_storeu_ps(c + r * ldc, tile[r][0]);
+    _mm256_storeu_ps(c + r * ldc + 8, tile[r][1]);
+  }
+}
+
+template <int kRows>
+__attribute__((target("avx2"))) void Int8KernelAvx2(int depth, const int16_t *a,
+                                                     int lda, const int16_t *b,
+                                                     int32_t *c, int ldc,
+                                                     bool accumulate) {
+  __m256i tile[kRows][2];
+  #pragma GCC unroll 8
+  for (int r = 0; r < kRows; ++r) {
+    tile[r][0] =
+        accumulate
+            ? _mm256_loadu_si256(reinterpret_cast<const __m256i *>(c + r * ldc))
+            : _mm256_setzero_si256();
+    tile[r][1] = accumulate ? _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                                  c + r * ldc + 8))
+                            : _mm256_setzero_si256();
+  }
+  for (int k = 0; k < depth; k += 2) {
+    const int16_t *pairs = b + k * kPanelWidth;
+    const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pairs));
+    const __m256i b1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pairs + 16));
+    #pragma GCC unroll 8
+    for (int r = 0; r < kRows; ++r) {
+      int32_t pair;
+      std::memcpy(&pair, a + r * lda + k, sizeof(pair));
+      const __m256i weights = _mm256_set1_epi32(pair);
+      tile[r][0] = _mm256_add_epi32(tile[r][0], _mm256_madd_epi16(weights, b0));
+      tile[r][1] = _mm256_add_epi32(tile[r][1], _mm256_madd_epi16(weights, b1));
+    }
+  }
+  #pragma GCC unroll 8
+  for (int r = 0; r < kRows; ++r) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(c + r * ldc), tile[r][0]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(c + r * ldc + 8),
+                        tile[r][1]);
+  }
+}
+
+#endif  // HAVE_X86_SIMD
+
+float MaxAbs(SimdLevel level, const float *values, size_t count) {
+#ifdef HAVE_X86_SIMD
+  if (level == SimdLevel::kAvx2) {
+    return MaxAbsAvx2(values, count);
+  }
+#endif
+  return MaxAbsScalar(values, count);
+}
+
+void FloatKernel(SimdLevel level, int rows, int depth, const float *a, int lda,
+                 const float *b, float *c, int ldc, bool accumulate) {
+#ifdef HAVE_X86_SIMD
+  if (level == SimdLevel::kAvx2) {
+    switch (rows) {
+      case 1:
+        return FloatKernelAvx2<1>(depth, a, lda, b, c, ldc, accumulate);
+      case 2:
+        return FloatKernelAvx2<2>(depth, a, lda, b, c, ldc, accumulate);
+      case 3:
+        return FloatKernelAvx2<3>(depth, a, lda, b, c, ldc, accumulate);
+      case 4:
+        return FloatKernelAvx2<4>(depth, a, lda, b, c, ldc, accumulate);
+      case 5:
+        return FloatKernelAvx2<5>(depth, a, lda, b, c, ldc, accumulate);
+      default:
+        return FloatKernelAvx2<6>(depth, a, lda, b, c, ldc, accumulate);
+    }
+  }
+#endif
+  FloatKernelScalar(rows, depth, a, lda, b, c, ldc, accumulate);
+}
+
+void Int8Kernel(SimdLevel level, int rows, int depth, const int16_t *a, int lda,
+                const int16_t *b, int32_t *c, int ldc, bool accumulate) {
+#ifdef HAVE_X86_SIMD
+  if (level == SimdLevel::kAvx2) {
+    switch (rows) {
+      case 1:
+        return Int8KernelAvx2<1>(depth, a, lda, b, c, ldc, accumulate);
+      case 2:
+        return Int8KernelAvx2<2>(depth, a, lda, b, c, ldc, accumulate);
+      case 3:
+        return Int8KernelAvx2<3>(depth, a, lda, b, c, ldc, accumulate);
+      case 4:
+        return Int8KernelAvx2<4>(depth, a, lda, b, c, ldc, accumulate);
+      case 5:
+        return Int8KernelAvx2<5>(depth, a, lda, b, c, ldc, accumulate);
+      default:
+        return Int8KernelAvx2<6>(depth, a, lda, b, c, ldc, accumulate);
+    }
+  }
+#endif
+  Int8KernelScalar(rows, depth, a, lda, b, c, ldc, accumulate);
+}
+
+// Runs |kernel| over every tile of rows [m0, m1) and the panel's |width|
+// columns of C, which starts at column 0 of the panel. Tiles which hang off
+// the end of the panel go through a scratch tile.
+template <typename T, typename Kernel>
+void ForEachTile(int m0, int m1, int width, T *c, int ldc, bool accumulate,
+                 Kernel kernel) {
+  for (int m = m0; m < m1; m += kTileRows) {
+    const int rows = std::min(kTileRows, m1 - m);
+    for (int x = 0; x < width; x += kTileColumns) {
+      T *tile = c + m * ldc + x;
+      const int columns = std::min(kTileColumns, width - x);
+      if (columns == kTileColumns) {
+        kernel(rows, m, x, tile, ldc);
+        continue;
+      }
+      T partial[kTileRows * kTileColumns] = {};
+      for (int r = 0; accumulate && (r < rows); ++r) {
+        std::memcpy(partial + r * kTileColumns, tile + r * ldc,
+                    columns * sizeof(T));
+      }
+      kernel(rows, m, x, partial, kTileColumns);
+      for (int r = 0; r < rows; ++r) {
+        std::memcpy(tile + r * ldc, partial + r * kTileColumns,
+                    columns * sizeof(T));
+      }
+    }
+  }
+}
+
+}  // namespace
+
+void QuantizePairs(SimdLevel level, const float *low, const float *high,
+                   size_t count, float inverse_scale, int16_t *out) {
+#ifdef HAVE_X86_SIMD
+  if (level == SimdLevel::kAvx2) {
+    return QuantizePairsAvx2(low, high, count, inverse_scale, out);
+  }
+#endif
+  QuantizePairsScalar(low, high, count, inverse_scale, out);
+}
+
+struct CpuDetector::Layer {
+  LayerType type;
+  int in_c = 0;
+  int in_h = 0;
+  int in_w = 0;
+  int out_c = 0;
+  int out_h = 0;
+  int out_w = 0;
+  Activation activation = Activation::kLinear;
+
+  // Convolutional and maxpool.
+  int size = 1;
+  int stride = 1;
+  int padding = 0;
+  // Convolutional. |weights| holds a row of in_c * size * size for every
+  // filter, with batch norm folded in.
+  bool batch_normalize = false;
+  std::vector<float> weights;
+  std::vector<float> biases;
+  // Only set if quantized. The 8-bit weights, widened to int16 and each row
+  // padded to an even length, and each row's scale.
+  std::vector<int16_t> quantized_weights;
+  std::vector<float> weight_scales;
+
+  // Route and shortcut.
+  std::vector<int> inputs;
+  int groups = 1;
+  int group_id = 0;
+
+  // Yolo.
+  std::vector<int> mask;
+  std::vector<float> anchors;
+  int classes = 0;
+  float scale_x_y = 1;
+
+  // Last layer which reads the output, and the buffer holding it.
+  size_t last_use = 0;
+  size_t buffer = 0;
+
+  int depth() const { return in_c * size * size; }
+  size_t output_size() const {
+    return static_cast<size_t>(out_c) * out_h * out_w;
+  }
+  bool needs_columns() const {
+    return (size != 1) || (stride != 1) || (padding != 0);
+  }
+};
+
+std::unique_ptr<CpuDetector> CpuDetector::Create(const std::string &config_file,
+                                                 const std::string &weight_file,
+                                                 const Options &options) {
+  std::unique_ptr<CpuDetector> detector(new CpuDetector(options));
+  if (!detector->LoadConfig(config_file) ||
+      !detector->LoadWeights(weight_file)) {
+    return nullptr;
+  }
+  detector->PlanBuffers();
+  return detector;
+}
+
+CpuDetector::CpuDetector(const Options &options)
+    : options_(options), simd_level_(DetectSimdLevel()) {
+#ifdef HAVE_X86_SIMD
+  // The float kernel needs FMA as well.
+  if ((simd_level_ == SimdLevel::kAvx2) && !__builtin_cpu_supports("fma")) {
+    simd_level_ = SimdLevel::kSse41;
+  }
+#endif
+  size_t num_threads = options.num_threads;
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  float_panels_.resize(num_threads);
+  int_panels_.resize(num_threads);
+  // The caller is thread 0.
+  for (size_t thread = 1; thread < num_threads; ++thread) {
+    workers_.emplace_back([this, thread]() { WorkerLoop(thread); });
+  }
+}
+
+CpuDetector::~CpuDetector() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    done_ = true;
+  }
+  work_ready_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+bool CpuDetector::LoadConfig(const std::string &path) {
+  std::vector<Section> sections;
+  if (!ReadSections(path, &sections)) {
+    return false;
+  }
+  if (sections.empty() || (sections[0].type != "net")) {
+    std::cerr << path << " doesn't start with [net]." << std::endl;
+    return false;
+  }
+  net_width_ = IntOption(sections[0], "width", 0);
+  net_height_ = IntOption(sections[0], "height", 0);
+  net_channels_ = IntOption(sections[0], "channels", 3);
+  if ((net_width_ <= 0) || (net_height_ <= 0) || (net_channels_ != 3)) {
+    std::cerr << path << ": the network input must be RGB with a size."
+              << std::endl;
+    return false;
+  }
+
+  int c = net_channels_;
+  int h = net_height_;
+  int w = net_width_;
+  for (size_t i = 1; i < sections.size(); ++i) {
+    const Section &section = sections[i];
+    const int index = layers_.size();
+    const auto error = [&](const std::string &why) {
+      std::cerr << path << ":" << section.line << ": " << why << std::endl;
+      return false;
+    };
+    const auto input_layer = [&](int reference, int *input) {
+      *input = LayerIndex(reference, index);
+      return (*input >= 0) && (*input < index);
+    };
+
+    Layer layer;
+    layer.in_c = c;
+    layer.in_h = h;
+    layer.in_w = w;
+    layer.out_c = c;
+    layer.out_h = h;
+    layer.out_w = w;
+    if (!ParseActivation(
+            section.options.count("activation") ? section.options.at("activation")
+                                                : "linear",
+            &layer.activation)) {
+      return error("unsupported activation.");
+    }
+    if ((section.type == "convolutional") || (section.type == "conv")) {
+      layer.type = LayerType::kConvolutional;
+      layer.out_c = IntOption(section, "filters", 1);
+      layer.size = IntOption(section, "size", 1);
+      layer.stride = IntOption(section, "stride", 1);
+      layer.padding = IntOption(section, "pad", 0) ? layer.size / 2
+                                                   : IntOption(section, "padding", 0);
+      layer.batch_normalize = IntOption(section, "batch_normalize", 0);
+      if ((IntOption(section, "groups", 1) != 1) ||
+          (IntOption(section, "dilation", 1) != 1) ||
+          (IntOption(section, "stride_x", layer.stride) != layer.stride) ||
+          (IntOption(section, "stride_y", layer.stride) != layer.stride)) {
+        return error("unsupported convolution.");
+      }
+      layer.out_h = (h + 2 * layer.padding - layer.size) / layer.stride + 1;
+      layer.out_w = (w + 2 * layer.padding - layer.size) / layer.stride + 1;
+    } else if ((section.type == "maxpool") || (section.type == "max")) {
+      layer.type = LayerType::kMaxpool;
+      layer.size = IntOption(section, "size", 1);
+      layer.stride = IntOption(section, "stride", 1);
+      layer.padding = IntOption(section, "padding", layer.size - 1);
+      layer.out_h = (h + layer.padding - layer.size) / layer.stride + 1;
+      layer.out_w = (w + layer.padding - layer.size) / layer.stride + 1;
+    } else if (section.type == "route") {
+      layer.type = LayerType::kRoute;
+      layer.groups = IntOption(section, "groups", 1);
+      layer.group_id = IntOption(section, "group_id", 0);
+      layer.out_c = 0;
+      for (float reference : FloatList(section, "layers")) {
+        int input;
+        if (!input_layer(static_cast<int>(reference), &input)) {
+          return error("route to a layer that doesn't exist.");
+        }
+        const Layer &from = layers_[input];
+        if (layer.inputs.empty()) {
+          layer.out_h = from.out_h;
+          layer.out_w = from.out_w;
+        } else if ((from.out_h != layer.out_h) || (from.out_w != layer.out_w)) {
+          return error("route of layers with different sizes.");
+        }
+        if ((layer.groups < 1) || (from.out_c % layer.groups != 0)) {
+          return error("route groups don't divide the channels.");
+        }
+        layer.out_c += from.out_c / layer.groups;
+        layer.inputs.push_back(input);
+      }
+      if (layer.inputs.empty()) {
+        return error("route without layers.");
+      }
+    } else if (section.type == "shortcut") {
+      layer.type = LayerType::kShortcut;
+      int input;
+      if (!input_layer(IntOption(section, "from", 0), &input)) {
+        return error("shortcut from a layer that doesn't exist.");
+      }
+      const Layer &from = layers_[input];
+      if ((from.out_c != c) || (from.out_h != h) || (from.out_w != w)) {
+        return error("shortcut between layers with different sizes.");
+      }
+      layer.inputs.push_back(input);
+    } else if (section.type == "upsample") {
+      layer.type = LayerType::kUpsample;
+      layer.stride = IntOption(section, "stride", 2);
+      if ((layer.stride < 1) || (FloatOption(section, "scale", 1) != 1)) {
+        return error("unsupported upsample.");
+      }
+      layer.out_h = h * layer.stride;
+      layer.out_w = w * layer.stride;
+    } else if (section.type == "yolo") {
+      layer.type = LayerType::kYolo;
+      for (float anchor : FloatList(section, "mask")) {
+        layer.mask.push_back(anchor);
+      }
+      layer.anchors = FloatList(section, "anchors");
+      layer.classes = IntOption(section, "classes", 20);
+      layer.scale_x_y = FloatOption(section, "scale_x_y", 1);
+      if (IntOption(section, "new_coords", 0) != 0) {
+        return error("unsupported yolo coordinates.");
+      }
+      if (static_cast<size_t>(c) != layer.mask.size() * (layer.classes + 5)) {
+        return error("yolo input doesn't match its classes and mask.");
+      }
+      for (int anchor : layer.mask) {
+        if ((anchor < 0) ||
+            (static_cast<size_t>(2 * anchor + 1) >= layer.anchors.size())) {
+          return error("yolo mask refers to a missing anchor.");
+        }
+      }
+    } else {
+      return error("unsupported layer [" + section.type + "].");
+    }
+    if ((layer.out_c <= 0) || (layer.out_h <= 0) || (layer.out_w <= 0)) {
+      return error("layer has no output.");
+    }
+    c = layer.out_c;
+    h = layer.out_h;
+    w = layer.out_w;
+    layers_.push_back(std::move(layer));
+  }
+  return true;
+}
+
+bool CpuDetector::LoadWeights(const std::string &path) {
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file.good()) {
+    std::cerr << "Could not open model weights " << path << std::endl;
+    return false;
+  }
+  int32_t version[3];
+  file.read(reinterpret_cast<char *>(version), sizeof(version));
+  // Images seen in training, which got wider in version 0.2.
+  const int32_t major = version[0];
+  const int32_t minor = version[1];
+  if (((major * 10 + minor) >= 2) && (major < 1000) && (minor < 1000)) {
+    uint64_t seen;
+    file.read(reinterpret_cast<char *>(&seen), sizeof(seen));
+  } else {
+    int32_t seen;
+    file.read(reinterpret_cast<char *>(&seen), sizeof(seen));
+  }
+  const auto read = [&file](std::vector<float> *values, size_t count) {
+    values->resize(count);
+    file.read(reinterpret_cast<char *>(values->data()), count * sizeof(float));
+    return file.good();
+  };
+
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    Layer &layer = layers_[i];
+    if (layer.type != LayerType::kConvolutional) {
+      continue;
+    }
+    const size_t filters = layer.out_c;
+    const size_t depth = layer.depth();
+    std::vector<float> scales;
+    std::vector<float> means;
+    std::vector<float> variances;
+    if (!read(&layer.biases, filters) ||
+        (layer.batch_normalize &&
+         (!read(&scales, filters) || !read(&means, filters) ||
+          !read(&variances, filters))) ||
+        !read(&layer.weights, filters * depth)) {
+      std::cerr << path << " ends before layer " << i << "'s weights."
+                << std::endl;
+      return false;
+    }
+    if (layer.batch_normalize) {
+      // Darknet normalizes with (x - mean) / (sqrt(variance) + .000001), then
+      // scales and adds the bias. All of which is linear.
+      for (size_t f = 0; f < filters; ++f) {
+        const float factor = scales[f] / (std::sqrt(variances[f]) + .000001f);
+        for (size_t k = 0; k < depth; ++k) {
+          layer.weights[f * depth + k] *= factor;
+        }
+        layer.biases[f] -= means[f] * factor;
+      }
+    }
+
+    const bool feeds_yolo = (i + 1 < layers_.size()) &&
+                            (layers_[i + 1].type == LayerType::kYolo);
+    if (!options_.int8 || (i == 0) || feeds_yolo) {
+      continue;
+    }
+    const size_t padded_depth = (depth + 1) & ~size_t{1};
+    layer.quantized_weights.assign(filters * padded_depth, 0);
+    layer.weight_scales.resize(filters);
+    for (size_t f = 0; f < filters; ++f) {
+      const float *row = layer.weights.data() + f * depth;
+      float max_abs = 0;
+      for (size_t k = 0; k < depth; ++k) {
+        max_abs = std::max(max_abs, std::abs(row[k]));
+      }
+      const float scale = (max_abs > 0) ? max_abs / 127 : 1;
+      layer.weight_scales[f] = scale;
+      for (size_t k = 0; k < depth; ++k) {
+        layer.quantized_weights[f * padded_depth + k] = Quantize(row[k], 1 / scale);
+      }
+    }
+    // Only the quantized weights are needed from here on.
+    std::vector<float>().swap(layer.weights);
+  }
+  return true;
+}
+
+void CpuDetector::PlanBuffers() {
+  const size_t num_layers = layers_.size();
+  for (size_t i = 0; i < num_layers; ++i) {
+    Layer &layer = layers_[i];
+    // Yolo outputs are read after the last layer. Uses only ever extend a
+    // buffer's life, or a yolo layer followed by anything but a route would
+    // have its output reused before it's decoded.
+    layer.last_use = std::max(
+        layer.last_use, (layer.type == LayerType::kYolo) ? num_layers : i);
+    if ((i > 0) && (layer.type != LayerType::kRoute)) {
+      layers_[i - 1].last_use = std::max(layers_[i - 1].last_use, i);
+    }
+    for (int input : layer.inputs) {
+      layers_[input].last_use = std::max(layers_[input].last_use, i);
+    }
+  }
+
+  // Greedy: every layer takes the smallest free buffer that's big enough (or
+  // grows the biggest one), and gives its inputs' buffers back once nothing
+  // later reads them.
+  std::vector<size_t> sizes;
+  std::vector<size_t> free;
+  size_t columns_size = 0;
+  size_t accumulators_size = 0;
+  size_t quantized_columns_size = 0;
+  for (size_t i = 0; i < num_layers; ++i) {
+    Layer &layer = layers_[i];
+    const size_t size = layer.output_size();
+    auto best = free.end();
+    for (auto it = free.begin(); it != free.end(); ++it) {
+      const bool fits = sizes[*it] >= size;
+      if ((best == free.end()) ||
+          (fits ? ((sizes[*best] < size) || (sizes[*it] < sizes[*best]))
+                : ((sizes[*best] < size) && (sizes[*it] > sizes[*best])))) {
+        best = it;
+      }
+    }
+    if (best == free.end()) {
+      layer.buffer = sizes.size();
+      sizes.push_back(size);
+    } else {
+      layer.buffer = *best;
+      sizes[*best] = std::max(sizes[*best], size);
+      free.erase(best);
+    }
+    for (size_t j = 0; j <= i; ++j) {
+      if (layers_[j].last_use == i) {
+        free.push_back(layers_[j].buffer);
+      }
+    }
+
+    if (layer.type == LayerType::kConvolutional) {
+      const size_t outputs = static_cast<size_t>(layer.out_h) * layer.out_w;
+      if (layer.needs_columns()) {
+        columns_size = std::max(columns_size, layer.depth() * outputs);
+      }
+      if (!layer.quantized_weights.empty()) {
+        accumulators_size =
+            std::max(accumulators_size, layer.output_size());
+        quantized_columns_size = std::max(
+            quantized_columns_size, ((layer.depth() + 1) & ~1) * outputs);
+      }
+    }
+  }
+
+  buffers_.resize(sizes.size());
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    buffers_[i].resize(sizes[i]);
+  }
+  columns_.resize(columns_size);
+  accumulators_.resize(accumulators_size);
+  quantized_columns_.resize(quantized_columns_size);
+  for (auto &panel : float_panels_) {
+    panel.resize(kKBlock * kPanelWidth);
+  }
+  if (accumulators_size > 0) {
+    for (auto &panel : int_panels_) {
+      panel.resize(kKBlock * kPanelWidth);
+    }
+  }
+}
+
+void CpuDetector::DetectBatch(const float *input, int batch_size,
+                              float threshold, size_t max_boxes,
+                              std::vector<std::vector<bbox_t>> *boxes) {
+  if (boxes->size() < static_cast<size_t>(batch_size)) {
+    boxes->resize(batch_size);
+  }
+  const size_t image_size =
+      static_cast<size_t>(net_channels_) * net_height_ * net_width_;
+  for (int i = 0; i < batch_size; ++i) {
+    Forward(input + i * image_size);
+    Detections(threshold, max_boxes, &(*boxes)[i]);
+  }
+}
+
+void CpuDetector::Forward(const float *image) {
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    Layer &layer = layers_[i];
+    const float *input =
+        (i == 0) ? image : buffers_[layers_[i - 1].buffer].data();
+    switch (layer.type) {
+      case LayerType::kConvolutional:
+        ForwardConvolutional(layer, input);
+        break;
+      case LayerType::kMaxpool:
+        ForwardMaxpool(layer, input);
+        break;
+      case LayerType::kRoute:
+        ForwardRoute(layer);
+        break;
+      case LayerType::kShortcut:
+        ForwardShortcut(layer, input);
+        break;
+      case LayerType::kUpsample:
+        ForwardUpsample(layer, input);
+        break;
+      case LayerType::kYolo:
+        ForwardYolo(layer, input);
+        break;
+    }
+  }
+}
+
+void CpuDetector::ForwardConvolutional(Layer &layer, const float *input) {
+  const int depth = layer.depth();
+  const int outputs = layer.out_h * layer.out_w;
+  const int filters = layer.out_c;
+  float *const output = buffers_[layer.buffer].data();
+
+  // Unroll every filter-sized patch of the input into a column, so that the
+  // convolution is one matrix multiply. 1x1 convolutions already are.
+  const float *columns = input;
+  if (layer.needs_columns()) {
+    float *const unrolled = columns_.data();
+    ParallelFor(layer.in_c, [&](size_t c, size_t) {
+      for (int ky = 0; ky < layer.size; ++ky) {
+        for (int kx = 0; kx < layer.size; ++kx) {
+          float *row = unrolled +
+                       ((c * layer.size + ky) * layer.size + kx) *
+                           static_cast<size_t>(outputs);
+          // Output columns [x0, x1) read from inside the input. The rest
+          // read padding.
+          const int offset = kx - layer.padding;
+          const int x0 = std::min(
+              layer.out_w, std::max(0, (-offset + layer.stride - 1) / layer.stride));
+          const int x1 = std::max(
+              x0, std::min(layer.out_w,
+                           (layer.in_w - offset + layer.stride - 1) / layer.stride));
+          for (int y = 0; y < layer.out_h; ++y, row += layer.out_w) {
+            const int in_y = y * layer.stride + ky - layer.padding;
+            if ((in_y < 0) || (in_y >= layer.in_h)) {
+              std::fill(row, row + layer.out_w, 0.0f);
+              continue;
+            }
+            const float *in =
+                input + (c * layer.in_h + in_y) * layer.in_w + offset;
+            std::fill(row, row + x0, 0.0f);
+            if (layer.stride == 1) {
+              std::memcpy(row + x0, in + x0, (x1 - x0) * sizeof(float));
+            } else {
+              for (int x = x0; x < x1; ++x) {
+                row[x] = in[x * layer.stride];
+              }
+            }
+            std::fill(row + x1, row + layer.out_w, 0.0f);
+          }
+        }
+      }
+    });
+    columns = unrolled;
+  }
+
+  const bool quantized = !layer.quantized_weights.empty();
+  const int padded_depth = (depth + 1) & ~1;
+  float input_scale = 1;
+  if (quantized) {
+    // One scale for the whole input. Unrolling doesn't add anything bigger.
+    const float max_abs =
+        MaxAbs(simd_level_, input,
+               static_cast<size_t>(layer.in_c) * layer.in_h * layer.in_w);
+    input_scale = (max_abs > 0) ? max_abs / 127 : 1;
+    // Quantize the columns once up front, with each pair of rows interleaved
+    // the way the kernels read them.
+    const size_t pairs = padded_depth / 2;
+    constexpr size_t kPairsPerChunk = 8;
+    ParallelFor((pairs + kPairsPerChunk - 1) / kPairsPerChunk,
+                [&](size_t chunk, size_t) {
+                  const size_t end = std::min(pairs, (chunk + 1) * kPairsPerChunk);
+                  for (size_t p = chunk * kPairsPerChunk; p < end; ++p) {
+                    const float *low = columns + 2 * p * outputs;
+                    QuantizePairs(simd_level_, low,
+                                  (2 * p + 1 < static_cast<size_t>(depth))
+                                      ? low + outputs
+                                      : nullptr,
+                                  outputs, 1 / input_scale,
+                                  quantized_columns_.data() + 2 * p * outputs);
+                  }
+                });
+  }
+
+  // Split into panels of output columns, and into groups of rows too when
+  // there aren't enough panels to keep every thread busy.
+  const size_t num_panels = (outputs + kPanelWidth - 1) / kPanelWidth;
+  const size_t wanted_chunks = float_panels_.size() * kChunksPerThread;
+  const size_t max_row_groups = (filters + kTileRows - 1) / kTileRows;
+  const size_t row_groups = std::clamp<size_t>(
+      (wanted_chunks + num_panels - 1) / num_panels, 1, max_row_groups);
+  const int rows_per_group =
+      (filters + row_groups * kTileRows - 1) / (row_groups * kTileRows) *
+      kTileRows;
+
+  ParallelFor(num_panels * row_groups, [&](size_t chunk, size_t thread) {
+    const int n0 = (chunk % num_panels) * kPanelWidth;
+    const int width = std::min(kPanelWidth, outputs - n0);
+    const int m0 = (chunk / num_panels) * rows_per_group;
+    const int m1 = std::min(filters, m0 + rows_per_group);
+    if (m0 >= m1) {
+      return;
+    }
+
+    for (int k0 = 0; k0 < depth; k0 += kKBlock) {
+      const int block = std::min(kKBlock, depth - k0);
+      if (quantized) {
+        int16_t *panel = int_panels_[thread].data();
+        const int pairs = (block + 1) / 2;
+        for (int p = 0; p < pairs; ++p) {
+          const int16_t *row = quantized_columns_.data() +
+                               (static_cast<size_t>(k0) + 2 * p) * outputs +
+                               2 * n0;
+          int16_t *out = panel + p * kPanelWidth * 2;
+          std::memcpy(out, row, 2 * width * sizeof(int16_t));
+          std::fill(out + 2 * width, out + 2 * kPanelWidth, 0);
+        }
+        int32_t *c = accumulators_.data() + n0;
+        ForEachTile(m0, m1, width, c, outputs, k0 > 0,
+                    [&](int rows, int m, int x, int32_t *tile, int ldc) {
+                      Int8Kernel(simd_level_, rows, 2 * pairs,
+                                 layer.quantized_weights.data() +
+                                     static_cast<size_t>(m) * padded_depth + k0,
+                                 padded_depth, panel + x * 2, tile, ldc,
+                                 k0 > 0);
+                    });
+      } else {
+        float *panel = float_panels_[thread].data();
+        for (int k = 0; k < block; ++k) {
+          const float *row =
+              columns + static_cast<size_t>(k0 + k) * outputs + n0;
+          float *out = panel + k * kPanelWidth;
+          std::memcpy(out, row, width * sizeof(float));
+          std::fill(out + width, out + kPanelWidth, 0.0f);
+        }
+        float *c = output + n0;
+        ForEachTile(m0, m1, width, c, outputs, k0 > 0,
+                    [&](int rows, int m, int x, float *tile, int ldc) {
+                      FloatKernel(simd_level_, rows, block,
+                                  layer.weights.data() +
+                                      static_cast<size_t>(m) * depth + k0,
+                                  depth, panel + x, tile, ldc, k0 > 0);
+                    });
+      }
+    }
+
+    // Bias and activation while the tile's still in cache.
+    for (int m = m0; m < m1; ++m) {
+      float *row = output + static_cast<size_t>(m) * outputs + n0;
+      const float bias = layer.biases[m];
+      if (quantized) {
+        const int32_t *sums =
+            accumulators_.data() + static_cast<size_t>(m) * outputs + n0;
+        const float scale = layer.weight_scales[m] * input_scale;
+        for (int x = 0; x < width; ++x) {
+          row[x] = Activate(layer.activation, sums[x] * scale + bias);
+        }
+      } else {
+        for (int x = 0; x < width; ++x) {
+          row[x] = Activate(layer.activation, row[x] + bias);
+        }
+      }
+    }
+  });
+}
+
+void CpuDetector::ForwardMaxpool(Layer &layer, const float *input) {
+  float *const output = buffers_[layer.buffer].data();
+  const int offset = -layer.padding / 2;
+  ParallelFor(layer.out_c, [&](size_t c, size_t) {
+    const float *plane = input + c * layer.in_h * layer.in_w;
+    float *out = output + c * layer.out_h * layer.out_w;
+    for (int y = 0; y < layer.out_h; ++y) {
+      for (int x = 0; x < layer.out_w; ++x) {
+        float max = -FLT_MAX;
+        for (int ky = 0; ky < layer.size; ++ky) {
+          const int in_y = offset + y * layer.stride + ky;
+          if ((in_y < 0) || (in_y >= layer.in_h)) {
+            continue;
+          }
+          for (int kx = 0; kx < layer.size; ++kx) {
+            const int in_x = offset + x * layer.stride + kx;
+            if ((in_x >= 0) && (in_x < layer.in_w)) {
+              max = std::max(max, plane[in_y * layer.in_w + in_x]);
+            }
+          }
+        }
+        *out++ = max;
+      }
+    }
+  });
+}
+
+void CpuDetector::ForwardRoute(Layer &layer) {
+  float *output = buffers_[layer.buffer].data();
+  for (int input : layer.inputs) {
+    const Layer &from = layers_[input];
+    const size_t part = from.output_size() / layer.groups;
+    const float *source =
+        buffers_[from.buffer].data() + part * layer.group_id;
+    std::memcpy(output, source, part * sizeof(float));
+    output += part;
+  }
+}
+
+void CpuDetector::ForwardShortcut(Layer &layer, const float *input) {
+  float *const output = buffers_[layer.buffer].data();
+  const float *from = buffers_[layers_[layer.inputs[0]].buffer].data();
+  const size_t size = layer.output_size();
+  for (size_t i = 0; i < size; ++i) {
+    output[i] = Activate(layer.activation, input[i] + from[i]);
+  }
+}
+
+void CpuDetector::ForwardUpsample(Layer &layer, const float *input) {
+  float *output = buffers_[layer.buffer].data();
+  for (int c = 0; c < layer.out_c; ++c) {
+    for (int y = 0; y < layer.out_h; ++y) {
+      const float *row =
+          input + (c * layer.in_h + y / layer.stride) * layer.in_w;
+      for (int x = 0; x < layer.out_w; ++x) {
+        *output++ = row[x / layer.stride];
+      }
+    }
+  }
+}
+
+void CpuDetector::ForwardYolo(Layer &layer, const float *input) {
+  float *const output = buffers_[layer.buffer].data();
+  std::memcpy(output, input, layer.output_size() * sizeof(float));
+  // Per anchor: x, y, w, h, objectness, then class planes. Everything but w and
+  // h goes through a logistic, and x and y are stretched by scale_x_y.
+  const size_t plane = static_cast<size_t>(layer.out_h) * layer.out_w;
+  for (size_t n = 0; n < layer.mask.size(); ++n) {
+    float *entries = output + n * (layer.classes + 5) * plane;
+    for (size_t i = 0; i < 2 * plane; ++i) {
+      entries[i] = Logistic(entries[i]) * layer.scale_x_y -
+                   0.5f * (layer.scale_x_y - 1);
+    }
+    for (size_t i = 4 * plane; i < (layer.classes + 5) * plane; ++i) {
+      entries[i] = Logistic(entries[i]);
+    }
+  }
+}
+
+void CpuDetector::Detections(float threshold, size_t max_boxes,
+                             std::vector<bbox_t> *boxes) {
+  candidates_.clear();
+  for (const Layer &layer : layers_) {
+    if (layer.type != LayerType::kYolo) {
+      continue;
+    }
+    const float *output = buffers_[layer.buffer].data();
+    const size_t plane = static_cast<size_t>(layer.out_h) * layer.out_w;
+    for (size_t n = 0; n < layer.mask.size(); ++n) {
+      const float *entries = output + n * (layer.classes + 5) * plane;
+      const float anchor_w = layer.anchors[2 * layer.mask[n]];
+      const float anchor_h = layer.anchors[2 * layer.mask[n] + 1];
+      for (size_t cell = 0; cell < plane; ++cell) {
+        const float objectness = entries[4 * plane + cell];
+        if (objectness <= threshold) {
+          continue;
+        }
+        // Like darknet, report the most likely class.
+        int best_class = 0;
+        float best_prob = 0;
+        for (int k = 0; k < layer.classes; ++k) {
+          const float prob = objectness * entries[(5 + k) * plane + cell];
+          if (prob > best_prob) {
+            best_prob = prob;
+            best_class = k;
+          }
+        }
+        if (best_prob <= threshold) {
+          continue;
+        }
+        const int column = cell % layer.out_w;
+        const int row = cell / layer.out_w;
+        const float center_x =
+            (column + entries[cell]) / layer.out_w * net_width_;
+        const float center_y =
+            (row + entries[plane + cell]) / layer.out_h * net_height_;
+        const float width = std::exp(entries[2 * plane + cell]) * anchor_w;
+        const float height = std::exp(entries[3 * plane + cell]) * anchor_h;
+        bbox_t box{};
+        box.x = std::max(0.0f, center_x - width / 2);
+        box.y = std::max(0.0f, center_y - height / 2);
+        box.w = width;
+        box.h = height;
+        box.prob = best_prob;
+        box.obj_id = best_class;
+        box.x_3d = NAN;
+        box.y_3d = NAN;
+        box.z_3d = NAN;
+        candidates_.push_back(box);
+      }
+    }
+  }
+
+  // Greedy non-maximum suppression within each class. Most confident first,
+  // so that it can stop as soon as max_boxes are kept.
+  std::sort(candidates_.begin(), candidates_.end(),
+            [](const bbox_t &a, const bbox_t &b) { return a.prob > b.prob; });
+  boxes->clear();
+  for (const bbox_t &box : candidates_) {
+    if (boxes->size() >= max_boxes) {
+      break;
+    }
+    const bool suppressed =
+        std::any_of(boxes->begin(), boxes->end(), [&](const bbox_t &k) {
+          return (k.obj_id == box.obj_id) &&
+                 (IntersectionOverUnion(k, box) > options_.nms_threshold);
+        });
+    if (!suppressed) {
+      boxes->push_back(box);
+    }
+  }
+}
+
+void CpuDetector::ParallelFor(size_t num_chunks,
+                              const std::function<void(size_t, size_t)> &job) {
+  if (workers_.empty() || (num_chunks <= 1)) {
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+      job(chunk, 0);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    job_ = &job;
+    job_chunks_ = num_chunks;
+    next_chunk_ = 0;
+    chunks_done_ = 0;
+    generation_++;
+  }
+  work_ready_.notify_all();
+  RunChunks(job, num_chunks, 0);
+  // Wait for stragglers to finish their chunks, and to let go of the job.
+  std::unique_lock<std::mutex> lock(lock_);
+  work_done_.wait(lock, [this, num_chunks]() {
+    return (chunks_done_ == num_chunks) && (active_workers_ == 0);
+  });
+  job_ = nullptr;
+}
+
+void CpuDetector::RunChunks(const std::function<void(size_t, size_t)> &job,
+                            size_t num_chunks, size_t thread) {
+  while (true) {
+    const size_t chunk = next_chunk_++;
+    if (chunk >= num_chunks) {
+      return;
+    }
+    job(chunk, thread);
+    chunks_done_++;
+  }
+}
+
+void CpuDetector::WorkerLoop(size_t thread) {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    work_ready_.wait(lock, [this, &seen]() {
+      return done_ || ((generation_ != seen) && (job_ != nullptr));
+    });
+    if (done_) {
+      return;
+    }
+    seen = generation_;
+    const auto *job = job_;
+    const size_t num_chunks = job_chunks_;
+    active_workers_++;
+    lock.unlock();
+    RunChunks(*job, num_chunks, thread);
+    lock.lock();
+    active_workers_--;
+    work_done_.notify_one();
+  }
+}
+
+}  // namespace cam
@@ -0,0 +1,133 @@
+#ifndef CPU_DETECTOR_H
+#define CPU_DETECTOR_H
+
+#include "host/image_ops.h"
+#include "host/object_detector.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cam {
+
+// Runs darknet YOLO models straight from their .cfg and .weights files on the
+// CPU, without darknet (or a GPU). Supports the layers yolov4 and yolov4-tiny
+// are made of: convolutional, maxpool, route, shortcut, upsample and yolo.
+//
+// Convolutions are im2col plus a cache-blocked GEMM, vectorized with AVX2 and
+// FMA when the CPU has them, and split across a pool of worker threads.
+// Batch norm is folded into the convolution weights at load time.
+//
+// With Options::int8, convolution weights are quantized to 8 bits per output
+// channel at load time, and each layer's input to 8 bits on the fly, roughly
+// doubling GEMM throughput. The first convolution, and those feeding yolo
+// layers, stay in float since they're the most sensitive to quantization.
+class CpuDetector : public ObjectDetector {
+  public:
+    struct Options {
+      // Threads to run each layer on, including the caller's. 0 means one per
+      // core.
+      size_t num_threads = 0;
+      bool int8 = false;
+      // Boxes of the same class which overlap by more than this (IoU) are
+      // suppressed, keeping the most confident. Matches darknet's default.
+      float nms_threshold = 0.4f;
+    };
+
+    // Returns nullptr (and logs why) if the model can't be loaded, or uses
+    // something this doesn't support.
+    static std::unique_ptr<CpuDetector> Create(const std::string &config_file,
+                                               const std::string &weight_file,
+                                               const Options &options);
+    ~CpuDetector() override;
+
+    CpuDetector(const CpuDetector &rhs) = delete;
+
+    int net_width() const override { return net_width_; }
+    int net_height() const override { return net_height_; }
+
+    void DetectBatch(const float *input, int batch_size, float threshold,
+                     size_t max_boxes,
+                     std::vector<std::vector<bbox_t>> *boxes) override;
+
+  private:
+    struct Layer;
+
+    explicit CpuDetector(const Options &options);
+
+    bool LoadConfig(const std::string &path);
+    bool LoadWeights(const std::string &path);
+    // Assigns every layer's output a buffer, sharing buffers between layers
+    // whose outputs are never needed at the same time, and sizes the scratch
+    // space.
+    void PlanBuffers();
+
+    // Runs one image through every layer.
+    void Forward(const float *image);
+    void ForwardConvolutional(Layer &layer, const float *input);
+    void ForwardMaxpool(Layer &layer, const float *input);
+    void ForwardRoute(Layer &layer);
+    void ForwardShortcut(Layer &layer, const float *input);
+    void ForwardUpsample(Layer &layer, const float *input);
+    void ForwardYolo(Layer &layer, const float *input);
+    // Replaces |boxes| with the |max_boxes| most confident boxes of every
+    // yolo layer, after Forward().
+    void Detections(float threshold, size_t max_boxes,
+                    std::vector<bbox_t> *boxes);
+
+    // Runs job(chunk, thread) for every chunk in [0, num_chunks) across the
+    // worker threads and the caller, and returns once they're all done.
+    // |thread| indexes per-thread scratch space.
+    void ParallelFor(size_t num_chunks,
+                     const std::function<void(size_t, size_t)> &job);
+    void WorkerLoop(size_t thread);
+    void RunChunks(const std::function<void(size_t, size_t)> &job,
+                   size_t num_chunks, size_t thread);
+
+    Options options_;
+    SimdLevel simd_level_;
+    int net_width_ = 0;
+    int net_height_ = 0;
+    int net_channels_ = 3;
+    std::vector<Layer> layers_;
+    std::vector<std::vector<float>> buffers_;
+
+    // Scratch space, reused from layer to layer.
+    std::vector<float> columns_;
+    std::vector<int16_t> quantized_columns_;
+    std::vector<int32_t> accumulators_;
+    // Boxes above the threshold, before non-maximum suppression.
+    std::vector<bbox_t> candidates_;
+    // Per thread.
+    std::vector<std::vector<float>> float_panels_;
+    std::vector<std::vector<int16_t>> int_panels_;
+
+    std::mutex lock_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+    // Guarded by lock_.
+    const std::function<void(size_t, size_t)> *job_ = nullptr;
+    size_t job_chunks_ = 0;
+    uint64_t generation_ = 0;
+    size_t active_workers_ = 0;
+    bool done_ = false;
+    std::atomic<size_t> next_chunk_{0};
+    std::atomic<size_t> chunks_done_{0};
+    std::vector<std::thread> workers_;
+};
+
+// Quantizes rows |low| and |high| (which may be null, for zeros) to int8s in
+// [-127, 127], rounding half to even, and interleaves them into pairs of
+// int16s in |out|, as the int8 GEMM kernels take them.
+void QuantizePairs(SimdLevel level, const float *low, const float *high,
+                   size_t count, float inverse_scale, int16_t *out);
+
+}  // namespace cam
+
+#endif // CPU_DETECTOR_H
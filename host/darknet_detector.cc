@@ -0,0 +1,32 @@
+#include "host/darknet_detector.h"
+
+#include <algorithm>
+
+namespace cam {
+
+DarknetDetector::DarknetDetector(const std::string &config_file,
+                                 const std::string &weight_file,
+                                 int batch_size)
+    : detector_(config_file, weight_file, /*gpu_id=*/0, batch_size) {}
+
+void DarknetDetector::DetectBatch(const float *input, int batch_size,
+                                  float threshold, size_t max_boxes,
+                                  std::vector<std::vector<bbox_t>> *boxes) {
+  // Darknet only reads the input, despite the pointer type.
+  image_t batch = {net_height(), net_width(), 3, const_cast<float *>(input)};
+  std::vector<std::vector<bbox_t>> detected = detector_.detectBatch(
+      batch, batch_size, net_width(), net_height(), threshold);
+  if (boxes->size() < detected.size()) {
+    boxes->resize(detected.size());
+  }
+  for (size_t i = 0; i < detected.size(); ++i) {
+    std::vector<bbox_t> &image_boxes = detected[i];
+    const size_t kept = std::min(image_boxes.size(), max_boxes);
+    std::partial_sort(
+        image_boxes.begin(), image_boxes.begin() + kept, image_boxes.end(),
+        [](const bbox_t &a, const bbox_t &b) { return a.prob > b.prob; });
+    (*boxes)[i].assign(image_boxes.begin(), image_boxes.begin() + kept);
+  }
+}
+
+}  // namespace cam
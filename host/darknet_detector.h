@@ -0,0 +1,34 @@
+#ifndef DARKNET_DETECTOR_H
+#define DARKNET_DETECTOR_H
+
+#include "host/object_detector.h"
+#include "include/yolo_v2_class.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace cam {
+
+// Runs a model through darknet itself, on the GPU if darknet was built with
+// one.
+class DarknetDetector : public ObjectDetector {
+  public:
+    DarknetDetector(const std::string &config_file,
+                    const std::string &weight_file, int batch_size);
+
+    int net_width() const override { return detector_.get_net_width(); }
+    int net_height() const override { return detector_.get_net_height(); }
+    bool fixed_batch_size() const override { return true; }
+
+    void DetectBatch(const float *input, int batch_size, float threshold,
+                     size_t max_boxes,
+                     std::vector<std::vector<bbox_t>> *boxes) override;
+
+  private:
+    Detector detector_;
+};
+
+}  // namespace cam
+
+#endif // DARKNET_DETECTOR_H
@@ -0,0 +1,180 @@
+#include "host/decode_pool.h"
+
+#include <algorithm>
+
+namespace cam {
+namespace {
+
+// Results are normally popped as soon as they're ready, so this leaves room
+// for a decode or two to finish while the consumer is busy.
+constexpr size_t kResultsPerCamera = 2;
+
+}  // namespace
+
+DecodePool::DecodePool(const Options &options, std::function<void()> on_result)
+    : decoder_(options.decoder), on_result_(std::move(on_result)) {
+  size_t num_threads = options.num_threads;
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (options.num_cameras > 0) {
+    AddCamera(options.num_cameras - 1);
+  }
+  stats_start_ = Clock::now();
+  // All of the workers exist before any thread starts, so workers_ never
+  // reallocates under them.
+  workers_.resize(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_[i].thread = std::thread([this, i]() { WorkerLoop(i); });
+  }
+}
+
+DecodePool::~DecodePool() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    done_ = true;
+  }
+  job_ready_.notify_all();
+  for (auto &worker : workers_) {
+    worker.thread.join();
+  }
+}
+
+void DecodePool::Submit(size_t camera, JpegFrame frame, int fit_width,
+                        int fit_height) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    AddCamera(camera);
+    Camera &slot = cameras_[camera];
+    slot.job.sequence = next_sequence_++;
+    slot.job.frame = std::move(frame);
+    slot.job.fit_width = fit_width;
+    slot.job.fit_height = fit_height;
+    if (slot.waiting) {
+      // Nobody's started on the older frame, so skip straight to this one.
+      frames_dropped_++;
+      return;
+    }
+    slot.waiting = true;
+    slot.waiting_since = slot.job.sequence;
+    jobs_waiting_++;
+  }
+  job_ready_.notify_one();
+}
+
+bool DecodePool::PopResult(Result *result) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (results_size_ == 0) {
+    return false;
+  }
+  *result = std::move(results_[results_start_]);
+  results_start_ = (results_start_ + 1) % results_.size();
+  results_size_--;
+  return true;
+}
+
+std::vector<DecodePool::WorkerStats> DecodePool::TakeWorkerStats() {
+  std::lock_guard<std::mutex> guard(lock_);
+  const auto now = Clock::now();
+  const std::chrono::duration<double> elapsed = now - stats_start_;
+  std::vector<WorkerStats> stats;
+  for (auto &worker : workers_) {
+    const std::chrono::duration<double> busy = worker.busy;
+    stats.push_back({.frames_decoded = worker.frames_decoded,
+                     .utilization = (elapsed.count() > 0)
+                                        ? busy.count() / elapsed.count()
+                                        : 0});
+    worker.frames_decoded = 0;
+    worker.busy = Clock::duration(0);
+  }
+  stats_start_ = now;
+  return stats;
+}
+
+size_t DecodePool::frames_dropped() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return frames_dropped_;
+}
+
+void DecodePool::AddCamera(size_t camera) {
+  if (camera < cameras_.size()) {
+    return;
+  }
+  cameras_.resize(camera + 1);
+  // Unrolls the ring into a bigger one.
+  std::vector<Result> results(cameras_.size() * kResultsPerCamera);
+  for (size_t i = 0; i < results_size_; ++i) {
+    results[i] = std::move(results_[(results_start_ + i) % results_.size()]);
+  }
+  results_.swap(results);
+  results_start_ = 0;
+}
+
+void DecodePool::PushResult(Result result) {
+  if (results_size_ == results_.size()) {
+    // Nobody's been popping, so the oldest result is stale anyway.
+    results_start_ = (results_start_ + 1) % results_.size();
+    results_size_--;
+    frames_dropped_++;
+  }
+  results_[(results_start_ + results_size_) % results_.size()] =
+      std::move(result);
+  results_size_++;
+}
+
+void DecodePool::WorkerLoop(size_t worker) {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    job_ready_.wait(lock, [this]() { return done_ || (jobs_waiting_ > 0); });
+    if (done_) {
+      return;
+    }
+    // Oldest first.
+    size_t camera = cameras_.size();
+    for (size_t i = 0; i < cameras_.size(); ++i) {
+      if (cameras_[i].waiting &&
+          ((camera == cameras_.size()) ||
+           (cameras_[i].waiting_since < cameras_[camera].waiting_since))) {
+        camera = i;
+      }
+    }
+    Job job = std::move(cameras_[camera].job);
+    cameras_[camera].waiting = false;
+    jobs_waiting_--;
+    lock.unlock();
+
+    const auto start = Clock::now();
+    job.frame.trace.decode_start = start;
+    Result result;
+    result.camera = camera;
+    if ((job.fit_width > 0) && (job.fit_height > 0)) {
+      result.image = decoder_.DecodeToFit(job.frame.bytes(), job.frame.size(),
+                                          job.fit_width, job.fit_height);
+    } else {
+      result.image = decoder_.Decode(job.frame.bytes(), job.frame.size());
+    }
+    const auto end = Clock::now();
+    job.frame.trace.decode_end = end;
+    result.frame = std::move(job.frame);
+
+    lock.lock();
+    workers_[worker].frames_decoded++;
+    // Only count the part of the decode inside the current stats window.
+    workers_[worker].busy += end - std::max(start, stats_start_);
+    uint64_t &newest_result = cameras_[camera].newest_result;
+    if (newest_result > job.sequence) {
+      // Another worker already finished a newer frame from this camera.
+      frames_dropped_++;
+      continue;
+    }
+    newest_result = job.sequence;
+    PushResult(std::move(result));
+    if (on_result_) {
+      lock.unlock();
+      on_result_();
+      lock.lock();
+    }
+  }
+}
+
+}  // namespace cam
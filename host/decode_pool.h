@@ -0,0 +1,130 @@
+#ifndef DECODE_POOL_H
+#define DECODE_POOL_H
+
+#include "host/cam_parser.h"
+#include "host/jpeg_decoder.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cam {
+
+// Decodes JPEGs from every camera on a fixed set of worker threads sharing one
+// work queue. Only the newest frame from each camera is worth decoding, so a
+// camera never has more than one frame waiting: submitting another replaces
+// it. Likewise, a decode which finishes after a newer frame from the same
+// camera is dropped, so results always come out in order per camera. Results
+// left unpopped for too long make way for newer ones too.
+//
+// This class is threadsafe.
+class DecodePool {
+  public:
+    struct Options {
+      // 0 means one per core.
+      size_t num_threads = 0;
+      // Cameras to make room for up front, so that submitting and popping
+      // frames doesn't allocate. Frames from other cameras still work, but
+      // allocate the first time each one comes up.
+      size_t num_cameras = 0;
+      JpegDecoder::Options decoder;
+    };
+
+    struct Result {
+      size_t camera = 0;
+      // The decoded frame's JPEG, still around for anything else that wants it.
+      JpegFrame frame;
+      DecodedJpeg image;
+    };
+
+    struct WorkerStats {
+      size_t frames_decoded = 0;
+      // Fraction of the time spent decoding.
+      double utilization = 0;
+    };
+
+    // |on_result| is called from a worker thread whenever a result is ready to
+    // be popped.
+    DecodePool(const Options &options, std::function<void()> on_result);
+    ~DecodePool();
+
+    DecodePool(const DecodePool &rhs) = delete;
+
+    // Queues |frame| to be decoded at full resolution, or scaled down to fit
+    // |fit_width| x |fit_height| if they're non-zero.
+    void Submit(size_t camera, JpegFrame frame, int fit_width = 0,
+                int fit_height = 0);
+
+    // Pops a finished decode. Returns false if there aren't any.
+    bool PopResult(Result *result);
+
+    // Per-worker stats since the last call.
+    std::vector<WorkerStats> TakeWorkerStats();
+
+    // Frames replaced before a worker got to them, decoded too late, or never
+    // popped.
+    size_t frames_dropped();
+
+    size_t num_threads() const { return workers_.size(); }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+      uint64_t sequence = 0;
+      JpegFrame frame;
+      int fit_width = 0;
+      int fit_height = 0;
+    };
+
+    struct Camera {
+      // Whether job is waiting for a worker, and since which sequence
+      // number. Replacing the job doesn't lose its place in line.
+      bool waiting = false;
+      uint64_t waiting_since = 0;
+      Job job;
+      // Sequence number of the newest result.
+      uint64_t newest_result = 0;
+    };
+
+    struct Worker {
+      std::thread thread;
+      // Guarded by lock_.
+      size_t frames_decoded = 0;
+      Clock::duration busy{0};
+    };
+
+    // Makes room for |camera|'s job and results. Must hold lock_.
+    void AddCamera(size_t camera);
+    // Queues |result|, dropping the oldest one if the ring is full. Must hold
+    // lock_.
+    void PushResult(Result result);
+    void WorkerLoop(size_t worker);
+
+    JpegDecoder decoder_;
+    std::function<void()> on_result_;
+
+    std::mutex lock_;
+    std::condition_variable job_ready_;
+    bool done_ = false;
+    // By camera.
+    std::vector<Camera> cameras_;
+    size_t jobs_waiting_ = 0;
+    uint64_t next_sequence_ = 0;
+    // Results not yet popped, as a ring of results_size_ starting at
+    // results_start_.
+    std::vector<Result> results_;
+    size_t results_start_ = 0;
+    size_t results_size_ = 0;
+    size_t frames_dropped_ = 0;
+    std::vector<Worker> workers_;
+    Clock::time_point stats_start_;
+};
+
+}  // namespace cam
+
+#endif // DECODE_POOL_H
@@ -0,0 +1,312 @@
+// Runs the same frames through every detector backend this build has, and
+// reports each one's throughput and how closely its boxes agree with the first
+// (darknet if built with it, otherwise the float CPU backend).
+//
+// Usage: detector_benchmark --config yolov4.cfg --weights yolov4.weights
+//                           (--segment file | --jpeg file) [--frames n]
+//                           [--batch n] [--threads n] [--threshold t]
+//
+// Frames come from a recorded segment, or are copies of a single JPEG. They're
+// stretched to the network's input size, so every backend sees exactly the same
+// pixels.
+
+#include "host/cpu_detector.h"
+#include "host/detector_factory.h"
+#include "host/image_ops.h"
+#include "host/jpeg_decoder.h"
+#include "host/object_detector.h"
+#include "host/segment_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Boxes count as the same detection above this IoU, as in the PASCAL VOC and
+// COCO mAP@0.5 metrics.
+constexpr float kMatchIou = 0.5f;
+// Every box is compared, however many there are.
+constexpr size_t kAllBoxes = std::numeric_limits<size_t>::max();
+
+struct Args {
+  std::string config;
+  std::string weights;
+  std::string segment;
+  std::string jpeg;
+  int frames = 50;
+  int batch = 4;
+  size_t threads = 0;
+  float threshold = 0.2f;
+};
+
+bool ParseArgs(int argc, char *argv[], Args *args) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string flag = argv[i];
+    const char *value = argv[i + 1];
+    if (flag == "--config") {
+      args->config = value;
+    } else if (flag == "--weights") {
+      args->weights = value;
+    } else if (flag == "--segment") {
+      args->segment = value;
+    } else if (flag == "--jpeg") {
+      args->jpeg = value;
+    } else if (flag == "--frames") {
+      args->frames = atoi(value);
+    } else if (flag == "--batch") {
+      args->batch = std::max(1, atoi(value));
+    } else if (flag == "--threads") {
+      args->threads = atoi(value);
+    } else if (flag == "--threshold") {
+      args->threshold = atof(value);
+    } else {
+      return false;
+    }
+  }
+  return ((argc % 2) == 1) && !args->config.empty() &&
+         !args->weights.empty() &&
+         (args->segment.empty() != args->jpeg.empty());
+}
+
+bool LoadJpegs(const Args &args, std::vector<std::string> *jpegs) {
+  if (!args.segment.empty()) {
+    auto segment = cam::SegmentReader::Open(args.segment);
+    if (!segment) {
+      return false;
+    }
+    for (size_t i = 0;
+         (i < segment->num_frames()) && (jpegs->size() < (size_t)args.frames);
+         ++i) {
+      const cam::ByteSpan jpeg = segment->jpeg(i);
+      jpegs->emplace_back(reinterpret_cast<const char *>(jpeg.data),
+                          jpeg.size);
+    }
+  } else {
+    std::ifstream file(args.jpeg, std::ios::in | std::ios::binary);
+    if (!file.good()) {
+      std::cerr << "Could not open " << args.jpeg << std::endl;
+      return false;
+    }
+    jpegs->emplace_back(std::istreambuf_iterator<char>(file),
+                        std::istreambuf_iterator<char>());
+    jpegs->resize(args.frames, jpegs->front());
+  }
+  return !jpegs->empty();
+}
+
+// Decodes every frame and stretches it into a planar float network input.
+bool PrepareInputs(const std::vector<std::string> &jpegs, int net_width,
+                   int net_height, std::vector<std::vector<float>> *inputs) {
+  cam::JpegDecoder decoder{cam::JpegDecoder::Options()};
+  const size_t plane = static_cast<size_t>(net_width) * net_height;
+  std::vector<uint8_t> resized(plane * 3);
+  cam::ResizeScratch scratch;
+  for (const std::string &jpeg : jpegs) {
+    const cam::DecodedJpeg image = decoder.DecodeToFit(
+        reinterpret_cast<const uint8_t *>(jpeg.data()), jpeg.size(),
+        net_width, net_height);
+    if (!image.data) {
+      std::cerr << "Could not decode frame " << inputs->size() << std::endl;
+      return false;
+    }
+    cam::ResizeBilinear(image.data->data(), image.width, image.height,
+                        resized.data(), net_width, net_height, &scratch);
+    std::vector<float> input(plane * 3);
+    cam::InterleavedToPlanar(resized.data(), plane, input.data(),
+                             input.data() + plane, input.data() + 2 * plane);
+    inputs->push_back(std::move(input));
+  }
+  return true;
+}
+
+struct Run {
+  double frames_per_second = 0;
+  std::vector<std::vector<bbox_t>> boxes;
+};
+
+Run RunBackend(cam::ObjectDetector *detector, const Args &args,
+               const std::vector<std::vector<float>> &inputs) {
+  const size_t image_size = inputs.front().size();
+  // Unused slots of a fixed size batch are left gray, as in
+  // ImageProcessingModule.
+  std::vector<float> batch(args.batch * image_size, 0.5f);
+  Run run;
+  std::vector<std::vector<bbox_t>> boxes;
+  // One untimed batch first, to fault in buffers and warm up caches.
+  std::copy(inputs.front().begin(), inputs.front().end(), batch.begin());
+  detector->DetectBatch(batch.data(),
+                        detector->fixed_batch_size() ? args.batch : 1,
+                        args.threshold, kAllBoxes, &boxes);
+
+  const auto start = Clock::now();
+  for (size_t first = 0; first < inputs.size(); first += args.batch) {
+    const size_t count = std::min<size_t>(args.batch, inputs.size() - first);
+    for (size_t i = 0; i < count; ++i) {
+      std::copy(inputs[first + i].begin(), inputs[first + i].end(),
+                batch.begin() + i * image_size);
+    }
+    const int batch_size =
+        detector->fixed_batch_size() ? args.batch : static_cast<int>(count);
+    detector->DetectBatch(batch.data(), batch_size, args.threshold, kAllBoxes,
+                          &boxes);
+    run.boxes.insert(run.boxes.end(), boxes.begin(), boxes.begin() + count);
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  run.frames_per_second = inputs.size() / seconds;
+  return run;
+}
+
+struct Agreement {
+  size_t reference_boxes = 0;
+  size_t boxes = 0;
+  size_t matched = 0;
+  double iou_sum = 0;
+};
+
+// Greedily pairs up boxes of the same class, most confident reference boxes
+// first, each with the unpaired box it overlaps most.
+Agreement Compare(const std::vector<std::vector<bbox_t>> &reference,
+                  const std::vector<std::vector<bbox_t>> &boxes) {
+  Agreement agreement;
+  for (size_t frame = 0; frame < reference.size(); ++frame) {
+    std::vector<bbox_t> expected = reference[frame];
+    std::sort(expected.begin(), expected.end(),
+              [](const bbox_t &a, const bbox_t &b) { return a.prob > b.prob; });
+    std::vector<bool> paired(boxes[frame].size(), false);
+    for (const bbox_t &want : expected) {
+      float best_iou = kMatchIou;
+      int best = -1;
+      for (size_t i = 0; i < boxes[frame].size(); ++i) {
+        const bbox_t &got = boxes[frame][i];
+        if (paired[i] || (got.obj_id != want.obj_id)) {
+          continue;
+        }
+        const float iou = cam::IntersectionOverUnion(want, got);
+        if (iou >= best_iou) {
+          best_iou = iou;
+          best = i;
+        }
+      }
+      if (best >= 0) {
+        paired[best] = true;
+        agreement.matched++;
+        agreement.iou_sum += best_iou;
+      }
+    }
+    agreement.reference_boxes += expected.size();
+    agreement.boxes += boxes[frame].size();
+  }
+  return agreement;
+}
+
+// Checks that every SIMD level quantizes like the scalar code, rounding ties
+// to even, including out of range values and a tail too short for a vector.
+bool CheckQuantization() {
+  std::vector<float> values;
+  for (int i = -261; i <= 261; ++i) {
+    values.push_back(i * 0.5f);
+  }
+  std::vector<int16_t> expected(2 * values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    float rounded = std::floor(values[i]);
+    const float fraction = values[i] - rounded;
+    if ((fraction > 0.5f) ||
+        ((fraction == 0.5f) && (std::fmod(rounded, 2.0f) != 0))) {
+      rounded += 1;
+    }
+    expected[2 * i] = std::clamp(rounded, -127.0f, 127.0f);
+    expected[2 * i + 1] = 0;
+  }
+  bool ok = true;
+  for (int level = 0; level <= static_cast<int>(cam::DetectSimdLevel());
+       ++level) {
+    const auto simd = static_cast<cam::SimdLevel>(level);
+    std::vector<int16_t> quantized(expected.size());
+    cam::QuantizePairs(simd, values.data(), nullptr, values.size(), 1.0f,
+                       quantized.data());
+    const bool matches = (quantized == expected);
+    ok &= matches;
+    std::cout << cam::SimdLevelName(simd) << " int8 quantization"
+              << (matches ? " rounds half to even" : ": MISMATCH")
+              << std::endl;
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Args args;
+  if (!ParseArgs(argc, argv, &args)) {
+    std::cerr << "Usage: detector_benchmark --config cfg --weights weights "
+                 "(--segment file | --jpeg file) [--frames n] [--batch n] "
+                 "[--threads n] [--threshold t]"
+              << std::endl;
+    return -1;
+  }
+  std::vector<std::string> jpegs;
+  if (!LoadJpegs(args, &jpegs)) {
+    return -1;
+  }
+  std::cout << "SIMD: " << cam::SimdLevelName(cam::DetectSimdLevel())
+            << std::endl;
+  if (!CheckQuantization()) {
+    return -1;
+  }
+
+  std::vector<std::vector<float>> inputs;
+  Run reference;
+  for (cam::DetectorBackend backend : cam::AvailableDetectorBackends()) {
+    const char *name = cam::DetectorBackendName(backend);
+    cam::DetectorOptions options;
+    options.backend = backend;
+    options.batch_size = args.batch;
+    options.cpu_threads = args.threads;
+    std::unique_ptr<cam::ObjectDetector> detector =
+        cam::LoadDetector(args.config, args.weights, options);
+    if (!detector) {
+      std::cerr << name << ": could not load the model." << std::endl;
+      continue;
+    }
+    if (inputs.empty() &&
+        !PrepareInputs(jpegs, detector->net_width(), detector->net_height(),
+                       &inputs)) {
+      return -1;
+    }
+
+    Run run = RunBackend(detector.get(), args, inputs);
+    std::cout << name << ": " << run.frames_per_second << " frames/s";
+    if (reference.boxes.empty()) {
+      size_t boxes = 0;
+      for (const auto &frame_boxes : run.boxes) {
+        boxes += frame_boxes.size();
+      }
+      std::cout << ", " << boxes << " boxes (reference)" << std::endl;
+      reference = std::move(run);
+      continue;
+    }
+    const Agreement agreement = Compare(reference.boxes, run.boxes);
+    const auto ratio = [](double num, double den) {
+      return (den > 0) ? num / den : 1.0;
+    };
+    std::cout << ", " << agreement.boxes << " boxes, recall "
+              << ratio(agreement.matched, agreement.reference_boxes)
+              << ", precision " << ratio(agreement.matched, agreement.boxes)
+              << ", mean IoU " << ratio(agreement.iou_sum, agreement.matched)
+              << ", speedup "
+              << run.frames_per_second / reference.frames_per_second
+              << std::endl;
+  }
+  return reference.boxes.empty() ? -1 : 0;
+}
@@ -0,0 +1,76 @@
+#include "host/detector_factory.h"
+
+#include "host/cpu_detector.h"
+#ifdef HAVE_DARKNET
+#include "host/darknet_detector.h"
+#endif
+
+#include <iostream>
+
+namespace cam {
+
+DetectorBackend DefaultDetectorBackend() {
+#ifdef HAVE_DARKNET
+  return DetectorBackend::kDarknet;
+#else
+  return DetectorBackend::kCpu;
+#endif
+}
+
+std::vector<DetectorBackend> AvailableDetectorBackends() {
+  std::vector<DetectorBackend> backends;
+#ifdef HAVE_DARKNET
+  backends.push_back(DetectorBackend::kDarknet);
+#endif
+  backends.push_back(DetectorBackend::kCpu);
+  backends.push_back(DetectorBackend::kCpuInt8);
+  return backends;
+}
+
+const char *DetectorBackendName(DetectorBackend backend) {
+  switch (backend) {
+    case DetectorBackend::kDarknet:
+      return "darknet";
+    case DetectorBackend::kCpu:
+      return "cpu";
+    case DetectorBackend::kCpuInt8:
+      return "cpu_int8";
+  }
+  return "unknown";
+}
+
+bool ParseDetectorBackend(const std::string &name, DetectorBackend *backend) {
+  for (DetectorBackend candidate :
+       {DetectorBackend::kDarknet, DetectorBackend::kCpu,
+        DetectorBackend::kCpuInt8}) {
+    if (name == DetectorBackendName(candidate)) {
+      *backend = candidate;
+      return true;
+    }
+  }
+  std::cerr << "Unknown detector backend " << name
+            << " (expected darknet, cpu or cpu_int8)." << std::endl;
+  return false;
+}
+
+std::unique_ptr<ObjectDetector> LoadDetector(const std::string &config_file,
+                                             const std::string &weight_file,
+                                             const DetectorOptions &options) {
+  if (options.backend == DetectorBackend::kDarknet) {
+#ifdef HAVE_DARKNET
+    return std::make_unique<DarknetDetector>(config_file, weight_file,
+                                             options.batch_size);
+#else
+    std::cerr << "This build has no darknet. Build without "
+                 "--define detector=cpu, or pick a CPU detector backend."
+              << std::endl;
+    return nullptr;
+#endif
+  }
+  CpuDetector::Options cpu_options;
+  cpu_options.num_threads = options.cpu_threads;
+  cpu_options.int8 = (options.backend == DetectorBackend::kCpuInt8);
+  return CpuDetector::Create(config_file, weight_file, cpu_options);
+}
+
+}  // namespace cam
@@ -0,0 +1,48 @@
+#ifndef DETECTOR_FACTORY_H
+#define DETECTOR_FACTORY_H
+
+#include "host/object_detector.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cam {
+
+enum class DetectorBackend {
+  // Darknet itself, on the GPU. Only available in builds with darknet (i.e.
+  // not --define detector=cpu).
+  kDarknet,
+  // CpuDetector, in float.
+  kCpu,
+  // CpuDetector, with 8-bit quantized convolutions.
+  kCpuInt8,
+};
+
+// Darknet if this build has it, the CPU otherwise.
+DetectorBackend DefaultDetectorBackend();
+// The backends this build can load.
+std::vector<DetectorBackend> AvailableDetectorBackends();
+
+// "darknet", "cpu" or "cpu_int8".
+const char *DetectorBackendName(DetectorBackend backend);
+bool ParseDetectorBackend(const std::string &name, DetectorBackend *backend);
+
+struct DetectorOptions {
+  DetectorBackend backend = DefaultDetectorBackend();
+  // Batch size the model is loaded with, for backends with a fixed one.
+  int batch_size = 1;
+  // For the CPU backends. 0 means one per core.
+  size_t cpu_threads = 0;
+};
+
+// Loads a darknet .cfg and .weights with the chosen backend. Returns nullptr
+// (and logs why) on failure.
+std::unique_ptr<ObjectDetector> LoadDetector(const std::string &config_file,
+                                             const std::string &weight_file,
+                                             const DetectorOptions &options);
+
+}  // namespace cam
+
+#endif // DETECTOR_FACTORY_H
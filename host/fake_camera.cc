@@ -0,0 +1,113 @@
+// Serves an ESP32-style MJPEG stream on a local port, so that host_client can
+// be run without a camera.
+//
+// Usage: fake_camera port [fps] [frames_per_connection] [jpeg_file]
+//
+// With frames_per_connection > 0, each stream is ended with a zero-length
+// chunk after that many frames, which exercises the client's reconnect path.
+// Without a jpeg_file, frames are random bytes of a typical JPEG size.
+
+#include "host/mjpeg_stream.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+namespace {
+
+bool SendAll(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t len =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (len <= 0) {
+      return false;
+    }
+    sent += len;
+  }
+  return true;
+}
+
+void ServeClient(int fd, const std::string &jpeg, int fps, int frames) {
+  // Wait for the request. Its contents don't matter.
+  char request[1024];
+  if (read(fd, request, sizeof(request)) <= 0) {
+    close(fd);
+    return;
+  }
+
+  const auto frame_period = std::chrono::microseconds(1000000 / fps);
+  auto next_frame = std::chrono::steady_clock::now();
+  bool ok = SendAll(fd, cam::StreamHeader(cam::kDefaultBoundary, fps));
+  for (int i = 0; ok && ((frames == 0) || (i < frames)); ++i) {
+    const double timestamp =
+        std::chrono::duration<double>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    ok = SendAll(fd, cam::FrameChunks(jpeg, timestamp));
+    next_frame += frame_period;
+    std::this_thread::sleep_until(next_frame);
+  }
+  if (ok) {
+    SendAll(fd, cam::EndOfStream());
+  }
+  close(fd);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int fps = (argc > 2) ? atoi(argv[2]) : 30;
+  // The frame period is 1/fps, so anything but a positive fps is meaningless.
+  if ((argc < 2) || (fps <= 0)) {
+    std::cerr << "Usage: fake_camera port [fps] [frames_per_connection] "
+                 "[jpeg_file]"
+              << std::endl;
+    return -1;
+  }
+  const int port = atoi(argv[1]);
+  const int frames = (argc > 3) ? atoi(argv[3]) : 0;
+  std::string jpeg = cam::RandomPayload(60 * 1024);
+  if (argc > 4) {
+    std::ifstream jpeg_file(argv[4], std::ios::in | std::ios::binary);
+    if (!jpeg_file.good()) {
+      std::cerr << "Could not open " << argv[4] << std::endl;
+      return -1;
+    }
+    jpeg.assign(std::istreambuf_iterator<char>(jpeg_file),
+                std::istreambuf_iterator<char>());
+  }
+
+  const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  const int reuse = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if ((bind(listen_fd, reinterpret_cast<sockaddr *>(&address),
+            sizeof(address)) != 0) ||
+      (listen(listen_fd, 16) != 0)) {
+    std::cerr << "Could not listen on port " << port << ": " << strerror(errno)
+              << std::endl;
+    return -1;
+  }
+  std::cout << "Serving " << fps << " fps on 127.0.0.1:" << port << std::endl;
+
+  while (true) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd == -1) {
+      continue;
+    }
+    std::thread(ServeClient, fd, jpeg, fps, frames).detach();
+  }
+}
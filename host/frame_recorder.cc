@@ -0,0 +1,127 @@
+#include "host/frame_recorder.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace cam {
+
+namespace {
+
+// Wall clock equivalent of a steady clock time point in the recent past.
+int64_t ToUnixMicros(std::chrono::steady_clock::time_point time) {
+  const auto age = std::chrono::steady_clock::now() - time;
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             (std::chrono::system_clock::now() - age).time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+FrameRecorder::FrameRecorder(const Options &options,
+                             std::vector<std::string> camera_prefixes)
+    : options_(options), buffers_(options.max_pending) {
+  for (auto &prefix : camera_prefixes) {
+    Camera camera;
+    camera.prefix = std::move(prefix);
+    cameras_.push_back(std::move(camera));
+  }
+  io_thread_ = std::thread([this]() { IoLoop(); });
+}
+
+FrameRecorder::~FrameRecorder() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    done_ = true;
+  }
+  pending_ready_.notify_one();
+  io_thread_.join();
+}
+
+void FrameRecorder::Record(size_t camera, const JpegFrame &frame) {
+  const auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    Camera &state = cameras_[camera];
+    if (now - state.last_recorded < options_.min_interval) {
+      return;
+    }
+    state.last_recorded = now;
+    if (pending_.size() >= options_.max_pending) {
+      frames_dropped_++;
+      return;
+    }
+  }
+
+  // Copy outside the lock. The parser's buffer goes on to be decoded.
+  BufferPool::Buffer jpeg = buffers_.Acquire(frame.size());
+  std::memcpy(jpeg->data(), frame.bytes(), frame.size());
+  const auto received = (frame.trace.parsed == FrameTrace::Clock::time_point())
+                            ? now
+                            : frame.trace.parsed;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    pending_.push_back({.camera = camera,
+                        .jpeg = std::move(jpeg),
+                        .received_unix_us = ToUnixMicros(received),
+                        .capture_timestamp_us = frame.capture_timestamp_us});
+  }
+  pending_ready_.notify_one();
+}
+
+size_t FrameRecorder::frames_recorded() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return frames_recorded_;
+}
+
+size_t FrameRecorder::frames_dropped() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return frames_dropped_;
+}
+
+void FrameRecorder::IoLoop() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    pending_ready_.wait(lock, [this]() { return done_ || !pending_.empty(); });
+    if (pending_.empty()) {
+      // Only get here once done_ is set and everything's been written.
+      break;
+    }
+    Pending pending = std::move(pending_.front());
+    pending_.pop_front();
+    lock.unlock();
+    Write(&pending);
+    lock.lock();
+  }
+  lock.unlock();
+  for (auto &camera : cameras_) {
+    camera.segment.reset();
+  }
+}
+
+void FrameRecorder::Write(Pending *pending) {
+  Camera &camera = cameras_[pending->camera];
+  const ByteSpan jpeg{pending->jpeg->data(), pending->jpeg->size()};
+  bool written = camera.segment &&
+                 camera.segment->Append(jpeg, pending->received_unix_us,
+                                        pending->capture_timestamp_us);
+  if (!written) {
+    // The segment is full (or there isn't one yet), so start the next one.
+    camera.segment = SegmentWriter::Create(
+        options_.directory + "/" + camera.prefix + "_" +
+            std::to_string(pending->received_unix_us) + ".seg",
+        options_.segment_bytes, options_.max_frames_per_segment,
+        pending->received_unix_us);
+    written = camera.segment &&
+              camera.segment->Append(jpeg, pending->received_unix_us,
+                                     pending->capture_timestamp_us);
+  }
+
+  std::lock_guard<std::mutex> guard(lock_);
+  if (written) {
+    frames_recorded_++;
+  } else {
+    frames_dropped_++;
+  }
+}
+
+}  // namespace cam
@@ -0,0 +1,93 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include "host/buffer_pool.h"
+#include "host/cam_parser.h"
+#include "host/segment_file.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cam {
+
+// Continuously records every camera's JPEGs into segment files (see
+// segment_file.h), one series per camera, named
+//
+//   <directory>/<camera prefix>_<segment start, us since the epoch>.seg
+//
+// so that starting up never needs to look at what's already recorded. All of
+// the disk I/O happens on a background thread, so Record() never blocks on the
+// disk. If the disk falls behind, frames are dropped rather than queued
+// without bound.
+//
+// This class is threadsafe.
+class FrameRecorder {
+  public:
+    struct Options {
+      std::string directory;
+      // Each segment is preallocated to this size.
+      size_t segment_bytes = 256 * 1024 * 1024;  // 256MB.
+      uint32_t max_frames_per_segment = 16384;
+      // Frames waiting for the I/O thread, across all cameras.
+      size_t max_pending = 64;
+      // Record at most one frame per camera this often. 0 records every frame.
+      std::chrono::milliseconds min_interval{0};
+    };
+
+    FrameRecorder(const Options &options,
+                  std::vector<std::string> camera_prefixes);
+    // Writes out whatever's still queued.
+    ~FrameRecorder();
+
+    FrameRecorder(const FrameRecorder &rhs) = delete;
+
+    // Queues a copy of |frame| to be appended to |camera|'s current segment.
+    void Record(size_t camera, const JpegFrame &frame);
+
+    size_t frames_recorded();
+    // Frames dropped because the I/O thread fell behind or couldn't write.
+    size_t frames_dropped();
+
+  private:
+    struct Pending {
+      size_t camera;
+      BufferPool::Buffer jpeg;
+      int64_t received_unix_us;
+      int64_t capture_timestamp_us;
+    };
+
+    struct Camera {
+      std::string prefix;
+      // Only touched by the I/O thread.
+      std::unique_ptr<SegmentWriter> segment;
+      // Guarded by lock_.
+      std::chrono::steady_clock::time_point last_recorded;
+    };
+
+    void IoLoop();
+    void Write(Pending *pending);
+
+    Options options_;
+    BufferPool buffers_;
+
+    std::mutex lock_;
+    std::condition_variable pending_ready_;
+    std::deque<Pending> pending_;
+    bool done_ = false;
+    size_t frames_recorded_ = 0;
+    size_t frames_dropped_ = 0;
+    std::vector<Camera> cameras_;
+
+    std::thread io_thread_;
+};
+
+}  // namespace cam
+
+#endif // FRAME_RECORDER_H
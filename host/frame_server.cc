@@ -0,0 +1,186 @@
+#include "host/frame_server.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace cam {
+namespace {
+
+// Viewers only ever send short commands, so anything longer is garbage.
+constexpr size_t kMaxRequestLength = 256;
+
+}  // namespace
+
+std::unique_ptr<FrameServer> FrameServer::Create(const std::string &socket_path,
+                                                 size_t num_cameras) {
+  std::unique_ptr<FrameServer> server(new FrameServer(num_cameras));
+  server->socket_ =
+      UnixSocketServer::Create(socket_path, "frame server", server.get());
+  if (!server->socket_) {
+    return nullptr;
+  }
+  return server;
+}
+
+FrameServer::FrameServer(size_t num_cameras)
+    : num_cameras_(num_cameras),
+      subscribers_(new std::atomic<int>[num_cameras]),
+      offered_(num_cameras) {
+  for (size_t camera = 0; camera < num_cameras_; ++camera) {
+    subscribers_[camera] = 0;
+  }
+}
+
+void FrameServer::Offer(size_t camera, const JpegFrame &frame) {
+  if ((camera >= num_cameras_) || (subscribers_[camera] == 0)) {
+    return;
+  }
+  // Build the whole message here, so that the frame's buffer can go back to
+  // its pool as soon as this returns.
+  char header[64];
+  const int header_size = snprintf(header, sizeof(header), "frame %zu %zu\n",
+                                   camera, frame.size());
+  auto message = std::make_shared<std::string>();
+  message->reserve(header_size + frame.size());
+  message->append(header, header_size);
+  message->append(reinterpret_cast<const char *>(frame.bytes()), frame.size());
+
+  bool was_empty = true;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (const Message &offered : offered_) {
+      was_empty = was_empty && !offered;
+    }
+    offered_[camera] = std::move(message);
+  }
+  // Run() only needs waking once per batch of frames.
+  if (was_empty) {
+    socket_->Wake();
+  }
+}
+
+void FrameServer::Run() { socket_->Run(); }
+
+void FrameServer::Stop() { socket_->Stop(); }
+
+bool FrameServer::OnConnect(int fd) {
+  Viewer viewer;
+  viewer.fd = fd;
+  viewer.subscribed.resize(num_cameras_, false);
+  viewer.next.resize(num_cameras_);
+  viewer.current = std::make_shared<const std::string>(
+      "cameras " + std::to_string(num_cameras_) + "\n");
+  viewers_[fd] = std::move(viewer);
+  return Flush(&viewers_[fd]);
+}
+
+bool FrameServer::OnReceive(int fd, const char *data, size_t size) {
+  Viewer *viewer = &viewers_[fd];
+  viewer->request.append(data, size);
+  size_t newline;
+  while ((newline = viewer->request.find('\n')) != std::string::npos) {
+    const std::string line = viewer->request.substr(0, newline);
+    viewer->request.erase(0, newline + 1);
+    char command[16];
+    size_t camera;
+    if ((sscanf(line.c_str(), "%15s %zu", command, &camera) != 2) ||
+        (camera >= num_cameras_)) {
+      std::cerr << "Ignoring viewer request: " << line << std::endl;
+      continue;
+    }
+    if (strcmp(command, "subscribe") == 0) {
+      Subscribe(viewer, camera, true);
+    } else if (strcmp(command, "unsubscribe") == 0) {
+      Subscribe(viewer, camera, false);
+    } else {
+      std::cerr << "Ignoring viewer request: " << line << std::endl;
+    }
+  }
+  return viewer->request.size() <= kMaxRequestLength;
+}
+
+bool FrameServer::OnWritable(int fd) {
+  auto it = viewers_.find(fd);
+  return (it != viewers_.end()) && Flush(&it->second);
+}
+
+void FrameServer::OnDisconnect(int fd) {
+  auto it = viewers_.find(fd);
+  if (it == viewers_.end()) {
+    return;
+  }
+  for (size_t camera = 0; camera < num_cameras_; ++camera) {
+    Subscribe(&it->second, camera, false);
+  }
+  viewers_.erase(it);
+}
+
+void FrameServer::OnWake() {
+  std::vector<Message> offered(num_cameras_);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    offered.swap(offered_);
+  }
+  std::vector<int> disconnected;
+  for (auto &[fd, viewer] : viewers_) {
+    for (size_t camera = 0; camera < num_cameras_; ++camera) {
+      // Replaces any older frame the viewer hasn't been sent yet.
+      if (offered[camera] && viewer.subscribed[camera]) {
+        viewer.next[camera] = offered[camera];
+      }
+    }
+    if (!Flush(&viewer)) {
+      disconnected.push_back(fd);
+    }
+  }
+  for (int fd : disconnected) {
+    socket_->Disconnect(fd);
+  }
+}
+
+void FrameServer::Subscribe(Viewer *viewer, size_t camera, bool subscribe) {
+  if (viewer->subscribed[camera] == subscribe) {
+    return;
+  }
+  viewer->subscribed[camera] = subscribe;
+  subscribers_[camera] += subscribe ? 1 : -1;
+  if (!subscribe) {
+    viewer->next[camera].reset();
+  }
+}
+
+bool FrameServer::Flush(Viewer *viewer) {
+  while (true) {
+    if (!viewer->current) {
+      for (size_t i = 0; i < num_cameras_ && !viewer->current; ++i) {
+        const size_t camera = (viewer->next_camera + i) % num_cameras_;
+        if (viewer->next[camera]) {
+          viewer->current = std::move(viewer->next[camera]);
+          viewer->next[camera].reset();
+          viewer->next_camera = camera + 1;
+        }
+      }
+      if (!viewer->current) {
+        break;
+      }
+      viewer->written = 0;
+    }
+    const std::string &message = *viewer->current;
+    size_t sent;
+    if (!socket_->Send(viewer->fd, message.data() + viewer->written,
+                       message.size() - viewer->written, &sent)) {
+      return false;
+    }
+    viewer->written += sent;
+    if (viewer->written < message.size()) {
+      // The socket is full.
+      break;
+    }
+    viewer->current.reset();
+  }
+  socket_->WatchWritable(viewer->fd, viewer->current != nullptr);
+  return true;
+}
+
+}  // namespace cam
@@ -0,0 +1,103 @@
+#ifndef FRAME_SERVER_H
+#define FRAME_SERVER_H
+
+#include "host/cam_parser.h"
+#include "host/unix_socket_server.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cam {
+
+// Where host_headless serves frames, and viewers look for them.
+inline constexpr char kFrameSocket[] = "/tmp/argos_frames.sock";
+
+// Serves camera frames, as the JPEGs the cameras sent, to viewers attached
+// over a Unix domain socket. A viewer only gets the cameras it asks for, by
+// sending lines of
+//
+//   subscribe <camera>
+//   unsubscribe <camera>
+//
+// On connecting, it's sent "cameras <number of cameras>\n". Each frame then
+// comes as a header line followed by the JPEG itself:
+//
+//   frame <camera> <JPEG size in bytes>\n<JPEG>
+//
+// Offering a frame nobody subscribed to costs next to nothing, and all socket
+// I/O happens on the thread running Run(). A viewer which can't keep up skips
+// frames rather than falling behind: it's only ever sent the newest frame from
+// each camera.
+//
+// This class is threadsafe.
+class FrameServer : private UnixSocketServer::Handler {
+  public:
+    // Returns nullptr (and logs why) if the socket can't be opened.
+    static std::unique_ptr<FrameServer> Create(const std::string &socket_path,
+                                               size_t num_cameras);
+
+    FrameServer(const FrameServer &rhs) = delete;
+
+    // Passes |frame| on to the viewers subscribed to |camera|, if any.
+    void Offer(size_t camera, const JpegFrame &frame);
+
+    // Accepts viewers and sends them frames until Stop() is called.
+    void Run();
+    void Stop();
+
+  private:
+    using Message = std::shared_ptr<const std::string>;
+
+    struct Viewer {
+      int fd = -1;
+      // Partial request line.
+      std::string request;
+      std::vector<bool> subscribed;
+      // Newest frame from each camera not yet started on.
+      std::vector<Message> next;
+      // Camera to check first for the next frame, so that every camera gets a
+      // turn.
+      size_t next_camera = 0;
+      // Message being written, and how much of it has been.
+      Message current;
+      size_t written = 0;
+    };
+
+    explicit FrameServer(size_t num_cameras);
+
+    // UnixSocketServer::Handler.
+    bool OnConnect(int fd) override;
+    // Handles the viewer's requests.
+    bool OnReceive(int fd, const char *data, size_t size) override;
+    bool OnWritable(int fd) override;
+    void OnDisconnect(int fd) override;
+    // Hands every offered frame to its subscribers.
+    void OnWake() override;
+
+    void Subscribe(Viewer *viewer, size_t camera, bool subscribe);
+    // Writes as much as the socket takes. Returns false on error.
+    bool Flush(Viewer *viewer);
+
+    size_t num_cameras_;
+    std::unique_ptr<UnixSocketServer> socket_;
+    // Viewers subscribed to each camera. Only written by Run(), but read by
+    // Offer().
+    std::unique_ptr<std::atomic<int>[]> subscribers_;
+
+    std::mutex lock_;
+    // Guarded by lock_. Newest frame offered from each camera, not yet
+    // distributed.
+    std::vector<Message> offered_;
+
+    // Only touched by Run(), by fd.
+    std::unordered_map<int, Viewer> viewers_;
+};
+
+}  // namespace cam
+
+#endif // FRAME_SERVER_H
@@ -0,0 +1,122 @@
+#include "host/frame_trace.h"
+
+#include <algorithm>
+
+namespace cam {
+
+const char *StageName(Stage stage) {
+  switch (stage) {
+    case Stage::kReceive:
+      return "receive";
+    case Stage::kDecodeWait:
+      return "decode_wait";
+    case Stage::kDecode:
+      return "decode";
+    case Stage::kInferenceWait:
+      return "inference_wait";
+    case Stage::kInference:
+      return "inference";
+    case Stage::kRender:
+      return "render";
+    case Stage::kDetectionTotal:
+      return "detection_total";
+    case Stage::kDisplayTotal:
+      return "display_total";
+    case Stage::kNumStages:
+      break;
+  }
+  return "invalid";
+}
+
+int LatencyHistogram::BucketIndex(uint64_t micros) {
+  micros = std::min<uint64_t>(micros, (1ull << kMaxBits) - 1);
+  if (micros < kSubBuckets) {
+    return micros;
+  }
+  const int bits = 63 - __builtin_clzll(micros);
+  const int shift = bits - kSubBucketBits;
+  const int sub_bucket = (micros >> shift) - kSubBuckets;
+  return kSubBuckets + shift * kSubBuckets + sub_bucket;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  const int shift = (index - kSubBuckets) / kSubBuckets;
+  const int sub_bucket = (index - kSubBuckets) % kSubBuckets;
+  return ((static_cast<uint64_t>(kSubBuckets + sub_bucket + 1)) << shift) - 1;
+}
+
+void LatencyHistogram::Add(std::chrono::microseconds latency) {
+  buckets_[BucketIndex(std::max<int64_t>(0, latency.count()))]++;
+  count_++;
+}
+
+std::chrono::microseconds LatencyHistogram::Percentile(double fraction) const {
+  if (count_ == 0) {
+    return std::chrono::microseconds(0);
+  }
+  // Rank of the sample we're after, counting from 1.
+  const size_t rank = std::max<size_t>(1, fraction * count_ + 0.5);
+  size_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::chrono::microseconds(BucketUpperBound(i));
+    }
+  }
+  return std::chrono::microseconds(BucketUpperBound(kNumBuckets - 1));
+}
+
+LatencyStats::LatencyStats(size_t num_cameras)
+    : histograms_(num_cameras * static_cast<size_t>(Stage::kNumStages)) {}
+
+void LatencyStats::Record(size_t camera, Stage stage,
+                          FrameTrace::Clock::time_point start,
+                          FrameTrace::Clock::time_point end) {
+  const FrameTrace::Clock::time_point unset;
+  if ((start == unset) || (end == unset)) {
+    return;
+  }
+  const auto latency =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  std::lock_guard<std::mutex> guard(lock_);
+  histograms_[camera * static_cast<size_t>(Stage::kNumStages) +
+              static_cast<size_t>(stage)]
+      .Add(latency);
+}
+
+std::vector<LatencyStats::Summary> LatencyStats::Summarize() {
+  std::lock_guard<std::mutex> guard(lock_);
+  std::vector<Summary> summaries;
+  const size_t num_stages = static_cast<size_t>(Stage::kNumStages);
+  for (size_t i = 0; i < histograms_.size(); ++i) {
+    const LatencyHistogram &histogram = histograms_[i];
+    if (histogram.count() == 0) {
+      continue;
+    }
+    summaries.push_back({.camera = i / num_stages,
+                         .stage = static_cast<Stage>(i % num_stages),
+                         .count = histogram.count(),
+                         .p50 = histogram.Percentile(0.5),
+                         .p99 = histogram.Percentile(0.99)});
+  }
+  return summaries;
+}
+
+void LatencyStats::WriteJson(std::ostream &out) {
+  const auto summaries = Summarize();
+  out << "[";
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    const Summary &summary = summaries[i];
+    out << ((i == 0) ? "\n" : ",\n") << "  {\"camera\": " << summary.camera
+        << ", \"stage\": \"" << StageName(summary.stage)
+        << "\", \"count\": " << summary.count
+        << ", \"p50_us\": " << summary.p50.count()
+        << ", \"p99_us\": " << summary.p99.count() << "}";
+  }
+  out << "\n]\n";
+}
+
+}  // namespace cam
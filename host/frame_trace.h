@@ -0,0 +1,116 @@
+#ifndef FRAME_TRACE_H
+#define FRAME_TRACE_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace cam {
+
+// When a frame passed each point in the pipeline. Every stage fills in its own
+// timestamps as the frame goes by. Unset timestamps are left at the epoch.
+struct FrameTrace {
+  using Clock = std::chrono::steady_clock;
+
+  // The read that delivered the first bytes of the frame.
+  Clock::time_point socket_read;
+  // The last byte of the JPEG was parsed.
+  Clock::time_point parsed;
+  Clock::time_point decode_start;
+  Clock::time_point decode_end;
+  // Inference covers letterboxing the frame into the batch too.
+  Clock::time_point inference_start;
+  Clock::time_point inference_end;
+  // The frame made it to the screen.
+  Clock::time_point presented;
+};
+
+// The spans of a FrameTrace that latency is tracked for.
+enum class Stage {
+  // socket_read -> parsed.
+  kReceive = 0,
+  // parsed -> decode_start.
+  kDecodeWait,
+  // decode_start -> decode_end.
+  kDecode,
+  // decode_end -> inference_start.
+  kInferenceWait,
+  // inference_start -> inference_end.
+  kInference,
+  // decode_end -> presented.
+  kRender,
+  // socket_read -> inference_end.
+  kDetectionTotal,
+  // socket_read -> presented.
+  kDisplayTotal,
+  kNumStages,
+};
+
+const char *StageName(Stage stage);
+
+// Log-linear latency histogram. Each power of two is split into 8 buckets, so
+// percentiles are accurate to within 12.5%, from 1us up to ~18 minutes.
+class LatencyHistogram {
+  public:
+    void Add(std::chrono::microseconds latency);
+
+    // Returns the |fraction| (0 to 1) percentile, rounded up to its bucket's
+    // upper bound. 0 if the histogram is empty.
+    std::chrono::microseconds Percentile(double fraction) const;
+
+    size_t count() const { return count_; }
+
+  private:
+    static constexpr int kSubBucketBits = 3;
+    static constexpr int kSubBuckets = 1 << kSubBucketBits;
+    static constexpr int kMaxBits = 30;
+    static constexpr int kNumBuckets =
+        kSubBuckets + (kMaxBits - kSubBucketBits) * kSubBuckets;
+
+    static int BucketIndex(uint64_t micros);
+    static uint64_t BucketUpperBound(int index);
+
+    std::array<uint32_t, kNumBuckets> buckets_{};
+    size_t count_ = 0;
+};
+
+// Latency histograms for every stage of every camera.
+//
+// This class is threadsafe.
+class LatencyStats {
+  public:
+    struct Summary {
+      size_t camera;
+      Stage stage;
+      size_t count;
+      std::chrono::microseconds p50;
+      std::chrono::microseconds p99;
+    };
+
+    explicit LatencyStats(size_t num_cameras);
+
+    LatencyStats(const LatencyStats &rhs) = delete;
+
+    // Records |end| - |start| for |stage|. Ignored if either is unset.
+    void Record(size_t camera, Stage stage, FrameTrace::Clock::time_point start,
+                FrameTrace::Clock::time_point end);
+
+    // Every camera and stage with at least one sample.
+    std::vector<Summary> Summarize();
+
+    // Writes Summarize() as a JSON array of objects, one per camera and stage.
+    void WriteJson(std::ostream &out);
+
+  private:
+    std::mutex lock_;
+    // Indexed by camera * kNumStages + stage.
+    std::vector<LatencyHistogram> histograms_;
+};
+
+}  // namespace cam
+
+#endif // FRAME_TRACE_H
@@ -0,0 +1,45 @@
+// Runs the pipeline without a display: ingest, recording, detection and scene
+// events, plus frames for any viewer that attaches. Runs until SIGINT or
+// SIGTERM.
+
+#include "host/pipeline.h"
+
+#include <signal.h>
+
+#include <iostream>
+#include <memory>
+#include <thread>
+
+int main(int argc, char *argv[]) {
+  cam::Pipeline::Options options;
+  if (!cam::ParsePipelineArgs(argc, argv, &options)) {
+    return -1;
+  }
+  options.frame_socket = cam::kFrameSocket;
+
+  // Signals are only taken by sigwait() below. Blocked before any threads
+  // start, so that they all inherit the mask.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  std::unique_ptr<cam::Pipeline> pipeline =
+      cam::Pipeline::Create(options, nullptr);
+  if (!pipeline) {
+    return -1;
+  }
+  std::thread pipeline_thread([&pipeline]() { pipeline->Run(); });
+  std::cout << "Serving frames on " << options.frame_socket << std::endl;
+
+  int signal_number = 0;
+  sigwait(&signals, &signal_number);
+  std::cout << "Exiting on signal " << signal_number << std::endl;
+
+  pipeline->Stop();
+  pipeline_thread.join();
+  pipeline.reset();
+  std::cerr << "DONE." << std::endl;
+  return 0;
+}
@@ -0,0 +1,306 @@
+#include "host/image_ops.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+namespace cam {
+
+namespace {
+
+constexpr float kByteToFloat = 1.0f / 255.0f;
+// 8 bits of fractional precision for the bilinear interpolation weights.
+constexpr int kResizeShift = 8;
+constexpr int kResizeOne = 1 << kResizeShift;
+constexpr int kResizeRound = 1 << (2 * kResizeShift - 1);
+
+void InterleavedToPlanarScalar(const uint8_t *rgb, size_t num_pixels, float *r,
+                               float *g, float *b) {
+  for (size_t i = 0; i < num_pixels; ++i) {
+    r[i] = rgb[3 * i] * kByteToFloat;
+    g[i] = rgb[3 * i + 1] * kByteToFloat;
+    b[i] = rgb[3 * i + 2] * kByteToFloat;
+  }
+}
+
+// Resizing blends the two source rows around each destination row first, and
+// then interpolates between the taps within the blended row. Both passes keep
+// every bit, so the result is the same as interpolating the other way around.
+void BlendRowsScalar(const uint8_t *top, const uint8_t *bottom, int weight,
+                     size_t size, uint16_t *row) {
+  for (size_t i = 0; i < size; ++i) {
+    row[i] = top[i] * (kResizeOne - weight) + bottom[i] * weight;
+  }
+}
+
+void InterpolateRowScalar(const uint16_t *row, const ResizeScratch &scratch,
+                          size_t begin, size_t size, uint8_t *out) {
+  for (size_t i = begin; i < size; ++i) {
+    const int32_t weight = scratch.weight[i];
+    const int32_t value = row[scratch.left[i]] * (kResizeOne - weight) +
+                          row[scratch.right[i]] * weight;
+    out[i] = (value + kResizeRound) >> (2 * kResizeShift);
+  }
+}
+
+void ResizeRowScalar(const uint8_t *top, const uint8_t *bottom, int weight,
+                     size_t src_size, const ResizeScratch &scratch,
+                     size_t dst_size, uint8_t *out, uint16_t *row) {
+  BlendRowsScalar(top, bottom, weight, src_size, row);
+  InterpolateRowScalar(row, scratch, 0, dst_size, out);
+}
+
+#ifdef HAVE_X86_SIMD
+
+// pshufb masks which gather one channel of 16 interleaved pixels (48 bytes,
+// spread over three 16-byte registers). kShuffles[channel][source] pulls that
+// channel's bytes out of register |source| into their final positions, and
+// zeroes every other lane so the three results can be OR'd together.
+struct ShuffleMasks {
+  alignas(16) int8_t masks[3][3][16];
+
+  ShuffleMasks() {
+    for (int channel = 0; channel < 3; ++channel) {
+      for (int source = 0; source < 3; ++source) {
+        for (int i = 0; i < 16; ++i) {
+          const int index = 3 * i + channel - 16 * source;
+          masks[channel][source][i] =
+              ((index >= 0) && (index < 16)) ? index : -1;
+        }
+      }
+    }
+  }
+};
+
+const ShuffleMasks &Shuffles() {
+  static const ShuffleMasks shuffles;
+  return shuffles;
+}
+
+// Gathers 16 bytes of |channel| from 16 interleaved pixels.
+__attribute__((target("sse4.1"))) inline __m128i GatherChannel(
+    const ShuffleMasks &shuffles, int channel, __m128i v0, __m128i v1,
+    __m128i v2) {
+  const auto mask = [&](int source) {
+    return _mm_load_si128(
+        reinterpret_cast<const __m128i *>(shuffles.masks[channel][source]));
+  };
+  return _mm_or_si128(
+      _mm_or_si128(_mm_shuffle_epi8(v0, mask(0)), _mm_shuffle_epi8(v1, mask(1))),
+      _mm_shuffle_epi8(v2, mask(2)));
+}
+
+__attribute__((target("sse4.1"))) void InterleavedToPlanarSse41(
+    const uint8_t *rgb, size_t num_pixels, float *r, float *g, float *b) {
+  const ShuffleMasks &shuffles = Shuffles();
+  const __m128 scale = _mm_set1_ps(kByteToFloat);
+  float *const planes[3] = {r, g, b};
+  size_t i = 0;
+  for (; i + 16 <= num_pixels; i += 16) {
+    const __m128i v0 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgb + 3 * i));
+    const __m128i v1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgb + 3 * i + 16));
+    const __m128i v2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgb + 3 * i + 32));
+    for (int channel = 0; channel < 3; ++channel) {
+      __m128i bytes = GatherChannel(shuffles, channel, v0, v1, v2);
+      float *const out = planes[channel] + i;
+      for (int j = 0; j < 4; ++j) {
+        const __m128 floats = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes));
+        _mm_storeu_ps(out + 4 * j, _mm_mul_ps(floats, scale));
+        bytes = _mm_srli_si128(bytes, 4);
+      }
+    }
+  }
+  InterleavedToPlanarScalar(rgb + 3 * i, num_pixels - i, r + i, g + i, b + i);
+}
+
+__attribute__((target("avx2"))) void InterleavedToPlanarAvx2(
+    const uint8_t *rgb, size_t num_pixels, float *r, float *g, float *b) {
+  const ShuffleMasks &shuffles = Shuffles();
+  const __m256 scale = _mm256_set1_ps(kByteToFloat);
+  float *const planes[3] = {r, g, b};
+  size_t i = 0;
+  for (; i + 16 <= num_pixels; i += 16) {
+    const __m128i v0 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgb + 3 * i));
+    const __m128i v1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgb + 3 * i + 16));
+    const __m128i v2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgb + 3 * i + 32));
+    for (int channel = 0; channel < 3; ++channel) {
+      const __m128i bytes = GatherChannel(shuffles, channel, v0, v1, v2);
+      float *const out = planes[channel] + i;
+      const __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+      const __m256 high = _mm256_cvtepi32_ps(
+          _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+      _mm256_storeu_ps(out, _mm256_mul_ps(low, scale));
+      _mm256_storeu_ps(out + 8, _mm256_mul_ps(high, scale));
+    }
+  }
+  InterleavedToPlanarScalar(rgb + 3 * i, num_pixels - i, r + i, g + i, b + i);
+}
+
+// The blend is 16 bytes at a time in 16-bit lanes, which can't overflow: the
+// two weights add up to 256, so a blended value is at most 255 * 256. The
+// interpolation gathers 8 taps at a time from the blended row.
+__attribute__((target("avx2"))) void ResizeRowAvx2(
+    const uint8_t *top, const uint8_t *bottom, int weight, size_t src_size,
+    const ResizeScratch &scratch, size_t dst_size, uint8_t *out,
+    uint16_t *row) {
+  const __m256i top_weight = _mm256_set1_epi16(kResizeOne - weight);
+  const __m256i bottom_weight = _mm256_set1_epi16(weight);
+  size_t i = 0;
+  for (; i + 16 <= src_size; i += 16) {
+    const __m256i t = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(top + i)));
+    const __m256i b = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bottom + i)));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(row + i),
+        _mm256_add_epi16(_mm256_mullo_epi16(t, top_weight),
+                         _mm256_mullo_epi16(b, bottom_weight)));
+  }
+  BlendRowsScalar(top + i, bottom + i, weight, src_size - i, row + i);
+
+  // Each gather loads 32 bits at a 16-bit tap, so it also picks up the value
+  // after it (the row has one spare at the end), which the mask drops.
+  const int *const taps = reinterpret_cast<const int *>(row);
+  const __m256i low_half = _mm256_set1_epi32(0xffff);
+  const __m256i one = _mm256_set1_epi32(kResizeOne);
+  const __m256i round = _mm256_set1_epi32(kResizeRound);
+  i = 0;
+  for (; i + 8 <= dst_size; i += 8) {
+    const __m256i left = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(scratch.left.data() + i));
+    const __m256i right = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(scratch.right.data() + i));
+    const __m256i right_weight = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(scratch.weight.data() + i));
+    const __m256i l =
+        _mm256_and_si256(_mm256_i32gather_epi32(taps, left, 2), low_half);
+    const __m256i r =
+        _mm256_and_si256(_mm256_i32gather_epi32(taps, right, 2), low_half);
+    const __m256i value = _mm256_add_epi32(
+        _mm256_mullo_epi32(l, _mm256_sub_epi32(one, right_weight)),
+        _mm256_mullo_epi32(r, right_weight));
+    const __m256i result = _mm256_srli_epi32(_mm256_add_epi32(value, round),
+                                             2 * kResizeShift);
+    // 8 x 32 bits down to 8 bytes. packus works within 128-bit lanes, so
+    // bring the two halves together in between.
+    const __m256i words = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(result, result), 0x08);
+    const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                           _mm256_castsi256_si128(words));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), bytes);
+  }
+  InterpolateRowScalar(row, scratch, i, dst_size, out);
+}
+
+#endif  // HAVE_X86_SIMD
+
+}  // namespace
+
+SimdLevel DetectSimdLevel() {
+#ifdef HAVE_X86_SIMD
+  static const SimdLevel level = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return SimdLevel::kAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return SimdLevel::kSse41;
+    }
+    return SimdLevel::kScalar;
+  }();
+  return level;
+#else
+  return SimdLevel::kScalar;
+#endif
+}
+
+const char *SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return "scalar";
+    case SimdLevel::kSse41:
+      return "sse4.1";
+    case SimdLevel::kAvx2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+void InterleavedToPlanar(const uint8_t *rgb, size_t num_pixels, float *r,
+                         float *g, float *b) {
+  InterleavedToPlanar(DetectSimdLevel(), rgb, num_pixels, r, g, b);
+}
+
+void InterleavedToPlanar(SimdLevel level, const uint8_t *rgb,
+                         size_t num_pixels, float *r, float *g, float *b) {
+  switch (level) {
+#ifdef HAVE_X86_SIMD
+    case SimdLevel::kAvx2:
+      InterleavedToPlanarAvx2(rgb, num_pixels, r, g, b);
+      return;
+    case SimdLevel::kSse41:
+      InterleavedToPlanarSse41(rgb, num_pixels, r, g, b);
+      return;
+#endif
+    default:
+      InterleavedToPlanarScalar(rgb, num_pixels, r, g, b);
+      return;
+  }
+}
+
+void ResizeBilinear(const uint8_t *src, int src_x, int src_y, uint8_t *dst,
+                    int dst_x, int dst_y, ResizeScratch *scratch) {
+  ResizeBilinear(DetectSimdLevel(), src, src_x, src_y, dst, dst_x, dst_y,
+                 scratch);
+}
+
+void ResizeBilinear(SimdLevel level, const uint8_t *src, int src_x, int src_y,
+                    uint8_t *dst, int dst_x, int dst_y,
+                    ResizeScratch *scratch) {
+  // Horizontal taps are the same for every row, so work them out once.
+  const size_t src_size = static_cast<size_t>(src_x) * 3;
+  const size_t dst_size = static_cast<size_t>(dst_x) * 3;
+  scratch->left.resize(dst_size);
+  scratch->right.resize(dst_size);
+  scratch->weight.resize(dst_size);
+  scratch->row.resize(src_size + 1);
+  for (int x = 0; x < dst_x; ++x) {
+    const float src_pos =
+        std::max(0.0f, (x + 0.5f) * src_x / dst_x - 0.5f);
+    const int x0 = std::min<int>(src_pos, src_x - 1);
+    const int x1 = std::min(x0 + 1, src_x - 1);
+    const int weight = (src_pos - x0) * kResizeOne;
+    for (int k = 0; k < 3; ++k) {
+      scratch->left[x * 3 + k] = x0 * 3 + k;
+      scratch->right[x * 3 + k] = x1 * 3 + k;
+      scratch->weight[x * 3 + k] = weight;
+    }
+  }
+
+  auto resize_row = ResizeRowScalar;
+#ifdef HAVE_X86_SIMD
+  if (level == SimdLevel::kAvx2) {
+    resize_row = ResizeRowAvx2;
+  }
+#endif
+  for (int y = 0; y < dst_y; ++y) {
+    const float src_pos =
+        std::max(0.0f, (y + 0.5f) * src_y / dst_y - 0.5f);
+    const int y0 = std::min<int>(src_pos, src_y - 1);
+    const int y1 = std::min(y0 + 1, src_y - 1);
+    const int weight = (src_pos - y0) * kResizeOne;
+    resize_row(src + y0 * src_size, src + y1 * src_size, weight, src_size,
+               *scratch, dst_size, dst + y * dst_size, scratch->row.data());
+  }
+}
+
+}  // namespace cam
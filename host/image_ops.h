@@ -0,0 +1,55 @@
+#ifndef IMAGE_OPS_H
+#define IMAGE_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cam {
+
+// Instruction sets with hand-vectorized kernels. The best one the CPU supports
+// is picked at runtime, so the same binary runs everywhere.
+enum class SimdLevel {
+  kScalar = 0,
+  kSse41,
+  kAvx2,
+};
+
+SimdLevel DetectSimdLevel();
+const char *SimdLevelName(SimdLevel level);
+
+// Splits |num_pixels| interleaved 24-bit RGB pixels into three planes of floats
+// normalized to [0, 1], which is the layout darknet expects.
+void InterleavedToPlanar(const uint8_t *rgb, size_t num_pixels, float *r,
+                         float *g, float *b);
+// Same, but forces a particular implementation. |level| must be supported by
+// the CPU.
+void InterleavedToPlanar(SimdLevel level, const uint8_t *rgb,
+                         size_t num_pixels, float *r, float *g, float *b);
+
+// Tables and a row buffer for ResizeBilinear(), grown as needed. Callers which
+// resize over and over keep one around, so that resizing doesn't allocate
+// once it has seen the largest size.
+struct ResizeScratch {
+  // For each byte of a destination row, the offsets of its left and right
+  // taps within a source row, and the right tap's weight out of 256.
+  std::vector<int32_t> left;
+  std::vector<int32_t> right;
+  std::vector<int32_t> weight;
+  // Two source rows blended vertically, in 8.8 fixed point.
+  std::vector<uint16_t> row;
+};
+
+// Bilinear resize of a 24-bit RGB image. Every implementation gives the same
+// result. AVX2 has a vectorized kernel, and anything less runs the scalar one.
+void ResizeBilinear(const uint8_t *src, int src_x, int src_y, uint8_t *dst,
+                    int dst_x, int dst_y, ResizeScratch *scratch);
+// Same, but forces a particular implementation. |level| must be supported by
+// the CPU.
+void ResizeBilinear(SimdLevel level, const uint8_t *src, int src_x, int src_y,
+                    uint8_t *dst, int dst_x, int dst_y,
+                    ResizeScratch *scratch);
+
+}  // namespace cam
+
+#endif // IMAGE_OPS_H
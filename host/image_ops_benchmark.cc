@@ -0,0 +1,80 @@
+// Micro-benchmark for the RGB -> planar float conversion that feeds the
+// detector, at the camera's native 800x600, and for resizing that down to fit
+// a 416x416 network input.
+//
+// Usage: image_ops_benchmark [iterations]
+
+#include "host/image_ops.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 500;
+  constexpr int kWidth = 800;
+  constexpr int kHeight = 600;
+  constexpr size_t kPixels = kWidth * kHeight;
+
+  std::mt19937 rng(0);
+  std::vector<uint8_t> rgb(kPixels * 3);
+  for (uint8_t &byte : rgb) {
+    byte = rng();
+  }
+  std::vector<float> expected(kPixels * 3);
+  cam::InterleavedToPlanar(cam::SimdLevel::kScalar, rgb.data(), kPixels,
+                           expected.data(), expected.data() + kPixels,
+                           expected.data() + 2 * kPixels);
+
+  std::cout << "Runtime dispatch picks "
+            << cam::SimdLevelName(cam::DetectSimdLevel()) << std::endl;
+  bool ok = true;
+  for (int level = 0; level <= static_cast<int>(cam::DetectSimdLevel());
+       ++level) {
+    const auto simd = static_cast<cam::SimdLevel>(level);
+    std::vector<float> planar(kPixels * 3);
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      cam::InterleavedToPlanar(simd, rgb.data(), kPixels, planar.data(),
+                               planar.data() + kPixels,
+                               planar.data() + 2 * kPixels);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const bool matches = (planar == expected);
+    ok &= matches;
+    std::cout << cam::SimdLevelName(simd) << ": "
+              << seconds * 1000 / iterations << " ms/frame, "
+              << kPixels * iterations / seconds / 1e6 << " Mpixel/s"
+              << (matches ? "" : " (MISMATCH)") << std::endl;
+  }
+
+  constexpr int kResizedWidth = 416;
+  constexpr int kResizedHeight = 312;
+  cam::ResizeScratch scratch;
+  std::vector<uint8_t> expected_resized(kResizedWidth * kResizedHeight * 3);
+  cam::ResizeBilinear(cam::SimdLevel::kScalar, rgb.data(), kWidth, kHeight,
+                      expected_resized.data(), kResizedWidth, kResizedHeight,
+                      &scratch);
+  for (int level = 0; level <= static_cast<int>(cam::DetectSimdLevel());
+       ++level) {
+    const auto simd = static_cast<cam::SimdLevel>(level);
+    std::vector<uint8_t> resized(expected_resized.size());
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      cam::ResizeBilinear(simd, rgb.data(), kWidth, kHeight, resized.data(),
+                          kResizedWidth, kResizedHeight, &scratch);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const bool matches = (resized == expected_resized);
+    ok &= matches;
+    std::cout << cam::SimdLevelName(simd) << " resize to " << kResizedWidth
+              << "x" << kResizedHeight << ": "
+              << seconds * 1000 / iterations << " ms/frame"
+              << (matches ? "" : " (MISMATCH)") << std::endl;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,498 @@
+#include "host/image_processing.h"
+
+#include "host/image_ops.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+size_t NumCrops(const ImageProcessingModule::Options &options, size_t stream) {
+  return (stream < options.crops.size())
+             ? std::max<size_t>(1, options.crops[stream].size())
+             : 1;
+}
+
+// Every crop of a frame has to fit in one batch, and there's no point in a
+// batch bigger than every crop of every stream.
+int BatchSize(const ImageProcessingModule::Options &options,
+              size_t num_streams) {
+  size_t total = 0;
+  size_t largest = 1;
+  for (size_t stream = 0; stream < num_streams; ++stream) {
+    total += NumCrops(options, stream);
+    largest = std::max(largest, NumCrops(options, stream));
+  }
+  return std::max<int>(largest, std::min<int>(options.max_batch_size, total));
+}
+
+// Intersection of |a| and |b| as a fraction of the smaller one's area. Unlike
+// IoU, this is high for a piece of an object cut off at a crop's edge, and the
+// whole object from a neighboring crop.
+float OverlapOfSmaller(const bbox_t &a, const bbox_t &b) {
+  const float x0 = std::max(a.x, b.x);
+  const float y0 = std::max(a.y, b.y);
+  const float x1 = std::min(a.x + a.w, b.x + b.w);
+  const float y1 = std::min(a.y + a.h, b.y + b.h);
+  if ((x1 <= x0) || (y1 <= y0)) {
+    return 0;
+  }
+  const float smaller = std::min<float>(a.w * a.h, b.w * b.h);
+  return (smaller > 0) ? (x1 - x0) * (y1 - y0) / smaller : 0;
+}
+
+// Darknet pads letterboxed images with 50% gray.
+constexpr float kLetterboxFill = 0.5f;
+
+constexpr size_t kAlignment = 64;
+
+}  // namespace
+
+ImageProcessingModule::ImageProcessingModule(const std::string &config_file,
+                                             const std::string &weight_file,
+                                             size_t num_streams,
+                                             const Options &options)
+    : options_(options),
+      streams_(num_streams),
+      scheduler_(options.scheduler) {
+  options_.max_batch_size = BatchSize(options, num_streams);
+  full_ = LoadNetwork(config_file, weight_file);
+  if (!ok()) {
+    std::cerr << "Could not load " << config_file << " and " << weight_file
+              << "." << std::endl;
+    return;
+  }
+  size_t slot_size = static_cast<size_t>(full_.width) * full_.height * 3;
+  if (!options.fast_config_file.empty() && !options.fast_weight_file.empty()) {
+    fast_ = LoadNetwork(options.fast_config_file, options.fast_weight_file);
+    slot_size = std::max(slot_size,
+                         static_cast<size_t>(fast_.width) * fast_.height * 3);
+  }
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    streams_[i].motion_gate = cam::MotionGate(options.motion_gate);
+    // Every snapshot the stream will ever publish fits in here, so that the
+    // inference loop doesn't allocate as objects come and go.
+    streams_[i].detections.InitSlots([&options](Detections &detections) {
+      detections.objects.reserve(options.max_objects);
+      detections.velocities.reserve(options.max_objects);
+    });
+    streams_[i].tracked.reserve(options.max_objects);
+    trackers_.emplace_back(&track_ids_, options.tracker);
+    trackers_.back().Reserve(options.max_objects, options.max_objects);
+    if ((i < options.crops.size()) && !options.crops[i].empty()) {
+      streams_[i].crops = options.crops[i];
+    } else {
+      streams_[i].crops = {cam::Region()};
+    }
+  }
+  batch_boxes_.resize(options_.max_batch_size);
+  for (std::vector<bbox_t> &boxes : batch_boxes_) {
+    boxes.reserve(options.max_objects);
+  }
+  letterboxes_.reserve(options_.max_batch_size);
+  frame_boxes_.reserve(options.max_objects);
+  merged_.reserve(options.max_objects);
+  live_track_ids_.reserve(options.max_objects);
+  batch_input_size_ = options_.max_batch_size * slot_size;
+  // Cache line aligned, and rounded up to a whole number of alignment units as
+  // aligned_alloc requires.
+  const size_t bytes = (batch_input_size_ * sizeof(float) + kAlignment - 1) /
+                       kAlignment * kAlignment;
+  batch_input_.reset(static_cast<float *>(std::aligned_alloc(kAlignment, bytes)));
+}
+
+ImageProcessingModule::Network ImageProcessingModule::LoadNetwork(
+    const std::string &config_file, const std::string &weight_file) const {
+  cam::DetectorOptions detector_options;
+  detector_options.backend = options_.backend;
+  detector_options.batch_size = options_.max_batch_size;
+  detector_options.cpu_threads = options_.cpu_threads;
+  Network network;
+  network.detector = cam::LoadDetector(config_file, weight_file,
+                                       detector_options);
+  if (network.detector) {
+    network.width = network.detector->net_width();
+    network.height = network.detector->net_height();
+  }
+  return network;
+}
+
+void ImageProcessingModule::InputImage(size_t stream, const uint8_t *image,
+                                       int size_x, int size_y,
+                                       const cam::FrameTrace &trace,
+                                       int frame_x, int frame_y) {
+  if ((size_x <= 0) || (size_y <= 0)) {
+    return;
+  }
+  Frame &frame = streams_[stream].frames.back();
+  // Each pixel is 3 bytes. The slot's buffer is reused from frame to frame.
+  frame.data.assign(image, image + size_x * size_y * 3);
+  frame.size_x = size_x;
+  frame.size_y = size_y;
+  frame.frame_x = (frame_x > 0) ? frame_x : size_x;
+  frame.frame_y = (frame_y > 0) ? frame_y : size_y;
+  frame.submitted = std::chrono::steady_clock::now();
+  frame.trace = trace;
+  streams_[stream].frames.Publish();
+  doorbell_.Ring();
+}
+
+bool ImageProcessingModule::CollectBatch() {
+  size_t ready = 0;
+  bool escalation_waiting = false;
+  while (!done_) {
+    // Pick up the latest frame from every stream. A stream that was already
+    // ready just swaps in its newer frame. Readiness is counted in crops,
+    // since that's what fills up batch slots.
+    ready = 0;
+    escalation_waiting = false;
+    auto oldest = std::chrono::steady_clock::time_point::max();
+    for (size_t stream = 0; stream < streams_.size(); ++stream) {
+      Stream &s = streams_[stream];
+      if (s.frames.Update()) {
+        const Frame &frame = s.frames.front();
+        const bool due = frame.submitted - s.last_detected >=
+                         options_.detection_interval;
+        const bool changed =
+            due &&
+            s.motion_gate.Check(frame.data.data(), frame.size_x, frame.size_y);
+        frames_considered_++;
+        if (changed || s.ready) {
+          // A frame replacing one that's still waiting goes through either
+          // way, since the one it replaced had changed.
+          s.ready = true;
+        } else {
+          frames_skipped_++;
+          if (due) {
+            // Nothing moved, so neither did any of the objects.
+            PublishTracked(stream, frame.submitted, /*moving=*/false);
+          }
+        }
+      }
+      if (s.ready) {
+        ready += s.crops.size();
+        escalation_waiting |= s.escalate;
+        oldest = std::min(oldest, s.frames.front().submitted);
+      }
+    }
+
+    if (ready == 0) {
+      doorbell_.Wait(&doorbell_seen_);
+      continue;
+    }
+    // Give the other streams until the oldest frame's deadline to fill out
+    // the batch.
+    const auto deadline = oldest + options_.max_batch_wait;
+    if ((ready >= (size_t)options_.max_batch_size) ||
+        (std::chrono::steady_clock::now() >= deadline)) {
+      break;
+    }
+    doorbell_.WaitUntil(&doorbell_seen_, deadline);
+  }
+  if (done_) {
+    return false;
+  }
+
+  batch_model_ = cam::ModelScheduler::Model::kFull;
+  if (fast_.detector) {
+    const size_t batches_waiting =
+        (ready + options_.max_batch_size - 1) / options_.max_batch_size;
+    batch_model_ = scheduler_.Choose(batches_waiting, escalation_waiting);
+  }
+
+  batch_slots_.clear();
+  // Streams which asked for the full model get it first.
+  const bool escalated_first =
+      (batch_model_ == cam::ModelScheduler::Model::kFull) && escalation_waiting;
+  for (int pass = escalated_first ? 0 : 1; pass < 2; ++pass) {
+    for (size_t i = 0; i < streams_.size(); ++i) {
+      const size_t stream = (next_stream_ + i) % streams_.size();
+      Stream &s = streams_[stream];
+      if (!s.ready || ((pass == 0) && !s.escalate) ||
+          (batch_slots_.size() + s.crops.size() >
+           (size_t)options_.max_batch_size)) {
+        // A stream whose crops don't all fit waits for the next batch.
+        continue;
+      }
+      // The frame stays in the mailbox's front slot, which the producer won't
+      // touch until we Update() again.
+      s.ready = false;
+      s.motion_gate.Commit();
+      s.last_detected = s.frames.front().submitted;
+      for (size_t crop = 0; crop < s.crops.size(); ++crop) {
+        batch_slots_.push_back({.stream = stream, .crop = crop});
+      }
+    }
+  }
+  next_stream_ = (batch_slots_.back().stream + 1) % streams_.size();
+  return true;
+}
+
+ImageProcessingModule::Letterbox ImageProcessingModule::LetterboxInto(
+    const Network &network, const Frame &frame, const cam::Region &crop,
+    int slot) {
+  const int net_width = network.width;
+  const int net_height = network.height;
+  const size_t plane = static_cast<size_t>(net_width) * net_height;
+  float *const out = batch_input_.get() + slot * plane * 3;
+
+  // The crop in pixels, at least one pixel big.
+  Letterbox letterbox;
+  letterbox.crop_x = std::clamp<int>(crop.x * frame.size_x, 0, frame.size_x - 1);
+  letterbox.crop_y = std::clamp<int>(crop.y * frame.size_y, 0, frame.size_y - 1);
+  const int crop_x = std::clamp<int>(crop.width * frame.size_x + 0.5f, 1,
+                                     frame.size_x - letterbox.crop_x);
+  const int crop_y = std::clamp<int>(crop.height * frame.size_y + 0.5f, 1,
+                                     frame.size_y - letterbox.crop_y);
+  const uint8_t *pixels = frame.data.data();
+  if ((crop_x != frame.size_x) || (crop_y != frame.size_y)) {
+    cropped_.resize(static_cast<size_t>(crop_x) * crop_y * 3);
+    for (int y = 0; y < crop_y; ++y) {
+      std::memcpy(cropped_.data() + static_cast<size_t>(y) * crop_x * 3,
+                  pixels + ((static_cast<size_t>(letterbox.crop_y) + y) *
+                                frame.size_x +
+                            letterbox.crop_x) *
+                               3,
+                  crop_x * 3);
+    }
+    pixels = cropped_.data();
+  }
+
+  letterbox.scale = std::min(static_cast<float>(net_width) / crop_x,
+                             static_cast<float>(net_height) / crop_y);
+  const int scaled_x = std::min<int>(net_width, crop_x * letterbox.scale);
+  const int scaled_y = std::min<int>(net_height, crop_y * letterbox.scale);
+  letterbox.offset_x = (net_width - scaled_x) / 2;
+  letterbox.offset_y = (net_height - scaled_y) / 2;
+  if ((scaled_x != net_width) || (scaled_y != net_height)) {
+    // Only the border needs it, but the whole slot is cheap enough to fill.
+    std::fill(out, out + plane * 3, kLetterboxFill);
+  }
+
+  // Resize in 8 bits while the pixels are still interleaved, then split into
+  // planes and normalize a row at a time.
+  if ((scaled_x != crop_x) || (scaled_y != crop_y)) {
+    resized_.resize(static_cast<size_t>(scaled_x) * scaled_y * 3);
+    cam::ResizeBilinear(pixels, crop_x, crop_y, resized_.data(), scaled_x,
+                        scaled_y, &resize_scratch_);
+    pixels = resized_.data();
+  }
+  for (int y = 0; y < scaled_y; ++y) {
+    const size_t out_index =
+        (y + letterbox.offset_y) * net_width + letterbox.offset_x;
+    cam::InterleavedToPlanar(pixels + static_cast<size_t>(y) * scaled_x * 3,
+                             scaled_x, out + out_index,
+                             out + plane + out_index,
+                             out + 2 * plane + out_index);
+  }
+  return letterbox;
+}
+
+void ImageProcessingModule::MapToFrame(const Frame &frame,
+                                       const Letterbox &letterbox,
+                                       const std::vector<bbox_t> &boxes,
+                                       std::vector<bbox_t> *out) {
+  // From the image's pixels to the camera's, if the image was scaled down.
+  const float frame_scale_x = static_cast<float>(frame.frame_x) / frame.size_x;
+  const float frame_scale_y = static_cast<float>(frame.frame_y) / frame.size_y;
+  for (bbox_t box : boxes) {
+    // Map from the letterboxed network input back to the frame. Box
+    // coordinates are unsigned, so do the math in floats.
+    const float x = std::min<float>(
+        letterbox.crop_x + std::max(0.0f, (static_cast<float>(box.x) -
+                                           letterbox.offset_x) /
+                                              letterbox.scale),
+        frame.size_x - 1);
+    const float y = std::min<float>(
+        letterbox.crop_y + std::max(0.0f, (static_cast<float>(box.y) -
+                                           letterbox.offset_y) /
+                                              letterbox.scale),
+        frame.size_y - 1);
+    const float w = std::min<float>(box.w / letterbox.scale, frame.size_x - x);
+    const float h = std::min<float>(box.h / letterbox.scale, frame.size_y - y);
+    box.x = x * frame_scale_x;
+    box.y = y * frame_scale_y;
+    box.w = w * frame_scale_x;
+    box.h = h * frame_scale_y;
+    out->push_back(box);
+  }
+}
+
+void ImageProcessingModule::MergeOverlapping(std::vector<bbox_t> *boxes) {
+  // Greedy, most confident first. A box that's merged away grows the one it
+  // merged into, since a crop's edge may have cut it off.
+  std::sort(boxes->begin(), boxes->end(),
+            [](const bbox_t &a, const bbox_t &b) { return a.prob > b.prob; });
+  std::vector<bbox_t> &kept = merged_;
+  kept.clear();
+  for (const bbox_t &box : *boxes) {
+    auto merged = std::find_if(kept.begin(), kept.end(), [&](const bbox_t &k) {
+      return (k.obj_id == box.obj_id) &&
+             (OverlapOfSmaller(k, box) > options_.merge_overlap);
+    });
+    if (merged == kept.end()) {
+      kept.push_back(box);
+      continue;
+    }
+    const unsigned int x1 = std::max(merged->x + merged->w, box.x + box.w);
+    const unsigned int y1 = std::max(merged->y + merged->h, box.y + box.h);
+    merged->x = std::min(merged->x, box.x);
+    merged->y = std::min(merged->y, box.y);
+    merged->w = x1 - merged->x;
+    merged->h = y1 - merged->y;
+  }
+  boxes->swap(kept);
+}
+
+void ImageProcessingModule::PublishBoxes(
+    size_t stream, std::chrono::steady_clock::time_point time,
+    std::vector<bbox_t> *boxes) {
+  trackers_[stream].Update(time, boxes);
+  streams_[stream].tracked.swap(*boxes);
+  PublishTracked(stream, time, /*moving=*/true);
+  if (options_.scene_events != nullptr) {
+    const auto age = std::chrono::steady_clock::now() - time;
+    trackers_[stream].LiveTrackIds(&live_track_ids_);
+    options_.scene_events->Publish(
+        stream,
+        std::chrono::system_clock::now() -
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                age),
+        streams_[stream].tracked, live_track_ids_);
+  }
+}
+
+void ImageProcessingModule::PublishTracked(
+    size_t stream, std::chrono::steady_clock::time_point time, bool moving) {
+  Stream &s = streams_[stream];
+  // The back slot isn't visible to the reader, so it can be refilled in
+  // place. Its storage was reserved up front.
+  Detections &detections = s.detections.back();
+  detections.objects.clear();
+  detections.velocities.clear();
+  detections.version = ++s.version;
+  detections.time = time;
+  for (const bbox_t &box : s.tracked) {
+    detections.objects.push_back(box);
+    detections.velocities.emplace_back();
+    if (moving) {
+      trackers_[stream].Velocity(box.track_id, &detections.velocities.back());
+    }
+  }
+  s.detections.Publish();
+}
+
+void ImageProcessingModule::operator()() {
+  if (!ok()) {
+    return;
+  }
+  while (CollectBatch()) {
+    const bool fast = (batch_model_ == cam::ModelScheduler::Model::kFast);
+    const Network &network = fast ? fast_ : full_;
+    const auto inference_start = std::chrono::steady_clock::now();
+    letterboxes_.clear();
+    for (size_t slot = 0; slot < batch_slots_.size(); ++slot) {
+      Stream &s = streams_[batch_slots_[slot].stream];
+      letterboxes_.push_back(LetterboxInto(network, s.frames.front(),
+                                           s.crops[batch_slots_[slot].crop],
+                                           slot));
+    }
+    // Some backends always run a full batch. Blank out any unused slots so
+    // that they don't repeat stale frames.
+    int batch_size = batch_slots_.size();
+    if (network.detector->fixed_batch_size()) {
+      const size_t slot_size =
+          static_cast<size_t>(network.width) * network.height * 3;
+      std::fill(batch_input_.get() + batch_slots_.size() * slot_size,
+                batch_input_.get() + options_.max_batch_size * slot_size,
+                kLetterboxFill);
+      batch_size = options_.max_batch_size;
+    }
+
+    if (options_.backend_hook) {
+      options_.backend_hook(true);
+    }
+    network.detector->DetectBatch(batch_input_.get(), batch_size,
+                                  options_.threshold, options_.max_objects,
+                                  &batch_boxes_);
+    if (options_.backend_hook) {
+      options_.backend_hook(false);
+    }
+    const auto inference_end = std::chrono::steady_clock::now();
+    scheduler_.Record(batch_model_, inference_end - inference_start);
+    batches_run_++;
+    if (fast) {
+      fast_batches_run_++;
+    }
+    // Each stream's crops sit next to each other in the batch.
+    for (size_t slot = 0; slot < batch_slots_.size();) {
+      const size_t stream = batch_slots_[slot].stream;
+      Frame &frame = streams_[stream].frames.front();
+      frame_boxes_.clear();
+      for (; (slot < batch_slots_.size()) &&
+             (batch_slots_[slot].stream == stream);
+           ++slot) {
+        MapToFrame(frame, letterboxes_[slot], batch_boxes_[slot],
+                   &frame_boxes_);
+      }
+      if (streams_[stream].crops.size() > 1) {
+        MergeOverlapping(&frame_boxes_);
+      }
+      // Anything the fast model wasn't sure about gets a second look.
+      streams_[stream].escalate =
+          fast && std::any_of(frame_boxes_.begin(), frame_boxes_.end(),
+                              [this](const bbox_t &box) {
+                                return box.prob < scheduler_.escalate_below();
+                              });
+      PublishBoxes(stream, frame.submitted, &frame_boxes_);
+      frame.trace.inference_start = inference_start;
+      frame.trace.inference_end = inference_end;
+      RecordLatency(stream, frame.trace);
+    }
+  }
+}
+
+void ImageProcessingModule::RecordLatency(size_t stream,
+                                          const cam::FrameTrace &trace) {
+  cam::LatencyStats *stats = options_.latency_stats;
+  if (stats == nullptr) {
+    return;
+  }
+  stats->Record(stream, cam::Stage::kInferenceWait, trace.decode_end,
+                trace.inference_start);
+  stats->Record(stream, cam::Stage::kInference, trace.inference_start,
+                trace.inference_end);
+  stats->Record(stream, cam::Stage::kDetectionTotal, trace.socket_read,
+                trace.inference_end);
+}
+
+const ImageProcessingModule::Detections &ImageProcessingModule::detections(
+    size_t stream) {
+  streams_[stream].detections.Update();
+  return streams_[stream].detections.front();
+}
+
+void ImageProcessingModule::Detections::Extrapolate(
+    std::chrono::steady_clock::time_point now, std::vector<bbox_t> *out) const {
+  const float age = std::chrono::duration<float>(now - time).count();
+  for (size_t i = 0; i < objects.size(); ++i) {
+    out->push_back(cam::Extrapolate(objects[i], velocities[i], age));
+  }
+}
+
+double ImageProcessingModule::skip_ratio() const {
+  const uint64_t considered = frames_considered_;
+  return (considered == 0) ? 0 : static_cast<double>(frames_skipped_) / considered;
+}
+
+double ImageProcessingModule::fast_batch_ratio() const {
+  const uint64_t batches = batches_run_;
+  return (batches == 0) ? 0 : static_cast<double>(fast_batches_run_) / batches;
+}
+
+void ImageProcessingModule::Exit() {
+  done_ = true;
+  doorbell_.Ring();
+}
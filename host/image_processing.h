@@ -0,0 +1,278 @@
+#ifndef IMAGE_PROCESSING_H
+#define IMAGE_PROCESSING_H
+
+#include "host/detector_factory.h"
+#include "host/frame_trace.h"
+#include "host/image_ops.h"
+#include "host/mailbox.h"
+#include "host/model_scheduler.h"
+#include "host/motion_gate.h"
+#include "host/object_detector.h"
+#include "host/region.h"
+#include "host/scene_events.h"
+#include "host/tracker.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Runs object detection for every camera stream through one shared detector,
+// on whichever backend the options pick (see LoadDetector()).
+// The latest frame from each stream is collected and cut into the stream's
+// crops (just the whole frame, by default). Each crop is letterboxed into a
+// slot of a single batched input tensor, and the whole batch is run through the
+// network in one forward pass. The resulting boxes are scattered back to their
+// streams in frame coordinates, with duplicates from overlapping crops merged.
+//
+// Given a second, faster model, each batch runs on whichever of the two the
+// scheduler picks (see ModelScheduler), so that every stream keeps getting
+// detections on time when the full model can't keep up. Both models are
+// loaded once, up front.
+//
+// Each stream's detections are tracked from frame to frame, which gives every
+// object a persistent ID, unique across streams, and a velocity to extrapolate
+// it to frames that weren't detected on.
+//
+// operator()() runs the inference loop and should get a thread to itself.
+class ImageProcessingModule {
+  public:
+    struct Options {
+      // Most crops run through the network at once. Clamped to the total
+      // number of crops, but always big enough for every crop of one frame.
+      int max_batch_size = 4;
+      // How long a frame may wait for other streams to fill out its batch.
+      std::chrono::milliseconds max_batch_wait{30};
+      float threshold = 0.2f;
+      // If set, inference latencies are recorded here.
+      cam::LatencyStats *latency_stats = nullptr;
+      // Frames that barely differ from the last one detected on are skipped,
+      // and the stream keeps its previous detections.
+      cam::MotionGate::Options motion_gate;
+      // Frames posted sooner than this after the last one detected on in
+      // their stream are skipped too. Readers extrapolate tracked objects in
+      // between.
+      std::chrono::milliseconds detection_interval{0};
+      cam::Tracker::Options tracker;
+      // If set, every stream's tracked objects are reported here after each
+      // detection.
+      cam::SceneEventServer *scene_events = nullptr;
+      // Parts of each stream's frames to run detection on, indexed by stream.
+      // Streams without any are detected on whole.
+      std::vector<std::vector<cam::Region>> crops;
+      // Boxes of the same class from different crops are merged when their
+      // intersection covers more than this much of the smaller one.
+      float merge_overlap = 0.6f;
+      // Optional fast model (e.g. yolov4-tiny) to fall back on under load.
+      // Takes the same input as the full one.
+      std::string fast_config_file;
+      std::string fast_weight_file;
+      cam::ModelScheduler::Options scheduler;
+      cam::DetectorBackend backend = cam::DefaultDetectorBackend();
+      // For the CPU backends. 0 means one per core.
+      size_t cpu_threads = 0;
+      // Most objects detected in each crop, keeping the most confident, and
+      // how many each stream's detections have room for up front. A stream
+      // with several crops can still have more, but allocates the first time
+      // it does.
+      size_t max_objects = 128;
+      // If set, called on the inference thread with true right before each
+      // batch goes to the detector backend, and with false once it's back,
+      // e.g. to tell the backend's own costs apart from the module's.
+      std::function<void(bool)> backend_hook;
+    };
+
+    ImageProcessingModule(const std::string &config_file,
+                          const std::string &weight_file, size_t num_streams,
+                          const Options &options);
+
+    // A snapshot of a stream's objects as of one frame. Snapshots live in
+    // storage reserved for the stream up front, and once published are never
+    // touched again while a reader may be looking at them, so readers use
+    // them in place instead of copying them out.
+    struct Detections {
+      // Counts up with every snapshot published for the stream, so that a
+      // reader can tell whether anything changed since it last looked.
+      uint64_t version = 0;
+      // When the frame these were detected in was posted.
+      std::chrono::steady_clock::time_point time;
+      // Tracked objects (with a track_id) and untracked ones (track_id 0).
+      std::vector<bbox_t> objects;
+      // Velocity of each object, in the same order. Zero for untracked
+      // objects, and for objects which aren't moving. See cam::Extrapolate().
+      std::vector<cam::BoxVelocity> velocities;
+
+      // Appends the objects to |out|, with each one moved along to where it
+      // should be at |now|. Doesn't allocate once |out| has room.
+      void Extrapolate(std::chrono::steady_clock::time_point now,
+                       std::vector<bbox_t> *out) const;
+    };
+
+    // Posts a 24-bit RGB frame for |stream|. Replaces the stream's previous
+    // frame if the inference loop hasn't picked that one up yet. Never blocks
+    // on the inference loop. Only one thread may post frames for a stream.
+    // |trace| is carried along to time inference against the earlier stages.
+    //
+    // Streams may be any resolution, and may change it. If |image| was scaled
+    // down from the camera's |frame_x| x |frame_y| frame (e.g. while decoding),
+    // boxes are scaled back up, so that they're always in the camera's pixels.
+    // 0 means |image| is the camera's frame.
+    void InputImage(size_t stream, const uint8_t *image, int size_x, int size_y,
+                    const cam::FrameTrace &trace = cam::FrameTrace(),
+                    int frame_x = 0, int frame_y = 0);
+
+    void operator()();
+
+    // Returns the latest detections for |stream|, without copying them. Never
+    // blocks on the inference loop. Only one thread may read a stream's
+    // detections, and the returned snapshot stays valid, and unchanged, until
+    // that thread's next call for the same stream.
+    const Detections &detections(size_t stream);
+
+    // False if the full model failed to load, in which case operator()()
+    // returns right away.
+    bool ok() const { return full_.detector != nullptr; }
+
+    // Dimensions of the full model's input that frames are letterboxed into.
+    int net_width() const { return full_.width; }
+    int net_height() const { return full_.height; }
+
+    // Fraction of the frames picked up by the inference loop which were
+    // skipped, by the motion gate or the detection interval.
+    double skip_ratio() const;
+    // Fraction of batches which ran on the fast model.
+    double fast_batch_ratio() const;
+
+    bool done() const { return done_; }
+    void Exit();
+
+  private:
+    struct Frame {
+      std::vector<uint8_t> data;
+      int size_x = 0;
+      int size_y = 0;
+      // Size of the camera's frame, which data may be scaled down from.
+      int frame_x = 0;
+      int frame_y = 0;
+      std::chrono::steady_clock::time_point submitted;
+      cam::FrameTrace trace;
+    };
+
+    struct Stream {
+      cam::Mailbox<Frame> frames;
+      cam::Mailbox<Detections> detections;
+      // Set by the inference loop when frames.front() holds a frame which
+      // hasn't been run through the network yet.
+      bool ready = false;
+      // Only touched by the inference loop.
+      cam::MotionGate motion_gate;
+      std::chrono::steady_clock::time_point last_detected;
+      // Boxes last published, after tracking.
+      std::vector<bbox_t> tracked;
+      // Version of the last snapshot published.
+      uint64_t version = 0;
+      std::vector<cam::Region> crops;
+      // Set when the fast model wasn't confident about the stream's last
+      // frame, so that its next one gets the full model if there's time.
+      bool escalate = false;
+    };
+
+    // A loaded model, and the input size it expects.
+    struct Network {
+      std::unique_ptr<cam::ObjectDetector> detector;
+      int width = 0;
+      int height = 0;
+    };
+
+    // A crop of a stream's frame, occupying one slot of the batch.
+    struct Slot {
+      size_t stream;
+      size_t crop;
+    };
+
+    // Where a crop of a frame landed within its slot of the batch, to map
+    // boxes back to frame coordinates.
+    struct Letterbox {
+      int crop_x;
+      int crop_y;
+      float scale;
+      int offset_x;
+      int offset_y;
+    };
+
+    Network LoadNetwork(const std::string &config_file,
+                        const std::string &weight_file) const;
+    // Waits for a batch to fill up (or for the wait deadline), picks the
+    // model to run it on, and lists the chosen crops in batch_slots_, with
+    // each stream's crops next to each other. Returns false on exit.
+    bool CollectBatch();
+    // Scales |crop| of |frame| to fit |network|'s input, centered on a gray
+    // background, and writes it planar into slot |slot| of batch_input_.
+    Letterbox LetterboxInto(const Network &network, const Frame &frame,
+                            const cam::Region &crop, int slot);
+    // Maps |boxes| from a slot back to |frame| and appends them to |out|.
+    void MapToFrame(const Frame &frame, const Letterbox &letterbox,
+                    const std::vector<bbox_t> &boxes, std::vector<bbox_t> *out);
+    // Merges boxes of the same class which mostly overlap, as happens when an
+    // object shows up in more than one crop.
+    void MergeOverlapping(std::vector<bbox_t> *boxes);
+    // Tracks |boxes|, already in frame coordinates, and publishes them as
+    // detected in a frame posted at |time|. Leaves |boxes| unspecified.
+    void PublishBoxes(size_t stream, std::chrono::steady_clock::time_point time,
+                      std::vector<bbox_t> *boxes);
+    // Publishes the stream's tracked boxes again, as of |time|. Unless
+    // |moving|, they're published without velocities, so that readers don't
+    // move them along.
+    void PublishTracked(size_t stream,
+                        std::chrono::steady_clock::time_point time,
+                        bool moving);
+    void RecordLatency(size_t stream, const cam::FrameTrace &trace);
+
+    Options options_;
+    std::atomic<bool> done_{false};
+    std::vector<Stream> streams_;
+    cam::TrackIds track_ids_;
+    // Only touched by the inference loop, by stream.
+    std::vector<cam::Tracker> trackers_;
+    std::atomic<uint64_t> frames_considered_{0};
+    std::atomic<uint64_t> frames_skipped_{0};
+    std::atomic<uint64_t> batches_run_{0};
+    std::atomic<uint64_t> fast_batches_run_{0};
+    // Rung whenever a frame is posted, or on exit.
+    cam::Doorbell doorbell_;
+
+    // Only touched by the inference loop.
+    uint64_t doorbell_seen_ = 0;
+    // Stream to start looking at for the next batch, so that no stream starves
+    // when there are more ready frames than batch slots.
+    size_t next_stream_ = 0;
+    std::vector<Slot> batch_slots_;
+    cam::ModelScheduler scheduler_;
+    cam::ModelScheduler::Model batch_model_ = cam::ModelScheduler::Model::kFull;
+    // Planar float input for the whole batch, reused from batch to batch.
+    std::unique_ptr<float[], decltype(&std::free)> batch_input_{nullptr,
+                                                                &std::free};
+    size_t batch_input_size_ = 0;
+    // Boxes found in each slot of the batch, with room for max_objects each.
+    std::vector<std::vector<bbox_t>> batch_boxes_;
+    std::vector<Letterbox> letterboxes_;
+    // Scratch space for crops, for frames which need resizing, and for boxes
+    // being mapped back to a frame and merged.
+    std::vector<uint8_t> cropped_;
+    std::vector<uint8_t> resized_;
+    cam::ResizeScratch resize_scratch_;
+    std::vector<bbox_t> frame_boxes_;
+    std::vector<bbox_t> merged_;
+    // Scratch space for the tracks scene events are told are still around.
+    std::vector<unsigned int> live_track_ids_;
+
+    Network full_;
+    // Only loaded if the options name one.
+    Network fast_;
+};
+
+#endif // IMAGE_PROCESSING_H
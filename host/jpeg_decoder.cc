@@ -0,0 +1,92 @@
+#include "host/jpeg_decoder.h"
+
+#include "libjpeg_turbo/turbojpeg.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace cam {
+
+namespace {
+
+// Owns this thread's decompressor handle.
+struct ThreadDecompressor {
+  tjhandle handle = tjInitDecompress();
+  ~ThreadDecompressor() {
+    if (handle != nullptr) {
+      tjDestroy(handle);
+    }
+  }
+};
+
+tjhandle DecompressorForThisThread() {
+  thread_local ThreadDecompressor decompressor;
+  return decompressor.handle;
+}
+
+// Picks the scaling factor giving the smallest image that's still at least
+// |min_width| x |min_height|.
+tjscalingfactor PickScalingFactor(int width, int height, int min_width,
+                                  int min_height) {
+  tjscalingfactor best = {1, 1};
+  int num_factors = 0;
+  const tjscalingfactor *factors = tjGetScalingFactors(&num_factors);
+  for (int i = 0; i < num_factors; ++i) {
+    const int scaled_width = TJSCALED(width, factors[i]);
+    const int scaled_height = TJSCALED(height, factors[i]);
+    if ((scaled_width >= min_width) && (scaled_height >= min_height) &&
+        (scaled_width < TJSCALED(width, best))) {
+      best = factors[i];
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+JpegDecoder::JpegDecoder(const Options &options)
+    : flags_((options.fast_dct ? TJFLAG_FASTDCT : TJFLAG_ACCURATEDCT) |
+             (options.fast_upsample ? TJFLAG_FASTUPSAMPLE : 0)) {}
+
+DecodedJpeg JpegDecoder::Decode(const uint8_t *jpeg, size_t len) {
+  return DecodeToFit(jpeg, len, 0, 0);
+}
+
+DecodedJpeg JpegDecoder::DecodeToFit(const uint8_t *jpeg, size_t len,
+                                     int fit_width, int fit_height) {
+  tjhandle operation = DecompressorForThisThread();
+  if (operation == nullptr) {
+    return {};
+  }
+  DecodedJpeg image;
+  if (tjDecompressHeader3(operation, jpeg, len, &image.width, &image.height,
+                          &image.subsample, &image.colorspace) < 0) {
+    return {};
+  }
+  image.source_width = image.width;
+  image.source_height = image.height;
+
+  if ((fit_width > 0) && (fit_height > 0)) {
+    // The size the image ends up at after letterboxing. Never upscale.
+    const float scale = std::min(
+        1.0f, std::min(static_cast<float>(fit_width) / image.width,
+                       static_cast<float>(fit_height) / image.height));
+    const tjscalingfactor factor =
+        PickScalingFactor(image.width, image.height, image.width * scale,
+                          image.height * scale);
+    image.width = TJSCALED(image.width, factor);
+    image.height = TJSCALED(image.height, factor);
+  }
+
+  // 24-bit colorspace.
+  const int pixel_format = TJPF_RGB;
+  image.data = buffers_.Acquire(static_cast<size_t>(image.width) *
+                                image.height * tjPixelSize[pixel_format]);
+  if (tjDecompress2(operation, jpeg, len, image.data->data(), image.width, 0,
+                    image.height, pixel_format, flags_) < 0) {
+    return {};
+  }
+  return image;
+}
+
+}  // namespace cam
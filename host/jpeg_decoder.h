@@ -0,0 +1,59 @@
+#ifndef JPEG_DECODER_H
+#define JPEG_DECODER_H
+
+#include "host/buffer_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cam {
+
+struct DecodedJpeg {
+  int width = 0;
+  int height = 0;
+  // The JPEG's own size, which width and height are less than if it was
+  // scaled while decoding.
+  int source_width = 0;
+  int source_height = 0;
+  int subsample = 0;
+  int colorspace = 0;
+  // 24-bit RGB. Null if decoding failed.
+  BufferPool::Buffer data;
+
+  size_t data_size() const { return data ? data->size() : 0; }
+};
+
+// Decodes JPEGs to RGB with turbojpeg. Each thread gets its own decompressor
+// handle, created on first use, and output buffers come from a pool, so
+// decoding a stream of frames doesn't allocate.
+//
+// This class is threadsafe.
+class JpegDecoder {
+  public:
+    struct Options {
+      // Trade a little accuracy for speed. See TJFLAG_FASTDCT and
+      // TJFLAG_FASTUPSAMPLE.
+      bool fast_dct = false;
+      bool fast_upsample = false;
+    };
+
+    explicit JpegDecoder(const Options &options);
+
+    // Decodes at full resolution.
+    DecodedJpeg Decode(const uint8_t *jpeg, size_t len);
+
+    // Decodes at the smallest DCT scaling factor which loses no resolution
+    // once the image is letterboxed into |fit_width| x |fit_height|. Scaling
+    // while decoding is much cheaper than decoding everything and then
+    // throwing most of it away in a resize.
+    DecodedJpeg DecodeToFit(const uint8_t *jpeg, size_t len, int fit_width,
+                            int fit_height);
+
+  private:
+    int flags_;
+    BufferPool buffers_;
+};
+
+}  // namespace cam
+
+#endif // JPEG_DECODER_H
@@ -0,0 +1,111 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace cam {
+
+// Single-producer single-consumer "latest value wins" handoff, implemented as a
+// lock-free triple buffer. The producer fills in back() and publishes it; the
+// consumer picks up whatever was published most recently. Neither side ever
+// blocks on the other, and values the consumer was too slow to see are simply
+// overwritten rather than queued.
+//
+// Slots are reused, so a T that holds heap memory (vectors, maps) keeps its
+// capacity from one value to the next.
+template <typename T>
+class Mailbox {
+  public:
+    Mailbox() = default;
+    Mailbox(const Mailbox &rhs) = delete;
+
+    // Calls |init| on every slot, e.g. to reserve memory up front so that
+    // publishing never has to allocate. Only before either side starts.
+    template <typename F>
+    void InitSlots(F init) {
+      for (T &slot : slots_) {
+        init(slot);
+      }
+    }
+
+    // Producer side. back() is only valid until Publish().
+    T &back() { return slots_[back_]; }
+    void Publish() {
+      back_ = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel) &
+              kIndexMask;
+    }
+
+    // Consumer side. Returns true if a value newer than front() was picked
+    // up. front() stays valid, and untouched by the producer, until the next
+    // Update().
+    bool Update() {
+      if ((middle_.load(std::memory_order_relaxed) & kFresh) == 0) {
+        return false;
+      }
+      front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndexMask;
+      return true;
+    }
+    T &front() { return slots_[front_]; }
+
+    // True if the producer has published since the last Update(). May be
+    // called from either side.
+    bool HasUpdate() const {
+      return (middle_.load(std::memory_order_relaxed) & kFresh) != 0;
+    }
+
+  private:
+    static constexpr uint8_t kIndexMask = 0x3;
+    static constexpr uint8_t kFresh = 0x4;
+
+    T slots_[3];
+    // Only touched by the producer.
+    uint8_t back_ = 0;
+    // Index of the slot in the middle, plus kFresh if it hasn't been picked up
+    // yet.
+    std::atomic<uint8_t> middle_{1};
+    // Only touched by the consumer.
+    uint8_t front_ = 2;
+};
+
+// Lets a consumer sleep until a producer has something for it, to pair with
+// one or more Mailboxes. Ringing only takes the lock for long enough to bump
+// a counter, so producers never wait on a slow consumer.
+class Doorbell {
+  public:
+    void Ring() {
+      {
+        std::lock_guard<std::mutex> guard(lock_);
+        rings_++;
+      }
+      rung_.notify_all();
+    }
+
+    // Waits until the doorbell has been rung since |*seen|, or until
+    // |deadline|. Updates |*seen|.
+    template <typename Clock, typename Duration>
+    void WaitUntil(uint64_t *seen,
+                   std::chrono::time_point<Clock, Duration> deadline) {
+      std::unique_lock<std::mutex> lock(lock_);
+      rung_.wait_until(lock, deadline, [&]() { return rings_ != *seen; });
+      *seen = rings_;
+    }
+
+    void Wait(uint64_t *seen) {
+      std::unique_lock<std::mutex> lock(lock_);
+      rung_.wait(lock, [&]() { return rings_ != *seen; });
+      *seen = rings_;
+    }
+
+  private:
+    std::mutex lock_;
+    std::condition_variable rung_;
+    uint64_t rings_ = 0;
+};
+
+}  // namespace cam
+
+#endif // MAILBOX_H
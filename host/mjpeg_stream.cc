@@ -0,0 +1,44 @@
+#include "host/mjpeg_stream.h"
+
+#include <cstdio>
+#include <random>
+
+namespace cam {
+
+std::string StreamHeader(const std::string &boundary, int frame_rate) {
+  return "HTTP/1.1 200 OK\r\n"
+         "Content-Type: multipart/x-mixed-replace;boundary=" + boundary + "\r\n"
+         "Transfer-Encoding: chunked\r\n"
+         "Access-Control-Allow-Origin: *\r\n"
+         "X-Framerate: " + std::to_string(frame_rate) + "\r\n"
+         "\r\n";
+}
+
+std::string FrameChunks(const std::string &jpeg, double timestamp,
+                        const std::string &boundary) {
+  char part_header[128];
+  snprintf(part_header, sizeof(part_header),
+           "Content-Type: image/jpeg\r\nContent-Length: %zu\r\n"
+           "X-Timestamp: %.6f\r\n\r\n",
+           jpeg.size(), timestamp);
+  return Chunk("\r\n--" + boundary + "\r\n") + Chunk(part_header) + Chunk(jpeg);
+}
+
+std::string EndOfStream() { return "0\r\n\r\n"; }
+
+std::string Chunk(const std::string &payload) {
+  char size_hex[32];
+  snprintf(size_hex, sizeof(size_hex), "%zx\r\n", payload.size());
+  return size_hex + payload + "\r\n";
+}
+
+std::string RandomPayload(size_t len, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::string payload(len, '\0');
+  for (char &c : payload) {
+    c = static_cast<char>(rng());
+  }
+  return payload;
+}
+
+}  // namespace cam
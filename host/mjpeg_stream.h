@@ -0,0 +1,34 @@
+#ifndef MJPEG_STREAM_H
+#define MJPEG_STREAM_H
+
+#include <cstdint>
+#include <string>
+
+namespace cam {
+
+// Helpers for synthesizing the MJPEG-over-chunked-HTTP stream that the ESP32
+// camera demo firmware serves, for benchmarks and fake cameras.
+
+constexpr char kDefaultBoundary[] = "123456789000000000000987654321";
+
+// HTTP response header that starts every stream.
+std::string StreamHeader(const std::string &boundary = kDefaultBoundary,
+                         int frame_rate = 60);
+
+// The three chunks (separator, part header, payload) the camera sends for each
+// frame.
+std::string FrameChunks(const std::string &jpeg, double timestamp,
+                        const std::string &boundary = kDefaultBoundary);
+
+// The zero-length chunk that ends a stream.
+std::string EndOfStream();
+
+// Wraps |payload| in HTTP chunked transfer encoding.
+std::string Chunk(const std::string &payload);
+
+// |len| bytes of deterministic noise, as a stand-in for a JPEG.
+std::string RandomPayload(size_t len, uint32_t seed = 0);
+
+}  // namespace cam
+
+#endif // MJPEG_STREAM_H
@@ -0,0 +1,63 @@
+#include "host/model_scheduler.h"
+
+namespace cam {
+
+namespace {
+
+// Weight of the newest batch in the smoothed latencies.
+constexpr double kLatencySmoothing = 0.2;
+
+void Smooth(double sample, double *average) {
+  *average = (*average < 0)
+                 ? sample
+                 : *average + kLatencySmoothing * (sample - *average);
+}
+
+}  // namespace
+
+ModelScheduler::ModelScheduler(const Options &options) : options_(options) {}
+
+ModelScheduler::Model ModelScheduler::Choose(size_t batches_waiting,
+                                             bool escalation_waiting) {
+  if (full_latency_ < 0) {
+    return Model::kFull;
+  }
+  const double period =
+      std::chrono::duration<double>(options_.detection_period).count();
+  const double full_cycle = batches_waiting * full_latency_;
+  overloaded_ =
+      full_cycle > (overloaded_ ? period * options_.hysteresis : period);
+  if (!overloaded_) {
+    return Model::kFull;
+  }
+  if (fast_latency_ < 0) {
+    return Model::kFast;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  const auto since_full = now - last_full_;
+  if (since_full >= options_.probe_period) {
+    return Model::kFull;
+  }
+  // Whatever's left of the period after the fast model has gone around every
+  // stream pays for at most one full batch.
+  const double fast_cycle = batches_waiting * fast_latency_;
+  if (escalation_waiting && (fast_cycle + full_latency_ <= period) &&
+      (since_full >= options_.detection_period)) {
+    return Model::kFull;
+  }
+  return Model::kFast;
+}
+
+void ModelScheduler::Record(Model model,
+                            std::chrono::steady_clock::duration latency) {
+  const double seconds = std::chrono::duration<double>(latency).count();
+  if (model == Model::kFull) {
+    Smooth(seconds, &full_latency_);
+    last_full_ = std::chrono::steady_clock::now();
+  } else {
+    Smooth(seconds, &fast_latency_);
+  }
+}
+
+}  // namespace cam
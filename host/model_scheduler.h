@@ -0,0 +1,61 @@
+#ifndef MODEL_SCHEDULER_H
+#define MODEL_SCHEDULER_H
+
+#include <chrono>
+#include <cstddef>
+
+namespace cam {
+
+// Decides, batch by batch, whether detection runs on the full model or on a
+// faster, less accurate one. The full model is used for as long as it can
+// still get around every waiting stream within the detection period. Once it
+// can't, batches switch to the fast model, and the full one only runs when
+// there's time to spare: for streams the fast model wasn't sure about, and
+// now and then to check whether the load has eased off.
+//
+// Not threadsafe. Meant to be owned by the inference loop.
+class ModelScheduler {
+  public:
+    enum class Model { kFull, kFast };
+
+    struct Options {
+      // Every stream should get a detection at least this often.
+      std::chrono::milliseconds detection_period{200};
+      // Once overloaded, the full model has to fit in this fraction of the
+      // detection period before switching back, so that it doesn't flap.
+      float hysteresis = 0.8f;
+      // Streams with a fast model detection less confident than this get their
+      // next frame run on the full model, if there's time.
+      float escalate_below = 0.5f;
+      // Run the full model at least this often while overloaded, to keep its
+      // latency estimate current.
+      std::chrono::milliseconds probe_period{5000};
+    };
+
+    ModelScheduler() : ModelScheduler(Options()) {}
+    explicit ModelScheduler(const Options &options);
+
+    // Picks the model for the next batch, given how many batches it takes to
+    // get through every waiting stream, and whether any waiting stream asked
+    // for the full model.
+    Model Choose(size_t batches_waiting, bool escalation_waiting);
+
+    // Records how long a batch took to run on |model|.
+    void Record(Model model, std::chrono::steady_clock::duration latency);
+
+    // True if the full model can't currently keep up on its own.
+    bool overloaded() const { return overloaded_; }
+    float escalate_below() const { return options_.escalate_below; }
+
+  private:
+    Options options_;
+    bool overloaded_ = false;
+    // Smoothed batch latencies, in seconds. Negative until measured.
+    double full_latency_ = -1;
+    double fast_latency_ = -1;
+    std::chrono::steady_clock::time_point last_full_;
+};
+
+}  // namespace cam
+
+#endif // MODEL_SCHEDULER_H
@@ -0,0 +1,80 @@
+#include "host/motion_gate.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace cam {
+
+namespace {
+
+// Pixels sampled along each axis of a thumbnail block. Averaging a sparse grid
+// is nearly as good at rejecting noise as averaging the whole block, at a
+// fraction of the memory traffic.
+constexpr int kSamplesPerBlock = 4;
+
+}  // namespace
+
+MotionGate::MotionGate(const Options &options) : options_(options) {}
+
+void MotionGate::Thumbnail(const uint8_t *frame, int size_x, int size_y,
+                           std::vector<uint8_t> *thumbnail) const {
+  const int width = options_.thumbnail_width;
+  const int height = options_.thumbnail_height;
+  thumbnail->resize(static_cast<size_t>(width) * height);
+  for (int ty = 0; ty < height; ++ty) {
+    const int y0 = ty * size_y / height;
+    const int y1 = std::max(y0 + 1, (ty + 1) * size_y / height);
+    const int step_y = std::max(1, (y1 - y0) / kSamplesPerBlock);
+    for (int tx = 0; tx < width; ++tx) {
+      const int x0 = tx * size_x / width;
+      const int x1 = std::max(x0 + 1, (tx + 1) * size_x / width);
+      const int step_x = std::max(1, (x1 - x0) / kSamplesPerBlock);
+      uint32_t sum = 0;
+      uint32_t count = 0;
+      for (int y = y0; y < y1; y += step_y) {
+        const uint8_t *row = frame + static_cast<size_t>(y) * size_x * 3;
+        for (int x = x0; x < x1; x += step_x) {
+          const uint8_t *pixel = row + x * 3;
+          // BT.601 luma in 8-bit fixed point.
+          sum += (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8;
+          count++;
+        }
+      }
+      (*thumbnail)[ty * width + tx] = sum / count;
+    }
+  }
+}
+
+bool MotionGate::Check(const uint8_t *frame, int size_x, int size_y) {
+  if (!options_.enabled) {
+    return true;
+  }
+  Thumbnail(frame, size_x, size_y, &candidate_);
+  if (reference_.size() != candidate_.size()) {
+    return true;
+  }
+  if (std::chrono::steady_clock::now() - committed_ >= options_.max_skip) {
+    return true;
+  }
+  const size_t min_changed = std::max<size_t>(
+      1, options_.changed_fraction * candidate_.size());
+  size_t changed = 0;
+  for (size_t i = 0; i < candidate_.size(); ++i) {
+    if (std::abs(candidate_[i] - reference_[i]) >= options_.pixel_threshold) {
+      if (++changed >= min_changed) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void MotionGate::Commit() {
+  if (!options_.enabled) {
+    return;
+  }
+  reference_.swap(candidate_);
+  committed_ = std::chrono::steady_clock::now();
+}
+
+}  // namespace cam
@@ -0,0 +1,57 @@
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cam {
+
+// Cheap change detection in front of the detector. Each frame is boiled down
+// to a tiny grayscale thumbnail and compared against the thumbnail of the last
+// frame that went through the network. If hardly any of it changed, the frame
+// isn't worth detecting on, and the previous detections still stand.
+//
+// Not threadsafe. Each camera stream should get its own.
+class MotionGate {
+  public:
+    struct Options {
+      bool enabled = true;
+      // Thumbnail size. Each thumbnail pixel averages a block of the frame, so
+      // sensor noise mostly cancels out.
+      int thumbnail_width = 64;
+      int thumbnail_height = 48;
+      // A thumbnail pixel has changed once it's this much brighter or darker.
+      int pixel_threshold = 12;
+      // Fraction of thumbnail pixels which must change to count as motion.
+      float changed_fraction = 0.005f;
+      // Detect at least this often anyway, so that detections never go stale.
+      std::chrono::milliseconds max_skip{5000};
+    };
+
+    MotionGate() : MotionGate(Options()) {}
+    explicit MotionGate(const Options &options);
+
+    // Returns true if the 24-bit RGB |frame| differs enough from the last
+    // committed one to be worth detecting on. Always true if disabled, or if
+    // nothing has been committed yet.
+    bool Check(const uint8_t *frame, int size_x, int size_y);
+
+    // Makes the frame last passed to Check() the one future frames are compared
+    // against. Call once it's been run through the network.
+    void Commit();
+
+  private:
+    void Thumbnail(const uint8_t *frame, int size_x, int size_y,
+                   std::vector<uint8_t> *thumbnail) const;
+
+    Options options_;
+    std::vector<uint8_t> reference_;
+    std::vector<uint8_t> candidate_;
+    std::chrono::steady_clock::time_point committed_;
+};
+
+}  // namespace cam
+
+#endif // MOTION_GATE_H
@@ -0,0 +1,55 @@
+#ifndef OBJECT_DETECTOR_H
+#define OBJECT_DETECTOR_H
+
+#include "include/yolo_v2_class.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace cam {
+
+// Intersection over union of two boxes, 0 if they don't overlap.
+inline float IntersectionOverUnion(const bbox_t &a, const bbox_t &b) {
+  const float x0 = std::max(a.x, b.x);
+  const float y0 = std::max(a.y, b.y);
+  const float x1 = std::min(a.x + a.w, b.x + b.w);
+  const float y1 = std::min(a.y + a.h, b.y + b.h);
+  if ((x1 <= x0) || (y1 <= y0)) {
+    return 0;
+  }
+  const float intersection = (x1 - x0) * (y1 - y0);
+  return intersection /
+         (static_cast<float>(a.w) * a.h + static_cast<float>(b.w) * b.h -
+          intersection);
+}
+
+// A loaded object detection model, whatever runs it. Boxes are reported with
+// darknet's bbox_t regardless of the backend.
+class ObjectDetector {
+  public:
+    virtual ~ObjectDetector() = default;
+
+    // Dimensions of the input images the model expects.
+    virtual int net_width() const = 0;
+    virtual int net_height() const = 0;
+    // Whether DetectBatch() always has to be given the batch size the model
+    // was loaded with, rather than just as many images as there are.
+    virtual bool fixed_batch_size() const { return false; }
+
+    // Runs |batch_size| images through the model. |input| holds them back to
+    // back, each net_width() x net_height(), as planar RGB floats in [0, 1].
+    // Fills the first |batch_size| entries of |boxes| (growing it if needed)
+    // with each image's boxes, in pixels of the network input, with
+    // overlapping boxes of the same class already suppressed, and only the
+    // |max_boxes| most confident kept. The entries' storage is reused, so a
+    // caller which keeps |boxes| around with room for |max_boxes| in each
+    // never has the results allocated for it. Not threadsafe.
+    virtual void DetectBatch(const float *input, int batch_size,
+                             float threshold, size_t max_boxes,
+                             std::vector<std::vector<bbox_t>> *boxes) = 0;
+};
+
+}  // namespace cam
+
+#endif // OBJECT_DETECTOR_H
@@ -0,0 +1,31 @@
+#include "host/object_names.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+
+namespace cam {
+
+bool LoadObjectNames(const std::string &path, std::vector<std::string> *names) {
+  std::ifstream file(path);
+  if (!file.good()) {
+    std::cerr << "Invalid object ID file: " << path << std::endl;
+    return false;
+  }
+  names->clear();
+  std::string line;
+  while (std::getline(file, line)) {
+    line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+    names->push_back(line);
+  }
+  return true;
+}
+
+const std::string &ObjectName(const std::vector<std::string> &names,
+                              unsigned int obj_id) {
+  static const std::string kInvalid = "invalid";
+  return (obj_id < names.size()) ? names[obj_id] : kInvalid;
+}
+
+}  // namespace cam
@@ -0,0 +1,24 @@
+#ifndef OBJECT_NAMES_H
+#define OBJECT_NAMES_H
+
+#include <string>
+#include <vector>
+
+namespace cam {
+
+// The COCO class names the models were trained on, as in darknet's
+// data/coco.names. Kept here so that builds without darknet have them too.
+inline constexpr char kObjectIdsFile[] = "host/coco.names";
+
+// Class names in darknet's format (e.g. coco.names): one per line, in obj_id
+// order. Whitespace is stripped. Returns false, and logs why, if the file
+// can't be read.
+bool LoadObjectNames(const std::string &path, std::vector<std::string> *names);
+
+// |names|[obj_id], or "invalid" if there's no such class.
+const std::string &ObjectName(const std::vector<std::string> &names,
+                              unsigned int obj_id);
+
+}  // namespace cam
+
+#endif // OBJECT_NAMES_H
@@ -0,0 +1,371 @@
+#include "host/pipeline.h"
+
+#include "host/object_names.h"
+#include "host/tracker.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace cam {
+namespace {
+
+// Trade a little decode accuracy for speed. See TJFLAG_FASTDCT.
+constexpr bool kFastDct = false;
+// JPEGs from all of the cameras are decoded on this many threads. 0 means one
+// per core.
+constexpr size_t kDecodeThreads = 0;
+// How often decode worker utilization is logged and latency stats are dumped.
+constexpr std::chrono::seconds kStatsPeriod(10);
+// Per-stage latency percentiles are dumped here as JSON.
+constexpr char kLatencyStatsFile[] = "/tmp/host_client_latency.json";
+
+// Record at most one frame per camera this often. 0 records every frame.
+constexpr std::chrono::milliseconds kRecordInterval(1000);
+constexpr char kWeightFile[] = "host/yolov4.weights";
+constexpr char kConfigFile[] = "host/yolov4.cfg";
+// Detection falls back on the tiny model when the full one can't get around
+// every camera once per kDetectionPeriod.
+constexpr char kFastWeightFile[] = "host/yolov4-tiny.weights";
+constexpr char kFastConfigFile[] = "host/yolov4-tiny.cfg";
+constexpr std::chrono::milliseconds kDetectionPeriod(200);
+// Each camera is detected on at most this often. Tracked objects are
+// extrapolated in between.
+constexpr std::chrono::milliseconds kDetectionInterval(100);
+
+// Detection runs on the latest frame from up to this many cameras at once. A
+// frame waits at most kMaxBatchWait for other cameras to fill out its batch.
+constexpr int kMaxBatchSize = 4;
+constexpr std::chrono::milliseconds kMaxBatchWait(30);
+// Neighboring detection tiles (see CameraConfig::tiles_x) overlap by this
+// fraction of a tile.
+constexpr float kTileOverlap = 0.15f;
+
+// Where recordings go unless the file prefix names its own directory:
+// $XDG_DATA_HOME/argos, or ~/.local/share/argos. Empty if neither variable is
+// set.
+std::string DefaultRecordingDirectory() {
+  const char *data_home = getenv("XDG_DATA_HOME");
+  if ((data_home != nullptr) && (data_home[0] != '\0')) {
+    return std::string(data_home) + "/argos";
+  }
+  const char *home = getenv("HOME");
+  if ((home != nullptr) && (home[0] != '\0')) {
+    return std::string(home) + "/.local/share/argos";
+  }
+  return "";
+}
+
+// Creates |directory|, and any missing parents. Returns false (and logs why)
+// if it still can't be written to.
+bool MakeWritableDirectory(const std::string &directory) {
+  for (size_t slash = directory.find('/', 1); ;
+       slash = directory.find('/', slash + 1)) {
+    const std::string path = directory.substr(0, slash);
+    if ((mkdir(path.c_str(), 0755) == -1) && (errno != EEXIST)) {
+      std::cerr << "Could not create " << path << ": " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+    if (slash == std::string::npos) {
+      break;
+    }
+  }
+  if (access(directory.c_str(), W_OK) == -1) {
+    std::cerr << "Can't record to " << directory << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::unique_ptr<Pipeline> Pipeline::Create(const Options &options,
+                                           FrameCallback frame_callback) {
+  std::unique_ptr<Pipeline> pipeline(
+      new Pipeline(options, std::move(frame_callback)));
+  if (!pipeline->Start()) {
+    return nullptr;
+  }
+  return pipeline;
+}
+
+Pipeline::Pipeline(const Options &options, FrameCallback frame_callback)
+    : options_(options), frame_callback_(std::move(frame_callback)),
+      latency_stats_(options.cameras.size()) {}
+
+bool Pipeline::Start() {
+  if (!LoadObjectNames(kObjectIdsFile, &class_names_)) {
+    return false;
+  }
+
+  // Every camera is recorded to its own series of segment files. This is
+  // set up first, so that a bad directory fails before the detector loads.
+  if (!options_.file_prefix.empty()) {
+    FrameRecorder::Options recorder_options;
+    std::string prefix = options_.file_prefix;
+    const size_t slash = prefix.rfind('/');
+    if (slash == std::string::npos) {
+      recorder_options.directory = DefaultRecordingDirectory();
+      if (recorder_options.directory.empty()) {
+        std::cerr << "Neither XDG_DATA_HOME nor HOME is set, so there's "
+                     "nowhere to record to. Give the file prefix a directory."
+                  << std::endl;
+        return false;
+      }
+    } else {
+      recorder_options.directory = (slash == 0) ? "/" : prefix.substr(0, slash);
+      prefix = prefix.substr(slash + 1);
+    }
+    if (!MakeWritableDirectory(recorder_options.directory)) {
+      return false;
+    }
+    recorder_options.min_interval = kRecordInterval;
+    std::vector<std::string> camera_prefixes;
+    for (const auto &camera : options_.cameras) {
+      camera_prefixes.push_back(camera.name.empty() ? prefix
+                                                    : prefix + "_" + camera.name);
+    }
+    std::cout << "Recording to " << recorder_options.directory << std::endl;
+    recorder_ = std::make_unique<FrameRecorder>(recorder_options,
+                                                std::move(camera_prefixes));
+  }
+
+  // Scene events and viewers are nice to have, so carry on without them if
+  // their sockets can't be opened.
+  if (!options_.scene_event_socket.empty()) {
+    SceneEventServer::Options scene_event_options;
+    scene_event_options.socket_path = options_.scene_event_socket;
+    scene_event_options.class_names = class_names_;
+    scene_event_options.num_cameras = options_.cameras.size();
+    scene_events_ = SceneEventServer::Create(scene_event_options);
+    if (scene_events_) {
+      scene_event_thread_ = std::thread([this]() { scene_events_->Run(); });
+    }
+  }
+  if (!options_.frame_socket.empty()) {
+    frame_server_ =
+        FrameServer::Create(options_.frame_socket, options_.cameras.size());
+    if (frame_server_) {
+      frame_server_thread_ = std::thread([this]() { frame_server_->Run(); });
+    }
+  }
+
+  ImageProcessingModule::Options detection_options;
+  detection_options.max_batch_size = kMaxBatchSize;
+  detection_options.max_batch_wait = kMaxBatchWait;
+  detection_options.latency_stats = &latency_stats_;
+  detection_options.fast_config_file = kFastConfigFile;
+  detection_options.fast_weight_file = kFastWeightFile;
+  detection_options.scheduler.detection_period = kDetectionPeriod;
+  detection_options.detection_interval = kDetectionInterval;
+  detection_options.scene_events = scene_events_.get();
+  detection_options.backend = options_.backend;
+  // Cameras detected on in pieces need every pixel they've got, as do the
+  // ones on display.
+  for (size_t camera = 0; camera < options_.cameras.size(); ++camera) {
+    const CameraConfig &config = options_.cameras[camera];
+    detection_options.crops.push_back(config.DetectionCrops(kTileOverlap));
+    full_resolution_.push_back(
+        detection_options.crops.back().size() > 1 || !config.regions.empty() ||
+        std::count(options_.displayed_cameras.begin(),
+                   options_.displayed_cameras.end(), camera) != 0);
+  }
+  image_processing_ = std::make_unique<ImageProcessingModule>(
+      kConfigFile, kWeightFile, options_.cameras.size(), detection_options);
+  if (!image_processing_->ok()) {
+    return false;
+  }
+  image_processing_thread_ =
+      std::thread([this]() { (*image_processing_)(); });
+
+  // All of the camera sockets are serviced from one reactor thread, which
+  // wakes Run() up whenever a frame is ready.
+  connections_ = std::make_unique<ConnectionManager>(options_.cameras);
+  connections_->SetFrameCallback(
+      [this](size_t /*camera*/) { frame_ready_.Ring(); });
+  connection_thread_ = std::thread([this]() { connections_->Run(); });
+
+  // Finished decodes wake Run() up too.
+  DecodePool::Options decode_options;
+  decode_options.num_threads = kDecodeThreads;
+  decode_options.num_cameras = options_.cameras.size();
+  decode_options.decoder.fast_dct = kFastDct;
+  decode_pool_ = std::make_unique<DecodePool>(
+      decode_options, [this]() { frame_ready_.Ring(); });
+  return true;
+}
+
+Pipeline::~Pipeline() {
+  if (connection_thread_.joinable()) {
+    connections_->Stop();
+    connection_thread_.join();
+  }
+  // Nothing feeds the decode pool any more, so this just waits out the
+  // decodes in flight.
+  decode_pool_.reset();
+  if (image_processing_thread_.joinable()) {
+    image_processing_->Exit();
+    image_processing_thread_.join();
+  }
+  if (scene_event_thread_.joinable()) {
+    scene_events_->Stop();
+    scene_event_thread_.join();
+  }
+  if (frame_server_thread_.joinable()) {
+    frame_server_->Stop();
+    frame_server_thread_.join();
+  }
+}
+
+void Pipeline::Run() {
+  uint64_t frame_ready_seen = 0;
+  auto last_stats_time = std::chrono::steady_clock::now();
+  bool frames_pending = false;
+  while (!stopping_) {
+    if (!frames_pending) {
+      // Wakes up for stats even when no frames are coming in.
+      frame_ready_.WaitUntil(&frame_ready_seen, last_stats_time + kStatsPeriod);
+    }
+    frames_pending = false;
+    for (size_t camera = 0; camera < connections_->num_cameras(); ++camera) {
+      CamParser &http_parser = connections_->parser(camera);
+      JpegFrame frame;
+      if (http_parser.RetrieveFrame(&frame)) {
+        if (http_parser.IsImageAvailable()) {
+          // Don't wait for the next frame to drain the rest of the queue.
+          frames_pending = true;
+        }
+        if (recorder_) {
+          recorder_->Record(camera, frame);
+        }
+        if (frame_server_) {
+          frame_server_->Offer(camera, frame);
+        }
+        if (full_resolution_[camera]) {
+          decode_pool_->Submit(camera, std::move(frame));
+        } else {
+          // Only used for detection, so there's no point decoding any more
+          // resolution than the network can see.
+          decode_pool_->Submit(camera, std::move(frame),
+                               image_processing_->net_width(),
+                               image_processing_->net_height());
+        }
+      }
+    }
+
+    DecodePool::Result decoded;
+    while (decode_pool_->PopResult(&decoded)) {
+      const size_t camera = decoded.camera;
+      const DecodedJpeg &image = decoded.image;
+      const FrameTrace &trace = decoded.frame.trace;
+      latency_stats_.Record(camera, Stage::kReceive, trace.socket_read,
+                            trace.parsed);
+      latency_stats_.Record(camera, Stage::kDecodeWait, trace.parsed,
+                            trace.decode_start);
+      latency_stats_.Record(camera, Stage::kDecode, trace.decode_start,
+                            trace.decode_end);
+      if (image.data == nullptr) {
+        continue;
+      }
+      // Detection letterboxes each frame to the network's input size, so any
+      // resolution works. Boxes come back in the camera's own pixels, however
+      // far the frame was scaled down while decoding.
+      image_processing_->InputImage(camera, image.data->data(), image.width,
+                                    image.height, trace, image.source_width,
+                                    image.source_height);
+      if (frame_callback_ &&
+          std::count(options_.displayed_cameras.begin(),
+                     options_.displayed_cameras.end(), camera) != 0) {
+        frame_callback_(decoded);
+      }
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_stats_time > kStatsPeriod) {
+      LogStats();
+      last_stats_time = now;
+    }
+  }
+}
+
+void Pipeline::Stop() {
+  stopping_ = true;
+  frame_ready_.Ring();
+}
+
+void Pipeline::CurrentObjects(size_t camera, std::vector<bbox_t> *objects) {
+  objects->clear();
+  // Move tracked objects along to where they should be by now.
+  image_processing_->detections(camera).Extrapolate(
+      std::chrono::steady_clock::now(), objects);
+}
+
+void Pipeline::LogStats() {
+  const auto stats = decode_pool_->TakeWorkerStats();
+  for (size_t i = 0; i < stats.size(); ++i) {
+    std::cout << "Decode worker " << i << ": " << stats[i].frames_decoded
+              << " frames, " << static_cast<int>(stats[i].utilization * 100)
+              << "% busy." << std::endl;
+  }
+  std::cout << "Decode frames dropped: " << decode_pool_->frames_dropped()
+            << std::endl;
+  std::cout << "Detection skip ratio: " << image_processing_->skip_ratio()
+            << ", fast model ratio: " << image_processing_->fast_batch_ratio()
+            << std::endl;
+  if (recorder_) {
+    std::cout << "Frames recorded: " << recorder_->frames_recorded()
+              << ", dropped: " << recorder_->frames_dropped() << std::endl;
+  }
+  std::ofstream latency_file(kLatencyStatsFile);
+  latency_stats_.WriteJson(latency_file);
+}
+
+bool ParsePipelineArgs(int argc, char *argv[], Pipeline::Options *options) {
+  std::string program = argv[0];
+  program = program.substr(program.rfind('/') + 1);
+  // --detector may go anywhere. Everything else is positional.
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i) {
+    if ((std::string(argv[i]) == "--detector") && (i + 1 < argc)) {
+      if (!ParseDetectorBackend(argv[++i], &options->backend)) {
+        return false;
+      }
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+
+  options->cameras.clear();
+  if ((args.size() >= 2) && (args[0] == "--cameras")) {
+    if (!LoadCameraConfigs(args[1], &options->cameras)) {
+      return false;
+    }
+  } else if (args.size() >= 2) {
+    // Field by field, so that everything else keeps its default.
+    CameraConfig camera;
+    camera.address = args[0];
+    camera.port = static_cast<int>(strtol(args[1].c_str(), nullptr, 10));
+    options->cameras.push_back(std::move(camera));
+  }
+  if (options->cameras.empty()) {
+    std::cerr << "Usage: " << program << " server_ip server_port [file_prefix]."
+              << std::endl;
+    std::cerr << "       " << program
+              << " --cameras camera_config_file [file_prefix]." << std::endl;
+    std::cerr << "Either may add --detector darknet|cpu|cpu_int8." << std::endl;
+    return false;
+  }
+  options->file_prefix = (args.size() == 3) ? args[2] : "";
+  return true;
+}
+
+}  // namespace cam
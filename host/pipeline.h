@@ -0,0 +1,118 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "host/camera_config.h"
+#include "host/connection_manager.h"
+#include "host/decode_pool.h"
+#include "host/detector_factory.h"
+#include "host/frame_recorder.h"
+#include "host/frame_server.h"
+#include "host/frame_trace.h"
+#include "host/image_processing.h"
+#include "host/mailbox.h"
+#include "host/scene_events.h"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cam {
+
+// Everything between the cameras and the screen: ingest, recording, decoding,
+// detection, tracking and scene events. Nothing in here touches SDL, so it runs
+// just the same on a host without a display.
+//
+// Run() drives ingest and should get a thread to itself. Detection, and every
+// socket, are serviced on threads of their own, started by Create() and joined
+// on destruction.
+class Pipeline {
+  public:
+    struct Options {
+      std::vector<CameraConfig> cameras;
+      DetectorBackend backend = DefaultDetectorBackend();
+      // If set, every camera is recorded. See FrameRecorder.
+      std::string file_prefix;
+      // Empty disables scene events.
+      std::string scene_event_socket = kSceneEventSocket;
+      // Empty disables serving frames to viewers.
+      std::string frame_socket;
+      // Cameras whose frames are decoded at full resolution and handed to the
+      // frame callback. The rest are only decoded for detection.
+      std::vector<size_t> displayed_cameras;
+    };
+
+    // Called from Run() with every decoded frame from a displayed camera. May
+    // take the decoded image's buffer.
+    using FrameCallback = std::function<void(DecodePool::Result &decoded)>;
+
+    // Returns nullptr (and logs why) if the detector couldn't be loaded, or
+    // there's nowhere to record to.
+    static std::unique_ptr<Pipeline> Create(const Options &options,
+                                            FrameCallback frame_callback);
+    ~Pipeline();
+
+    Pipeline(const Pipeline &rhs) = delete;
+
+    // Blocks until Stop() is called.
+    void Run();
+    void Stop();
+
+    // Replaces |objects| with |camera|'s latest detections, with tracked
+    // objects moved along to where they should be by now. Reuses |objects|'s
+    // memory, so calling it for every frame with the same vector doesn't
+    // allocate. Only one thread may read a camera's objects (see
+    // ImageProcessingModule::detections()).
+    void CurrentObjects(size_t camera, std::vector<bbox_t> *objects);
+
+    LatencyStats &latency_stats() { return latency_stats_; }
+    // Labels for bbox_t::obj_id.
+    const std::vector<std::string> &class_names() const {
+      return class_names_;
+    }
+
+  private:
+    Pipeline(const Options &options, FrameCallback frame_callback);
+    bool Start();
+    void LogStats();
+
+    Options options_;
+    FrameCallback frame_callback_;
+    std::vector<std::string> class_names_;
+    LatencyStats latency_stats_;
+    // Cameras decoded at full resolution, either to be displayed or because
+    // they're detected on in pieces.
+    std::vector<bool> full_resolution_;
+
+    std::unique_ptr<SceneEventServer> scene_events_;
+    std::unique_ptr<FrameServer> frame_server_;
+    std::unique_ptr<ImageProcessingModule> image_processing_;
+    std::unique_ptr<FrameRecorder> recorder_;
+    std::unique_ptr<ConnectionManager> connections_;
+    std::unique_ptr<DecodePool> decode_pool_;
+    std::thread scene_event_thread_;
+    std::thread frame_server_thread_;
+    std::thread image_processing_thread_;
+    std::thread connection_thread_;
+
+    // Rung by the connections and the decode pool when there's work, and by
+    // Stop().
+    Doorbell frame_ready_;
+    std::atomic<bool> stopping_{false};
+};
+
+// Parses the arguments host_client and host_headless share:
+//
+//   server_ip server_port [file_prefix]
+//   --cameras camera_config_file [file_prefix]
+//
+// either of which may add --detector darknet|cpu|cpu_int8 anywhere. Returns
+// false, after printing usage, if they don't make sense.
+bool ParsePipelineArgs(int argc, char *argv[], Pipeline::Options *options);
+
+}  // namespace cam
+
+#endif // PIPELINE_H
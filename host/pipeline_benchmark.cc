@@ -0,0 +1,587 @@
+// Replays an MJPEG-over-chunked-HTTP stream through the host pipeline (parser,
+// JPEG decoder and, given a network, the detector) as fast as possible, and
+// reports throughput for each stage. Needs no cameras or network, so it can run
+// on CI machines.
+//
+// Usage: pipeline_benchmark [--capture file | --segment file | --jpeg file]
+//                           [--frames n] [--size WIDTHxHEIGHT]
+//                           [--config yolov4.cfg --weights yolov4.weights]
+//                           [--detect_seconds s]
+//                           [--detector darknet|cpu|cpu_int8]
+//
+// A capture is the raw HTTP response a camera sends, e.g. from
+//   curl --raw -s -i --max-time 10 http://camera/stream > capture.bin
+// Otherwise a synthetic stream is built from the frames of a recorded segment,
+// or from --frames copies of --jpeg (or of a generated test image, 800x600
+// unless --size says otherwise, e.g. 320x240 for QVGA or 1600x1200 for UXGA).
+//
+// The parser is fed the stream with several read patterns, including reads
+// split on every CR and LF, and every pattern must parse out the same frames.
+//
+// Every heap allocation is counted, per thread. Once the detector has warmed
+// up, posting frames and reading back detections must not allocate at all, and
+// neither must the inference loop, apart from inside the detector backend.
+// The inference loop runs with tracking and scene events on, but with one
+// full-frame crop per camera and no fast model.
+
+#include "host/cam_parser.h"
+#include "host/detector_factory.h"
+#include "host/frame_trace.h"
+#include "host/image_processing.h"
+#include "host/jpeg_decoder.h"
+#include "host/mjpeg_stream.h"
+#include "host/scene_events.h"
+#include "host/segment_file.h"
+#include "libjpeg_turbo/turbojpeg.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Heap allocations made by the current thread, apart from those made by the
+// detector backend (see ImageProcessingModule::Options::backend_hook), which
+// are counted separately.
+thread_local uint64_t t_allocations = 0;
+thread_local uint64_t t_backend_allocations = 0;
+thread_local bool t_in_backend = false;
+
+void *CountedAlloc(size_t size, size_t alignment) {
+  (t_in_backend ? t_backend_allocations : t_allocations)++;
+  // aligned_alloc() wants a multiple of the alignment.
+  void *memory = (alignment == 0)
+                     ? std::malloc(size == 0 ? 1 : size)
+                     : std::aligned_alloc(alignment,
+                                          (size + alignment - 1) / alignment *
+                                              alignment);
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+}  // namespace
+
+// Every other form of new and delete goes through these.
+void *operator new(size_t size) { return CountedAlloc(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) {
+  return CountedAlloc(size, static_cast<size_t>(alignment));
+}
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+  std::free(memory);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The ESP32 camera's default SVGA.
+constexpr int kTestImageWidth = 800;
+constexpr int kTestImageHeight = 600;
+// Stand-in network input size for DecodeToFit() when no network is given.
+constexpr int kDefaultFitSize = 416;
+
+struct Args {
+  std::string capture;
+  std::string segment;
+  std::string jpeg;
+  int frames = 300;
+  int width = kTestImageWidth;
+  int height = kTestImageHeight;
+  std::string config;
+  std::string weights;
+  int detect_seconds = 10;
+  cam::DetectorBackend detector = cam::DefaultDetectorBackend();
+};
+
+bool ParseArgs(int argc, char *argv[], Args *args) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string flag = argv[i];
+    const char *value = argv[i + 1];
+    if (flag == "--capture") {
+      args->capture = value;
+    } else if (flag == "--segment") {
+      args->segment = value;
+    } else if (flag == "--jpeg") {
+      args->jpeg = value;
+    } else if (flag == "--frames") {
+      args->frames = atoi(value);
+    } else if (flag == "--size") {
+      if ((sscanf(value, "%dx%d", &args->width, &args->height) != 2) ||
+          (args->width <= 0) || (args->height <= 0)) {
+        return false;
+      }
+    } else if (flag == "--config") {
+      args->config = value;
+    } else if (flag == "--weights") {
+      args->weights = value;
+    } else if (flag == "--detect_seconds") {
+      args->detect_seconds = atoi(value);
+    } else if (flag == "--detector") {
+      if (!cam::ParseDetectorBackend(value, &args->detector)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return (argc % 2) == 1;
+}
+
+bool ReadFile(const std::string &path, std::string *contents) {
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  if (!file.good()) {
+    std::cerr << "Could not open " << path << std::endl;
+    return false;
+  }
+  contents->assign(std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>());
+  return true;
+}
+
+// Gradients with some noise on top, so that it compresses about as well as a
+// real scene does.
+std::string MakeTestJpeg(int width, int height) {
+  std::mt19937 rng(0);
+  std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      uint8_t *pixel = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+      pixel[0] = (x * 255 / width) ^ (rng() & 0xf);
+      pixel[1] = (y * 255 / height) ^ (rng() & 0xf);
+      pixel[2] = ((x + y) & 0xff) ^ (rng() & 0xf);
+    }
+  }
+  tjhandle compressor = tjInitCompress();
+  unsigned char *jpeg = nullptr;
+  unsigned long jpeg_size = 0;
+  // The ESP32 camera's own JPEG encoder uses 4:2:2.
+  const int result = tjCompress2(compressor, rgb.data(), width, 0,
+                                 height, TJPF_RGB, &jpeg, &jpeg_size,
+                                 TJSAMP_422, /*jpegQual=*/80, 0);
+  std::string jpeg_string;
+  if (result == 0) {
+    jpeg_string.assign(reinterpret_cast<const char *>(jpeg), jpeg_size);
+  } else {
+    std::cerr << "Could not encode test JPEG: " << tjGetErrorStr2(compressor)
+              << std::endl;
+  }
+  tjFree(jpeg);
+  tjDestroy(compressor);
+  return jpeg_string;
+}
+
+// Lengths of the reads to split |stream| into.
+using ReadPattern = std::vector<size_t>;
+
+ReadPattern FixedReads(const std::string &stream, size_t read_size) {
+  ReadPattern reads(stream.size() / read_size, read_size);
+  if (stream.size() % read_size != 0) {
+    reads.push_back(stream.size() % read_size);
+  }
+  return reads;
+}
+
+ReadPattern RandomReads(const std::string &stream, size_t max_read_size) {
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<size_t> read_size(1, max_read_size);
+  ReadPattern reads;
+  for (size_t offset = 0; offset < stream.size();) {
+    reads.push_back(std::min(read_size(rng), stream.size() - offset));
+    offset += reads.back();
+  }
+  return reads;
+}
+
+// Splits right before and right after every CR and LF, so that every line and
+// chunk size is torn apart at its worst possible place.
+ReadPattern LineBoundaryReads(const std::string &stream) {
+  ReadPattern reads;
+  size_t last_split = 0;
+  for (size_t i = 0; i < stream.size(); ++i) {
+    if ((stream[i] != '\r') && (stream[i] != '\n')) {
+      continue;
+    }
+    if (i > last_split) {
+      reads.push_back(i - last_split);
+    }
+    reads.push_back(1);
+    last_split = i + 1;
+  }
+  if (last_split < stream.size()) {
+    reads.push_back(stream.size() - last_split);
+  }
+  return reads;
+}
+
+// Feeds |stream| to a fresh parser in |reads| and returns the frames parsed.
+std::vector<cam::JpegFrame> RunParser(const std::string &stream,
+                                      const ReadPattern &reads,
+                                      double *seconds) {
+  cam::CamParser::Options options;
+  // Frames are pulled out after every read, so this only matters if a single
+  // read holds lots of them. None may be dropped.
+  options.max_images = 1024;
+  cam::CamParser parser(options);
+  std::vector<cam::JpegFrame> frames;
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(stream.data());
+  const auto start = Clock::now();
+  for (size_t len : reads) {
+    parser.Feed(data, len);
+    data += len;
+    cam::JpegFrame frame;
+    while (parser.RetrieveFrame(&frame)) {
+      frames.push_back(std::move(frame));
+    }
+  }
+  *seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return frames;
+}
+
+bool SameFrames(const std::vector<cam::JpegFrame> &a,
+                const std::vector<cam::JpegFrame> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if ((a[i].size() != b[i].size()) ||
+        (std::memcmp(a[i].bytes(), b[i].bytes(), a[i].size()) != 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Report(const std::string &stage, size_t frames, size_t bytes,
+            double seconds) {
+  std::cout << stage << ": " << frames << " frames in " << seconds << "s, "
+            << frames / seconds << " frames/s, "
+            << bytes / seconds / (1024 * 1024) << " MB/s" << std::endl;
+}
+
+// Decodes every frame, at full resolution or scaled to fit. Returns false if
+// any frame fails to decode.
+bool RunDecoder(const std::vector<cam::JpegFrame> &frames, int fit_width,
+                int fit_height, std::vector<cam::DecodedJpeg> *decoded) {
+  cam::JpegDecoder decoder(cam::JpegDecoder::Options{});
+  size_t jpeg_bytes = 0;
+  size_t failures = 0;
+  const auto start = Clock::now();
+  for (const auto &frame : frames) {
+    cam::DecodedJpeg image =
+        decoder.DecodeToFit(frame.bytes(), frame.size(), fit_width, fit_height);
+    jpeg_bytes += frame.size();
+    if (image.data == nullptr) {
+      failures++;
+      continue;
+    }
+    if (decoded != nullptr) {
+      decoded->push_back(std::move(image));
+    }
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  const std::string stage =
+      (fit_width == 0) ? "decode (full)"
+                       : "decode (fit " + std::to_string(fit_width) + "x" +
+                             std::to_string(fit_height) + ")";
+  Report(stage, frames.size(), jpeg_bytes, seconds);
+  if (failures > 0) {
+    std::cerr << failures << " frames failed to decode." << std::endl;
+  }
+  return failures == 0;
+}
+
+// Keeps every stream of the detector fed with decoded frames for
+// --detect_seconds, reading back each stream's objects the way the pipeline
+// does, and reports how many made it through the network. Returns false if
+// that allocated once warmed up.
+// Publishes an object whose class name has a space in it, and checks that its
+// scene event parses back to the same object.
+bool CheckSceneEventFormat() {
+  char path[] = "/tmp/pipeline_benchmark_scene_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd == -1) {
+    std::cerr << "Could not create a scene event file." << std::endl;
+    return false;
+  }
+  close(fd);
+  cam::SceneEventServer::Options options;
+  options.file_path = path;
+  options.class_names = {"person", "traffic light"};
+  auto server = cam::SceneEventServer::Create(options);
+  if (!server) {
+    unlink(path);
+    return false;
+  }
+  bbox_t light{};
+  light.x = 10;
+  light.y = 20;
+  light.w = 30;
+  light.h = 40;
+  light.prob = 0.75f;
+  light.obj_id = 1;
+  light.track_id = 7;
+  std::thread server_thread([&server]() { server->Run(); });
+  server->Publish(0, std::chrono::system_clock::now(), {light},
+                  {light.track_id});
+  server->Stop();
+  server_thread.join();
+  std::string lines;
+  const bool read = ReadFile(path, &lines);
+  unlink(path);
+
+  cam::SceneEvent event;
+  const bool parsed =
+      read && cam::ParseSceneEvent(lines.substr(0, lines.find('\n')),
+                                   options.class_names, &event);
+  const bbox_t &box = event.box;
+  if (!parsed || (event.kind != '+') || (box.obj_id != light.obj_id) ||
+      (box.track_id != light.track_id) || (box.x != light.x) ||
+      (box.y != light.y) || (box.w != light.w) || (box.h != light.h)) {
+    std::cerr << "Scene event didn't parse back: " << lines << std::endl;
+    return false;
+  }
+  std::cout << "scene events: " << lines;
+  return true;
+}
+
+bool RunDetector(const Args &args, const std::vector<cam::JpegFrame> &frames) {
+  constexpr size_t kStreams = 4;
+  cam::LatencyStats latency_stats(kStreams);
+  ImageProcessingModule::Options options;
+  options.max_batch_size = kStreams;
+  options.latency_stats = &latency_stats;
+  // The same few frames go round and round, which would all look static.
+  options.motion_gate.enabled = false;
+  options.backend = args.detector;
+  // Scene events are published from the inference loop, so they're on too,
+  // written out to a file that's thrown away.
+  char scene_path[] = "/tmp/pipeline_benchmark_scene_XXXXXX";
+  const int scene_fd = mkstemp(scene_path);
+  if (scene_fd == -1) {
+    std::cerr << "Could not create a scene event file." << std::endl;
+    return false;
+  }
+  close(scene_fd);
+  cam::SceneEventServer::Options scene_options;
+  scene_options.file_path = scene_path;
+  scene_options.num_cameras = kStreams;
+  auto scene_events = cam::SceneEventServer::Create(scene_options);
+  unlink(scene_path);
+  if (!scene_events) {
+    return false;
+  }
+  options.scene_events = scene_events.get();
+  // When warm up is over. Set before the inference thread starts.
+  Clock::time_point steady = Clock::time_point::max();
+  // The inference thread's counts as of its first batch after warm up, and
+  // how many batches it ran from then on.
+  uint64_t steady_allocations_start = 0;
+  uint64_t steady_backend_allocations_start = 0;
+  size_t steady_batches = 0;
+  options.backend_hook = [&](bool in_backend) {
+    if (in_backend && (Clock::now() >= steady)) {
+      if (steady_batches == 0) {
+        steady_allocations_start = t_allocations;
+        steady_backend_allocations_start = t_backend_allocations;
+      }
+      steady_batches++;
+    }
+    t_in_backend = in_backend;
+  };
+  ImageProcessingModule detector(args.config, args.weights, kStreams, options);
+  if (!detector.ok()) {
+    return false;
+  }
+
+  std::vector<cam::DecodedJpeg> decoded;
+  if (!RunDecoder(frames, detector.net_width(), detector.net_height(),
+                  &decoded) &&
+      decoded.empty()) {
+    return false;
+  }
+
+  const auto start = Clock::now();
+  const auto end = start + std::chrono::seconds(args.detect_seconds);
+  // The first quarter of the run is warm up, for every buffer to grow to
+  // the biggest frame and busiest scene.
+  steady = start + (end - start) / 4;
+  uint64_t inference_allocations = 0;
+  uint64_t backend_allocations = 0;
+  std::thread scene_thread([&scene_events]() { scene_events->Run(); });
+  std::thread detector_thread([&]() {
+    detector();
+    inference_allocations = t_allocations - steady_allocations_start;
+    backend_allocations =
+        t_backend_allocations - steady_backend_allocations_start;
+  });
+  std::vector<bbox_t> objects;
+  uint64_t versions_seen = 0;
+  uint64_t last_version[kStreams] = {};
+  size_t steady_frames = 0;
+  uint64_t steady_allocations = 0;
+  for (size_t i = 0; Clock::now() < end; ++i) {
+    const uint64_t allocations = t_allocations;
+    const size_t stream = i % kStreams;
+    const cam::DecodedJpeg &image = decoded[i % decoded.size()];
+    cam::FrameTrace trace;
+    trace.decode_end = Clock::now();
+    detector.InputImage(stream, image.data->data(), image.width,
+                        image.height, trace);
+    const auto &detections = detector.detections(stream);
+    if (detections.version != last_version[stream]) {
+      last_version[stream] = detections.version;
+      versions_seen++;
+    }
+    objects.clear();
+    detections.Extrapolate(Clock::now(), &objects);
+    if (trace.decode_end >= steady) {
+      steady_frames++;
+      steady_allocations += t_allocations - allocations;
+    }
+    if (stream == kStreams - 1) {
+      // Frames are latest-wins, so there's no point posting much faster than
+      // the network can run.
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  detector.Exit();
+  detector_thread.join();
+  scene_events->Stop();
+  scene_thread.join();
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  size_t inferences = 0;
+  for (const auto &summary : latency_stats.Summarize()) {
+    if (summary.stage == cam::Stage::kInference) {
+      inferences += summary.count;
+      std::cout << "inference latency (stream " << summary.camera
+                << "): p50 " << summary.p50.count() / 1000.0 << "ms, p99 "
+                << summary.p99.count() / 1000.0 << "ms" << std::endl;
+    }
+  }
+  const size_t pixels =
+      inferences * detector.net_width() * detector.net_height();
+  std::cout << "detect: " << inferences << " frames in " << seconds << "s, "
+            << inferences / seconds << " frames/s, " << pixels / seconds / 1e6
+            << " Mpixel/s" << std::endl;
+  std::cout << "detect: " << versions_seen << " snapshots read" << std::endl;
+  std::cout << "inference loop: " << inference_allocations
+            << " allocations in " << steady_batches
+            << " batches after warm up, plus " << backend_allocations
+            << " in the " << cam::DetectorBackendName(args.detector)
+            << " backend" << std::endl;
+  std::cout << "post and read: " << steady_allocations << " allocations in "
+            << steady_frames << " frames after warm up" << std::endl;
+  bool ok = true;
+  if (inference_allocations > 0) {
+    std::cerr << "The inference loop allocated outside the backend."
+              << std::endl;
+    ok = false;
+  }
+  if (steady_allocations > 0) {
+    std::cerr << "Posting frames and reading detections allocated."
+              << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Args args;
+  if (!ParseArgs(argc, argv, &args)) {
+    std::cerr << "Usage: pipeline_benchmark [--capture file | --segment file "
+                 "| --jpeg file] [--frames n] [--size WIDTHxHEIGHT] "
+                 "[--config cfg --weights weights] "
+                 "[--detect_seconds s] [--detector darknet|cpu|cpu_int8]"
+              << std::endl;
+    return -1;
+  }
+
+  std::string stream;
+  if (!args.capture.empty()) {
+    if (!ReadFile(args.capture, &stream)) {
+      return -1;
+    }
+  } else if (!args.segment.empty()) {
+    auto segment = cam::SegmentReader::Open(args.segment);
+    if (!segment) {
+      return -1;
+    }
+    stream = cam::StreamHeader();
+    for (size_t i = 0; i < segment->num_frames(); ++i) {
+      const cam::ByteSpan jpeg = segment->jpeg(i);
+      stream += cam::FrameChunks(
+          std::string(reinterpret_cast<const char *>(jpeg.data), jpeg.size),
+          segment->entry(i).capture_timestamp_us / 1e6);
+    }
+  } else {
+    std::string jpeg;
+    if (args.jpeg.empty()) {
+      jpeg = MakeTestJpeg(args.width, args.height);
+    } else if (!ReadFile(args.jpeg, &jpeg)) {
+      return -1;
+    }
+    stream = cam::StreamHeader();
+    for (int i = 0; i < args.frames; ++i) {
+      stream += cam::FrameChunks(jpeg, i / 30.0);
+    }
+  }
+
+  const std::vector<std::pair<std::string, ReadPattern>> patterns = {
+      {"parse (16KB reads)", FixedReads(stream, 16 * 1024)},
+      {"parse (random reads)", RandomReads(stream, 64 * 1024)},
+      {"parse (tiny reads)", RandomReads(stream, 16)},
+      {"parse (CR/LF splits)", LineBoundaryReads(stream)},
+  };
+  bool ok = true;
+  std::vector<cam::JpegFrame> frames;
+  for (const auto &[name, reads] : patterns) {
+    double seconds = 0;
+    auto parsed = RunParser(stream, reads, &seconds);
+    Report(name, parsed.size(), stream.size(), seconds);
+    if (frames.empty()) {
+      frames = std::move(parsed);
+    } else if (!SameFrames(frames, parsed)) {
+      std::cerr << name << " parsed different frames than "
+                << patterns.front().first << "." << std::endl;
+      ok = false;
+    }
+  }
+  if (frames.empty()) {
+    std::cerr << "No frames parsed." << std::endl;
+    return 1;
+  }
+
+  ok &= RunDecoder(frames, 0, 0, nullptr);
+  ok &= RunDecoder(frames, kDefaultFitSize, kDefaultFitSize, nullptr);
+  ok &= CheckSceneEventFormat();
+
+  if (!args.config.empty() && !args.weights.empty()) {
+    ok &= RunDetector(args, frames);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#include "host/region.h"
+
+#include <algorithm>
+
+namespace cam {
+
+std::vector<Region> TileRegion(const Region &region, int tiles_x, int tiles_y,
+                               float overlap) {
+  tiles_x = std::max(1, tiles_x);
+  tiles_y = std::max(1, tiles_y);
+  // n tiles of size s overlapping by overlap * s span
+  // s * (n - (n - 1) * overlap).
+  const float tile_width = region.width / (tiles_x - (tiles_x - 1) * overlap);
+  const float tile_height = region.height / (tiles_y - (tiles_y - 1) * overlap);
+  std::vector<Region> tiles;
+  for (int ty = 0; ty < tiles_y; ++ty) {
+    for (int tx = 0; tx < tiles_x; ++tx) {
+      tiles.push_back({.x = region.x + tx * tile_width * (1 - overlap),
+                       .y = region.y + ty * tile_height * (1 - overlap),
+                       .width = tile_width,
+                       .height = tile_height});
+    }
+  }
+  return tiles;
+}
+
+}  // namespace cam
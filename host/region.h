@@ -0,0 +1,26 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <vector>
+
+namespace cam {
+
+// Part of a frame, in fractions of its width and height, so that it doesn't
+// depend on the resolution the frame was decoded at.
+struct Region {
+  float x = 0;
+  float y = 0;
+  float width = 1;
+  float height = 1;
+};
+
+// Splits |region| into a |tiles_x| by |tiles_y| grid. Neighboring tiles
+// overlap by |overlap| of a tile's size, so that an object straddling a seam is
+// still wholly inside at least one tile as long as it's no bigger than the
+// overlap.
+std::vector<Region> TileRegion(const Region &region, int tiles_x, int tiles_y,
+                               float overlap);
+
+}  // namespace cam
+
+#endif // REGION_H
@@ -0,0 +1,336 @@
+#include "host/render_thread.h"
+
+#include "host/object_names.h"
+#include "SDL_ttf.h"
+#include "imgui_sdl/imgui_sdl.h"
+#include "dear_imgui/imgui.h"
+#include "dear_imgui/examples/imgui_impl_sdl.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+namespace cam {
+namespace {
+
+// Labels are rendered big and scaled down, which looks smoother.
+constexpr char kFontFile[] = "/usr/share/fonts/truetype/ubuntu/Ubuntu-R.ttf";
+constexpr int kFontSize = 50;
+
+}  // namespace
+
+RenderThread::RenderThread(int width, int height, size_t num_cameras,
+                           LatencyStats *latency_stats,
+                           std::vector<std::string> class_names,
+                           double max_framerate)
+    : canvas_(width, height), width_(width), height_(height),
+      num_cameras_(num_cameras), views_(new CameraView[num_cameras]),
+      class_names_(std::move(class_names)), latency_stats_(latency_stats) {
+  if (max_framerate > 0) {
+    min_render_period_ =
+        std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+            std::chrono::duration<double>(1 / max_framerate));
+  }
+
+  IMGUI_CHECKVERSION();
+  ImGui::CreateContext();
+  ImGuiSDL::Initialize(canvas_.renderer(), width_, height_);
+  ImGui_ImplSDL2_InitForOpenGL(canvas_.window(), nullptr);
+  ImGui::StyleColorsDark();
+  for (size_t camera = 0; camera < num_cameras_; ++camera) {
+    views_[camera].previous_video_time =
+        std::chrono::high_resolution_clock::now();
+  }
+  previous_render_time_ = std::chrono::high_resolution_clock::now();
+}
+
+void RenderThread::operator()() {
+  TTF_Init();
+  font_ = TTF_OpenFont(kFontFile, kFontSize);
+  if (font_ == nullptr) {
+    std::cerr << "Error loading font file, labels won't be drawn: "
+              << TTF_GetError() << std::endl;
+  }
+  labels_.assign(class_names_.size() + 1, Label());
+  uint64_t wake_seen = 0;
+  while (!done_) {
+    // Sleeps until there's a new frame or new boxes. SDL can't wake the loop up
+    // for input, so that's polled.
+    const uint64_t previous_wake = wake_seen;
+    wake_.WaitUntil(&wake_seen,
+                    std::chrono::steady_clock::now() + kInputPollPeriod);
+    if (done_) {
+      break;
+    }
+    if ((wake_seen != previous_wake) && (min_render_period_.count() != 0)) {
+      // Anything that arrives in the meantime is picked up below.
+      std::this_thread::sleep_until(previous_render_time_ + min_render_period_);
+    }
+    // Pick up whatever the main loop has handed over since last time.
+    bool changed = false;
+    size_t num_shown = 0;
+    for (size_t camera = 0; camera < num_cameras_; ++camera) {
+      CameraView &view = views_[camera];
+      if (view.bg_images.Update()) {
+        UploadBGImage(view, view.bg_images.front());
+        changed = true;
+      }
+      changed = view.targets.Update() || changed;
+      if (view.texture != nullptr) {
+        num_shown++;
+      }
+    }
+    // UI handling.
+    ImGuiIO& io = ImGui::GetIO();
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+      changed = true;
+      ImGui_ImplSDL2_ProcessEvent(&event);
+      if (event.type == SDL_QUIT) done_ = true;
+      if (event.type == SDL_WINDOWEVENT) {
+        if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+          io.DisplaySize.x = static_cast<float>(event.window.data1);
+          io.DisplaySize.y = static_cast<float>(event.window.data2);
+        }
+      }
+    }
+    // Otherwise there's nothing new to show, other than fresh latency stats.
+    if (!changed && (std::chrono::high_resolution_clock::now() -
+                         previous_latency_time_ <=
+                     kLatencyRefreshPeriod)) {
+      continue;
+    }
+    // Clear the canvas before re-rendering.
+    canvas_.Clear();
+    if (num_shown != 0) {
+      // Every camera with a frame gets a cell of a grid which is as close to
+      // square as it can be.
+      int output_width = width_, output_height = height_;
+      SDL_GetRendererOutputSize(canvas_.renderer(), &output_width,
+                                &output_height);
+      int columns = 1;
+      while (columns * columns < static_cast<int>(num_shown)) {
+        columns++;
+      }
+      const int rows = (num_shown + columns - 1) / columns;
+      int cell_index = 0;
+      for (size_t camera = 0; camera < num_cameras_; ++camera) {
+        if (views_[camera].texture == nullptr) {
+          continue;
+        }
+        const int column = cell_index % columns;
+        const int row = cell_index / columns;
+        const SDL_Rect cell{column * output_width / columns,
+                            row * output_height / rows,
+                            output_width / columns, output_height / rows};
+        DrawCamera(camera, cell);
+        cell_index++;
+      }
+      SDL_RenderPresent(canvas_.renderer());
+      for (size_t camera = 0; camera < num_cameras_; ++camera) {
+        CameraView &view = views_[camera];
+        if (view.changed) {
+          RecordPresented(camera, view.bg_images.front());
+          view.changed = false;
+        }
+      }
+    }
+    auto render_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> render_dt = render_time - previous_render_time_;
+    double render_framerate = (render_dt.count() != 0) ? 1 / (render_dt.count()) : 0;
+    previous_render_time_ = render_time;
+
+    ImGui_ImplSDL2_NewFrame(canvas_.window());
+    // Frames are rendered on demand, so the time between them varies. ImGui
+    // insists on it being positive.
+    io.DeltaTime = std::max(static_cast<float>(render_dt.count()), 1e-4f);
+    ImGui::NewFrame();
+    // ImGui UI defined here.
+    ImGui::Begin("Info");
+
+    ImGui::Text("Render Loop Framerate %f", render_framerate);
+    for (size_t camera = 0; camera < num_cameras_; ++camera) {
+      CameraView &view = views_[camera];
+      if (view.texture == nullptr) {
+        continue;
+      }
+      const std::vector<bbox_t> &targets = view.targets.front();
+      ImGui::Text("Camera %zu: %dx%d, Video Framerate %f", camera, view.width,
+                  view.height, view.video_framerate);
+      ImGui::Text("Objects detected: %lu", targets.size());
+      // Render target squares.
+      for (size_t i = 0; i < targets.size(); ++i) {
+        ImGui::Text("%s at (%i, %i).", ObjectName(class_names_, targets[i].obj_id).c_str(),
+                    targets[i].x,
+                    targets[i].y);
+      }
+    }
+    ImGui::End();
+
+    ImGui::Begin("Latency");
+    if (render_time - previous_latency_time_ > kLatencyRefreshPeriod) {
+      latency_summary_ = latency_stats_->Summarize();
+      previous_latency_time_ = render_time;
+    }
+    for (const auto &summary : latency_summary_) {
+      ImGui::Text("Camera %zu %-15s p50 %7.1fms p99 %7.1fms (%zu)",
+                  summary.camera, StageName(summary.stage),
+                  summary.p50.count() / 1000.0,
+                  summary.p99.count() / 1000.0, summary.count);
+    }
+    ImGui::End();
+    // End of ImGui UI definition.
+
+    ImGui::Render();
+    ImGuiSDL::Render(ImGui::GetDrawData());
+    canvas_.Render();
+  }
+  ReleaseTextures();
+}
+
+void RenderThread::SetBGImage(size_t camera, BufferPool::Buffer image,
+                              int width, int height, const FrameTrace &trace) {
+  BGImage &bg_image = views_[camera].bg_images.back();
+  // Whatever buffer the slot held goes back to its pool.
+  bg_image.data = std::move(image);
+  bg_image.width = width;
+  bg_image.height = height;
+  bg_image.received = std::chrono::high_resolution_clock::now();
+  bg_image.trace = trace;
+  views_[camera].bg_images.Publish();
+  wake_.Ring();
+}
+
+void RenderThread::SetObjectsDetected(size_t camera,
+                                      const std::vector<bbox_t> &objects) {
+  views_[camera].targets.back() = objects;
+  views_[camera].targets.Publish();
+  wake_.Ring();
+}
+
+void RenderThread::Exit() {
+  done_ = true;
+  wake_.Ring();
+}
+
+void RenderThread::Shutdown() {
+  ImGuiSDL::Deinitialize();
+  ImGui::DestroyContext();
+  ImGui_ImplSDL2_Shutdown();
+}
+
+const RenderThread::Label &RenderThread::LabelFor(unsigned int obj_id) {
+  Label &label = labels_[std::min<size_t>(obj_id, class_names_.size())];
+  if ((label.texture != nullptr) || (font_ == nullptr)) {
+    return label;
+  }
+  SDL_Surface *surface = TTF_RenderText_Blended(
+      font_, ObjectName(class_names_, obj_id).c_str(), {255, 255, 255});
+  if (surface == nullptr) {
+    return label;
+  }
+  label.texture = SDL_CreateTextureFromSurface(canvas_.renderer(), surface);
+  label.width = surface->w;
+  label.height = surface->h;
+  SDL_FreeSurface(surface);
+  return label;
+}
+
+void RenderThread::DrawCamera(size_t camera, const SDL_Rect &cell) {
+  CameraView &view = views_[camera];
+  // Letterboxed, so that frames keep their aspect ratio.
+  const float scale = std::min(static_cast<float>(cell.w) / view.width,
+                               static_cast<float>(cell.h) / view.height);
+  const int frame_width = view.width * scale;
+  const int frame_height = view.height * scale;
+  const SDL_Rect frame_rect{cell.x + (cell.w - frame_width) / 2,
+                            cell.y + (cell.h - frame_height) / 2, frame_width,
+                            frame_height};
+  SDL_RenderCopy(canvas_.renderer(), view.texture, NULL, &frame_rect);
+  // Render object boxes.
+  SDL_SetRenderDrawColor(canvas_.renderer(), 255, 255, 255, 255);
+  for (const bbox_t &t : view.targets.front()) {
+    const SDL_Rect box{frame_rect.x + static_cast<int>(t.x * scale),
+                       frame_rect.y + static_cast<int>(t.y * scale),
+                       static_cast<int>(t.w * scale),
+                       static_cast<int>(t.h * scale)};
+    SDL_RenderDrawRect(canvas_.renderer(), &box);
+    DrawLabel(t, box);
+  }
+}
+
+void RenderThread::DrawLabel(const bbox_t &target, const SDL_Rect &box) {
+  const Label &label = LabelFor(target.obj_id);
+  if ((label.texture == nullptr) || (label.height == 0)) {
+    return;
+  }
+  // Keeps the text's aspect ratio.
+  const SDL_Rect rect{box.x, box.y, label.width * kLabelHeight / label.height,
+                      kLabelHeight};
+  SDL_RenderCopy(canvas_.renderer(), label.texture, NULL, &rect);
+}
+
+void RenderThread::ReleaseTextures() {
+  for (Label &label : labels_) {
+    if (label.texture != nullptr) {
+      SDL_DestroyTexture(label.texture);
+    }
+  }
+  labels_.clear();
+  for (size_t camera = 0; camera < num_cameras_; ++camera) {
+    if (views_[camera].texture != nullptr) {
+      SDL_DestroyTexture(views_[camera].texture);
+      views_[camera].texture = nullptr;
+    }
+  }
+  if (font_ != nullptr) {
+    TTF_CloseFont(font_);
+    font_ = nullptr;
+  }
+}
+
+void RenderThread::RecordPresented(size_t camera, const BGImage &bg_image) {
+  const FrameTrace::Clock::time_point presented = FrameTrace::Clock::now();
+  latency_stats_->Record(camera, Stage::kRender, bg_image.trace.decode_end,
+                         presented);
+  latency_stats_->Record(camera, Stage::kDisplayTotal,
+                         bg_image.trace.socket_read, presented);
+}
+
+void RenderThread::UploadBGImage(CameraView &view, const BGImage &bg_image) {
+  if ((bg_image.data == nullptr) ||
+      (bg_image.data->size() <
+       static_cast<size_t>(bg_image.width) * bg_image.height * 3)) {
+    return;
+  }
+  if ((view.texture == nullptr) || (view.width != bg_image.width) ||
+      (view.height != bg_image.height)) {
+    if (view.texture != nullptr) {
+      SDL_DestroyTexture(view.texture);
+    }
+    view.texture = SDL_CreateTexture(canvas_.renderer(), SDL_PIXELFORMAT_RGB24,
+                                     SDL_TEXTUREACCESS_STREAMING,
+                                     bg_image.width, bg_image.height);
+    if (view.texture == nullptr) {
+      std::cerr << "Could not create a " << bg_image.width << "x"
+                << bg_image.height << " texture: " << SDL_GetError()
+                << std::endl;
+      return;
+    }
+    view.width = bg_image.width;
+    view.height = bg_image.height;
+  }
+  SDL_UpdateTexture(view.texture, NULL, bg_image.data->data(),
+                    3 * bg_image.width);
+  view.changed = true;
+
+  // Measure how frequently we're receiving BG images to calculate framerate.
+  std::chrono::duration<double> video_dt = bg_image.received - view.previous_video_time;
+  if (video_dt.count() != 0) {
+    view.video_framerate = 1 / (video_dt.count());
+  }
+  view.previous_video_time = bg_image.received;
+}
+
+}  // namespace cam
@@ -0,0 +1,133 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include "host/buffer_pool.h"
+#include "host/frame_trace.h"
+#include "host/mailbox.h"
+#include "host/object_detector.h"
+#include "linux_sdl/include/SDL.h"
+#include "SDL_ttf.h"
+#include "graphics/sdl_canvas.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cam {
+
+// Shows every camera that has sent it a frame, in a grid, with each camera's
+// detections drawn on top, plus an ImGui overlay with frame rates and latency
+// stats. Frames and detections are handed over through mailboxes, so whoever
+// feeds them never blocks on rendering.
+//
+// operator()() runs the render loop and should get a thread to itself. It only
+// renders when there's something new to show (a frame, boxes or input), so an
+// idle window costs next to nothing.
+class RenderThread {
+  public:
+    // |class_names| label the boxes, by obj_id. With |max_framerate| > 0,
+    // renders at most that many times a second.
+    RenderThread(int width, int height, size_t num_cameras,
+                 LatencyStats *latency_stats,
+                 std::vector<std::string> class_names,
+                 double max_framerate = 0);
+
+    void operator()();
+
+    // Hands a 24-bit RGB frame from |camera| to the render thread, which keeps
+    // |image| until it's replaced. Frames may be any size. Never blocks on
+    // rendering. If the render thread hasn't picked up the previous frame yet,
+    // it's replaced. Only one thread may hand over frames for a camera.
+    void SetBGImage(size_t camera, BufferPool::Buffer image, int width,
+                    int height, const FrameTrace &trace);
+
+    // Replaces |camera|'s boxes, which are in the pixels of its frames. They're
+    // copied into a mailbox slot which keeps its memory, so this doesn't
+    // allocate once a camera has shown its busiest scene.
+    void SetObjectsDetected(size_t camera, const std::vector<bbox_t> &objects);
+
+    // Tears down ImGui. Call once the render loop has returned.
+    void Shutdown();
+
+    bool done() const { return done_; }
+
+    void Exit();
+
+  private:
+    struct BGImage {
+      BufferPool::Buffer data;
+      int width = 0;
+      int height = 0;
+      std::chrono::high_resolution_clock::time_point received;
+      FrameTrace trace;
+    };
+
+    // A class name rendered to a texture, at its natural size.
+    struct Label {
+      SDL_Texture *texture = nullptr;
+      int width = 0;
+      int height = 0;
+    };
+
+    struct CameraView {
+      Mailbox<BGImage> bg_images;
+      Mailbox<std::vector<bbox_t>> targets;
+      // Streamed into from each frame, and only recreated when the frame size
+      // changes. SDL isn't threadsafe, so it's only ever touched from the
+      // render thread.
+      SDL_Texture *texture = nullptr;
+      int width = 0;
+      int height = 0;
+      // Whether a frame not yet on screen has been uploaded.
+      bool changed = false;
+      std::chrono::high_resolution_clock::time_point previous_video_time;
+      double video_framerate = 0;
+    };
+
+    static constexpr std::chrono::milliseconds kLatencyRefreshPeriod{500};
+    // How long input may wait for the render loop when nothing else is going
+    // on.
+    static constexpr std::chrono::milliseconds kInputPollPeriod{10};
+    // Labels are drawn this tall, in pixels, above the top left of each box.
+    static constexpr int kLabelHeight = 20;
+
+    // The label for |obj_id|, rendered the first time it's needed. Null
+    // texture if there's no font.
+    const Label &LabelFor(unsigned int obj_id);
+    // Draws |camera|'s frame letterboxed into |cell|, with its boxes.
+    void DrawCamera(size_t camera, const SDL_Rect &cell);
+    void DrawLabel(const bbox_t &target, const SDL_Rect &box);
+    void ReleaseTextures();
+
+    void RecordPresented(size_t camera, const BGImage &bg_image);
+
+    void UploadBGImage(CameraView &view, const BGImage &bg_image);
+
+    std::atomic<bool> done_{false};
+    SdlCanvas canvas_;
+    int width_, height_;
+    size_t num_cameras_;
+    std::unique_ptr<CameraView[]> views_;
+    std::vector<std::string> class_names_;
+    // Loaded once, when the render loop starts.
+    TTF_Font *font_ = nullptr;
+    // By obj_id, with one past the last class for "invalid".
+    std::vector<Label> labels_;
+
+    std::chrono::high_resolution_clock::time_point previous_render_time_;
+    // 0 if rendering isn't capped.
+    std::chrono::high_resolution_clock::duration min_render_period_{0};
+    // Rung whenever there's a new frame or new boxes, and by Exit().
+    Doorbell wake_;
+
+    LatencyStats *latency_stats_;
+    std::vector<LatencyStats::Summary> latency_summary_;
+    std::chrono::high_resolution_clock::time_point previous_latency_time_;
+};
+
+}  // namespace cam
+
+#endif // RENDER_THREAD_H
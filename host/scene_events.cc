@@ -0,0 +1,314 @@
+#include "host/scene_events.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace cam {
+namespace {
+
+int64_t UnixMicros(std::chrono::system_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+// Writes all of |data| to a blocking |fd|.
+bool WriteAll(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t result =
+        write(fd, data.data() + written, data.size() - written);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+// |name| as a single token, for an event line.
+std::string ClassToken(std::string name) {
+  std::replace(name.begin(), name.end(), ' ', '_');
+  return name;
+}
+
+// Whether |token| is what ClassToken() makes of |name|.
+bool IsClassToken(const std::string &name, const char *token) {
+  size_t i = 0;
+  for (; (i < name.size()) && (token[i] != '\0'); ++i) {
+    if (((name[i] == ' ') ? '_' : name[i]) != token[i]) {
+      return false;
+    }
+  }
+  return (i == name.size()) && (token[i] == '\0');
+}
+
+}  // namespace
+
+bool ParseSceneEvent(const std::string &line,
+                     const std::vector<std::string> &class_names,
+                     SceneEvent *event) {
+  long long time_us;
+  char token[64];
+  SceneEvent parsed;
+  bbox_t &box = parsed.box;
+  const int fields =
+      sscanf(line.c_str(), "%lld %zu %c %u %63s %u %u %u %u %f", &time_us,
+             &parsed.camera, &parsed.kind, &box.track_id, token, &box.x,
+             &box.y, &box.w, &box.h, &box.prob);
+  parsed.time_us = time_us;
+  if ((fields == 4) && (parsed.kind == '-')) {
+    *event = parsed;
+    return true;
+  }
+  if ((fields != 10) || ((parsed.kind != '+') && (parsed.kind != '~'))) {
+    return false;
+  }
+  box.obj_id = class_names.size();
+  for (size_t i = 0; i < class_names.size(); ++i) {
+    if (IsClassToken(class_names[i], token)) {
+      box.obj_id = i;
+      break;
+    }
+  }
+  unsigned int number;
+  char rest;
+  if ((box.obj_id == class_names.size()) &&
+      (sscanf(token, "%u%c", &number, &rest) == 1)) {
+    box.obj_id = number;
+  }
+  *event = parsed;
+  return true;
+}
+
+std::unique_ptr<SceneEventServer> SceneEventServer::Create(
+    const Options &options) {
+  std::unique_ptr<SceneEventServer> server(new SceneEventServer(options));
+  if (!options.file_path.empty()) {
+    server->file_fd_ = open(options.file_path.c_str(),
+                            O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (server->file_fd_ == -1) {
+      std::cerr << "Could not open " << options.file_path << ": "
+                << strerror(errno) << std::endl;
+      return nullptr;
+    }
+  }
+  server->socket_ = UnixSocketServer::Create(
+      options.socket_path, "scene event server", server.get());
+  if (!server->socket_) {
+    return nullptr;
+  }
+  return server;
+}
+
+SceneEventServer::SceneEventServer(const Options &options)
+    : options_(options) {
+  for (const std::string &name : options_.class_names) {
+    class_tokens_.push_back(ClassToken(name));
+  }
+  if (options_.num_cameras > 0) {
+    AddCamera(options_.num_cameras - 1);
+  }
+  published_.reserve(options_.max_pending_bytes);
+  distributing_.reserve(options_.max_pending_bytes);
+}
+
+void SceneEventServer::AddCamera(size_t camera) {
+  const size_t added = reported_.size();
+  reported_.resize(camera + 1);
+  reported_us_.resize(camera + 1);
+  for (size_t i = added; i < reported_.size(); ++i) {
+    reported_[i].reserve(options_.max_objects);
+  }
+}
+
+SceneEventServer::~SceneEventServer() {
+  if (file_fd_ != -1) {
+    close(file_fd_);
+  }
+}
+
+void SceneEventServer::FormatObject(int64_t time_us, size_t camera, char kind,
+                                    const bbox_t &box, std::string *out) const {
+  char line[256];
+  int length;
+  if (kind == '-') {
+    length = snprintf(line, sizeof(line), "%lld %zu - %u\n",
+                      static_cast<long long>(time_us), camera, box.track_id);
+  } else if (box.obj_id < class_tokens_.size()) {
+    length = snprintf(line, sizeof(line), "%lld %zu %c %u %s %u %u %u %u %.2f\n",
+                      static_cast<long long>(time_us), camera, kind,
+                      box.track_id, class_tokens_[box.obj_id].c_str(), box.x,
+                      box.y, box.w, box.h, box.prob);
+  } else {
+    length = snprintf(line, sizeof(line), "%lld %zu %c %u %u %u %u %u %u %.2f\n",
+                      static_cast<long long>(time_us), camera, kind,
+                      box.track_id, box.obj_id, box.x, box.y, box.w, box.h,
+                      box.prob);
+  }
+  out->append(line, std::min<size_t>(std::max(length, 0), sizeof(line) - 1));
+}
+
+bool SceneEventServer::Changed(const bbox_t &before,
+                               const bbox_t &after) const {
+  const auto moved = [this](unsigned int a, unsigned int b) {
+    return std::abs(static_cast<int>(a) - static_cast<int>(b)) >=
+           options_.min_move;
+  };
+  return (before.obj_id != after.obj_id) || moved(before.x, after.x) ||
+         moved(before.y, after.y) ||
+         moved(before.x + before.w, after.x + after.w) ||
+         moved(before.y + before.h, after.y + after.h) ||
+         (std::abs(before.prob - after.prob) >=
+          options_.min_confidence_change);
+}
+
+void SceneEventServer::Publish(
+    size_t camera, std::chrono::system_clock::time_point time,
+    const std::vector<bbox_t> &objects,
+    const std::vector<unsigned int> &live_track_ids) {
+  const int64_t time_us = UnixMicros(time);
+  std::lock_guard<std::mutex> guard(lock_);
+  if (camera >= reported_.size()) {
+    AddCamera(camera);
+  }
+  std::vector<bbox_t> &reported = reported_[camera];
+  reported_us_[camera] = time_us;
+  const bool was_empty = published_.empty();
+
+  for (const bbox_t &box : objects) {
+    if (box.track_id == 0) {
+      continue;
+    }
+    auto it = std::find_if(
+        reported.begin(), reported.end(),
+        [&](const bbox_t &before) { return before.track_id == box.track_id; });
+    if (it == reported.end()) {
+      FormatObject(time_us, camera, '+', box, &published_);
+      reported.push_back(box);
+    } else if (Changed(*it, box)) {
+      FormatObject(time_us, camera, '~', box, &published_);
+      *it = box;
+    }
+  }
+  // Anything reported before whose track has been dropped has left. Tracks
+  // still coasting keep their last report.
+  for (size_t i = 0; i < reported.size();) {
+    const bool present =
+        std::find(live_track_ids.begin(), live_track_ids.end(),
+                  reported[i].track_id) != live_track_ids.end();
+    if (present) {
+      ++i;
+      continue;
+    }
+    FormatObject(time_us, camera, '-', reported[i], &published_);
+    reported[i] = reported.back();
+    reported.pop_back();
+  }
+
+  // Run() only needs waking once per batch of lines.
+  if (was_empty && !published_.empty()) {
+    socket_->Wake();
+  }
+}
+
+void SceneEventServer::Run() { socket_->Run(); }
+
+void SceneEventServer::Stop() { socket_->Stop(); }
+
+bool SceneEventServer::OnConnect(int fd) {
+  // Existing subscribers get everything published so far, and the new one a
+  // snapshot of the state that leaves things in, so that neither misses or
+  // repeats anything.
+  Subscriber subscriber;
+  subscriber.fd = fd;
+  subscriber.pending = "# snapshot\n";
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    distributing_.swap(published_);
+    for (size_t camera = 0; camera < reported_.size(); ++camera) {
+      for (const bbox_t &box : reported_[camera]) {
+        FormatObject(reported_us_[camera], camera, '+', box,
+                     &subscriber.pending);
+      }
+    }
+  }
+  Deliver();
+  subscriber.pending += "# live\n";
+  subscribers_[fd] = std::move(subscriber);
+  return Flush(&subscribers_[fd]);
+}
+
+bool SceneEventServer::OnReceive(int, const char *, size_t) {
+  return true;
+}
+
+bool SceneEventServer::OnWritable(int fd) {
+  auto it = subscribers_.find(fd);
+  return (it != subscribers_.end()) && Flush(&it->second);
+}
+
+void SceneEventServer::OnDisconnect(int fd) { subscribers_.erase(fd); }
+
+void SceneEventServer::OnWake() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    distributing_.swap(published_);
+  }
+  Deliver();
+}
+
+void SceneEventServer::Deliver() {
+  if (distributing_.empty()) {
+    return;
+  }
+  const std::string &lines = distributing_;
+  if ((file_fd_ != -1) && !WriteAll(file_fd_, lines)) {
+    std::cerr << "Could not write scene events to " << options_.file_path
+              << ": " << strerror(errno) << std::endl;
+  }
+  std::vector<int> disconnected;
+  for (auto &[fd, subscriber] : subscribers_) {
+    subscriber.pending += lines;
+    if (!Flush(&subscriber)) {
+      disconnected.push_back(fd);
+    }
+  }
+  for (int fd : disconnected) {
+    socket_->Disconnect(fd);
+  }
+  distributing_.clear();
+}
+
+bool SceneEventServer::Flush(Subscriber *subscriber) {
+  size_t sent;
+  if (!socket_->Send(subscriber->fd, subscriber->pending.data(),
+                     subscriber->pending.size(), &sent)) {
+    return false;
+  }
+  subscriber->pending.erase(0, sent);
+  if (subscriber->pending.size() > options_.max_buffered_bytes) {
+    std::lock_guard<std::mutex> guard(lock_);
+    subscribers_dropped_++;
+    return false;
+  }
+  socket_->WatchWritable(subscriber->fd, !subscriber->pending.empty());
+  return true;
+}
+
+size_t SceneEventServer::subscribers_dropped() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return subscribers_dropped_;
+}
+
+}  // namespace cam
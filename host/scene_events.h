@@ -0,0 +1,164 @@
+#ifndef SCENE_EVENTS_H
+#define SCENE_EVENTS_H
+
+#include "host/object_detector.h"
+#include "host/unix_socket_server.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cam {
+
+// Where the pipeline serves scene events by default.
+inline constexpr char kSceneEventSocket[] = "/tmp/argos_scene.sock";
+
+// Streams what every camera sees as text, one event per line, to any number of
+// local subscribers (over a Unix domain socket) and optionally to a file.
+// Rather than the whole scene for every frame, only what changed since the
+// last event goes out:
+//
+//   <unix time, us> <camera> + <track id> <class> <x> <y> <w> <h> <confidence>
+//   <unix time, us> <camera> ~ <track id> <class> <x> <y> <w> <h> <confidence>
+//   <unix time, us> <camera> - <track id>
+//
+// for an object which appeared, moved (or changed) and left, respectively.
+// Every field is a single token: class names have their spaces replaced with
+// '_' (e.g. "traffic_light"), and classes without a name are reported by
+// number. See ParseSceneEvent(). Boxes are in frame pixels. Only tracked
+// objects are reported, since deltas need something to refer to. A new
+// subscriber first gets every object which is already in view, as "+" lines
+// between "# snapshot" and "# live", and deltas from then on, so it never has
+// to reconstruct history.
+//
+// Publish() only formats lines into a buffer, and all I/O happens on the
+// thread running Run(), so a slow subscriber never holds up the caller.
+// Subscribers which fall too far behind are disconnected instead. Anything
+// subscribers send is read and ignored.
+//
+// One line of scene events, parsed back. Everything but box.track_id is only
+// set for '+' and '~' events.
+struct SceneEvent {
+  int64_t time_us = 0;
+  size_t camera = 0;
+  char kind = 0;
+  bbox_t box{};
+};
+
+// Parses an event line as SceneEventServer writes it, mapping the class back
+// to its obj_id with |class_names| (classes not in there get
+// class_names.size()). Returns false for comments and malformed lines.
+bool ParseSceneEvent(const std::string &line,
+                     const std::vector<std::string> &class_names,
+                     SceneEvent *event);
+
+// This class is threadsafe.
+class SceneEventServer : private UnixSocketServer::Handler {
+  public:
+    struct Options {
+      // Path of the Unix domain socket to listen on. Replaced if it exists.
+      // Empty for none.
+      std::string socket_path;
+      // File to append events to. Empty for none.
+      std::string file_path;
+      // Class names by obj_id. Classes without one are reported by number.
+      std::vector<std::string> class_names;
+      // Objects are only reported as moved once an edge of their box has
+      // moved this many pixels since they were last reported, or their
+      // confidence has changed by min_confidence_change, so that detection
+      // jitter doesn't turn into a flood of events.
+      int min_move = 4;
+      float min_confidence_change = 0.1f;
+      // Subscribers with this much unsent output are disconnected.
+      size_t max_buffered_bytes = 1024 * 1024;  // 1MB.
+      // Room reserved up front, so that Publish() doesn't allocate: cameras,
+      // tracked objects per camera, and bytes of events published but not
+      // yet picked up by Run(). More still work, but allocate the first time
+      // they come up.
+      size_t num_cameras = 0;
+      size_t max_objects = 128;
+      size_t max_pending_bytes = 64 * 1024;  // 64KB.
+    };
+
+    // Returns nullptr (and logs why) if the socket or file can't be opened.
+    static std::unique_ptr<SceneEventServer> Create(const Options &options);
+    ~SceneEventServer() override;
+
+    SceneEventServer(const SceneEventServer &rhs) = delete;
+
+    // Reports that |objects| are what |camera| saw at |time|, and sends out
+    // whatever changed since its last report. Objects only leave once their
+    // track is gone from |live_track_ids| (see Tracker::LiveTrackIds()), so
+    // that an object the detector missed for a frame or two doesn't leave and
+    // come straight back.
+    void Publish(size_t camera, std::chrono::system_clock::time_point time,
+                 const std::vector<bbox_t> &objects,
+                 const std::vector<unsigned int> &live_track_ids);
+
+    // Accepts subscribers and writes out events until Stop() is called.
+    void Run();
+    void Stop();
+
+    // Subscribers disconnected for falling too far behind.
+    size_t subscribers_dropped();
+
+  private:
+    struct Subscriber {
+      int fd = -1;
+      std::string pending;
+    };
+
+    explicit SceneEventServer(const Options &options);
+
+    // Appends an event line for |box| to |out|.
+    void FormatObject(int64_t time_us, size_t camera, char kind,
+                      const bbox_t &box, std::string *out) const;
+    bool Changed(const bbox_t &before, const bbox_t &after) const;
+
+    // UnixSocketServer::Handler.
+    bool OnConnect(int fd) override;
+    // Subscribers have nothing to say, so this ignores it.
+    bool OnReceive(int fd, const char *data, size_t size) override;
+    bool OnWritable(int fd) override;
+    void OnDisconnect(int fd) override;
+    // Hands everything published since the last call to every subscriber and
+    // the file.
+    void OnWake() override;
+
+    // Makes room in reported_ for |camera|.
+    void AddCamera(size_t camera);
+    // Writes out distributing_, and empties it.
+    void Deliver();
+    // Writes as much of |subscriber|'s pending output as the socket takes.
+    // Returns false if it should be disconnected.
+    bool Flush(Subscriber *subscriber);
+
+    Options options_;
+    // options_.class_names as they appear in events.
+    std::vector<std::string> class_tokens_;
+    int file_fd_ = -1;
+    std::unique_ptr<UnixSocketServer> socket_;
+
+    std::mutex lock_;
+    // Guarded by lock_. Last reported state of each camera's objects.
+    std::vector<std::vector<bbox_t>> reported_;
+    // Guarded by lock_. Time of each camera's last report.
+    std::vector<int64_t> reported_us_;
+    // Guarded by lock_. Lines published but not yet distributed. Swapped
+    // with distributing_, so that both keep their room.
+    std::string published_;
+    size_t subscribers_dropped_ = 0;
+
+    // Only touched by Run(). Lines being distributed, and subscribers by fd.
+    std::string distributing_;
+    std::unordered_map<int, Subscriber> subscribers_;
+};
+
+}  // namespace cam
+
+#endif // SCENE_EVENTS_H
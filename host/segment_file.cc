@@ -0,0 +1,220 @@
+#include "host/segment_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace cam {
+
+namespace {
+
+constexpr size_t kPageSize = 4096;
+
+size_t RoundUpToPage(size_t len) {
+  return (len + kPageSize - 1) / kPageSize * kPageSize;
+}
+
+bool PwriteAll(int fd, const void *data, size_t len, uint64_t offset) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  while (len > 0) {
+    const ssize_t written = pwrite(fd, bytes, len, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += written;
+    len -= written;
+    offset += written;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::unique_ptr<SegmentWriter> SegmentWriter::Create(const std::string &path,
+                                                     size_t segment_bytes,
+                                                     uint32_t index_capacity,
+                                                     int64_t start_unix_us) {
+  const uint64_t data_offset = RoundUpToPage(
+      kSegmentHeaderSize + index_capacity * sizeof(SegmentIndexEntry));
+  if (segment_bytes <= data_offset) {
+    std::cerr << "Segment of " << segment_bytes
+              << " bytes has no room for frames." << std::endl;
+    return nullptr;
+  }
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    std::cerr << "Could not create segment " << path << ": " << strerror(errno)
+              << std::endl;
+    return nullptr;
+  }
+  // Reserve the whole segment up front, so that appends don't fragment the
+  // file and the index reads back as zeros until it's written.
+  const int error = posix_fallocate(fd, 0, segment_bytes);
+  if (error != 0) {
+    std::cerr << "Could not preallocate segment " << path << ": "
+              << strerror(error) << std::endl;
+    close(fd);
+    unlink(path.c_str());
+    return nullptr;
+  }
+
+  SegmentHeader header{};
+  std::memcpy(header.magic, kSegmentMagic, sizeof(header.magic));
+  header.version = kSegmentVersion;
+  header.index_capacity = index_capacity;
+  header.data_offset = data_offset;
+  header.start_unix_us = start_unix_us;
+  if (!PwriteAll(fd, &header, sizeof(header), 0)) {
+    std::cerr << "Could not write segment header to " << path << ": "
+              << strerror(errno) << std::endl;
+    close(fd);
+    unlink(path.c_str());
+    return nullptr;
+  }
+  return std::unique_ptr<SegmentWriter>(new SegmentWriter(
+      fd, path, segment_bytes, index_capacity, data_offset));
+}
+
+SegmentWriter::SegmentWriter(int fd, std::string path, size_t segment_bytes,
+                             uint32_t index_capacity, uint64_t data_offset)
+    : fd_(fd),
+      path_(std::move(path)),
+      segment_bytes_(segment_bytes),
+      index_capacity_(index_capacity),
+      data_end_(data_offset) {}
+
+SegmentWriter::~SegmentWriter() { Close(); }
+
+bool SegmentWriter::Append(ByteSpan jpeg, int64_t received_unix_us,
+                           int64_t capture_timestamp_us) {
+  if ((fd_ == -1) || failed_ || (num_frames_ == index_capacity_) ||
+      (data_end_ + jpeg.size > segment_bytes_)) {
+    return false;
+  }
+  SegmentIndexEntry entry{};
+  entry.received_unix_us = received_unix_us;
+  entry.capture_timestamp_us = capture_timestamp_us;
+  entry.offset = data_end_;
+  entry.size = jpeg.size;
+  const uint64_t entry_offset =
+      kSegmentHeaderSize + num_frames_ * sizeof(SegmentIndexEntry);
+  // Data before index, so that an entry never points at unwritten data.
+  if (!PwriteAll(fd_, jpeg.data, jpeg.size, data_end_) ||
+      !PwriteAll(fd_, &entry, sizeof(entry), entry_offset)) {
+    std::cerr << "Could not write to segment " << path_ << ": "
+              << strerror(errno) << std::endl;
+    failed_ = true;
+    return false;
+  }
+  data_end_ += jpeg.size;
+  num_frames_++;
+  return true;
+}
+
+void SegmentWriter::Close() {
+  if (fd_ == -1) {
+    return;
+  }
+  // The index stays full size, since readers find its end by the zeroed
+  // entries.
+  if (ftruncate(fd_, data_end_) != 0) {
+    std::cerr << "Could not trim segment " << path_ << ": " << strerror(errno)
+              << std::endl;
+  }
+  close(fd_);
+  fd_ = -1;
+}
+
+std::unique_ptr<SegmentReader> SegmentReader::Open(const std::string &path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    std::cerr << "Could not open segment " << path << ": " << strerror(errno)
+              << std::endl;
+    return nullptr;
+  }
+  struct stat stats;
+  if ((fstat(fd, &stats) != 0) ||
+      (static_cast<size_t>(stats.st_size) < kSegmentHeaderSize)) {
+    std::cerr << path << " is too small to be a segment." << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  void *data = mmap(nullptr, stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps the file open.
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Could not map segment " << path << ": " << strerror(errno)
+              << std::endl;
+    return nullptr;
+  }
+
+  const SegmentHeader *header = static_cast<const SegmentHeader *>(data);
+  const uint64_t index_end =
+      kSegmentHeaderSize +
+      static_cast<uint64_t>(header->index_capacity) * sizeof(SegmentIndexEntry);
+  if ((std::memcmp(header->magic, kSegmentMagic, sizeof(kSegmentMagic)) != 0) ||
+      (header->version != kSegmentVersion) ||
+      (index_end > static_cast<uint64_t>(stats.st_size))) {
+    std::cerr << path << " isn't a segment." << std::endl;
+    munmap(data, stats.st_size);
+    return nullptr;
+  }
+  return std::unique_ptr<SegmentReader>(
+      new SegmentReader(static_cast<const uint8_t *>(data), stats.st_size));
+}
+
+SegmentReader::SegmentReader(const uint8_t *data, size_t size)
+    : data_(data), size_(size) {
+  // Count up to the first empty (or, after a crash, out of bounds) entry.
+  const uint32_t capacity = header().index_capacity;
+  while (num_frames_ < capacity) {
+    const SegmentIndexEntry &next = entry(num_frames_);
+    if ((next.size == 0) || (next.offset + next.size > size_)) {
+      break;
+    }
+    num_frames_++;
+  }
+}
+
+SegmentReader::~SegmentReader() {
+  munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+const SegmentHeader &SegmentReader::header() const {
+  return *reinterpret_cast<const SegmentHeader *>(data_);
+}
+
+const SegmentIndexEntry &SegmentReader::entry(size_t frame) const {
+  return reinterpret_cast<const SegmentIndexEntry *>(data_ +
+                                                     kSegmentHeaderSize)[frame];
+}
+
+ByteSpan SegmentReader::jpeg(size_t frame) const {
+  const SegmentIndexEntry &index = entry(frame);
+  return {data_ + index.offset, index.size};
+}
+
+size_t SegmentReader::FindFrame(int64_t unix_us) const {
+  size_t low = 0;
+  size_t high = num_frames_;
+  while (low < high) {
+    const size_t mid = low + (high - low) / 2;
+    if (entry(mid).received_unix_us < unix_us) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+}  // namespace cam
@@ -0,0 +1,118 @@
+#ifndef SEGMENT_FILE_H
+#define SEGMENT_FILE_H
+
+#include "host/slab_buffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace cam {
+
+// Recorded frames are appended to large, preallocated segment files, so that
+// keeping weeks of footage doesn't mean millions of tiny files. A segment is
+// laid out as:
+//
+//   SegmentHeader, padded to kSegmentHeaderSize
+//   SegmentIndexEntry[index_capacity], one per frame, in recording order
+//   JPEG data
+//
+// The preallocated index starts out zeroed, and a frame's entry is written
+// after its data, so a segment cut short by a crash still reads back up to the
+// last complete frame.
+
+constexpr char kSegmentMagic[8] = {'A', 'R', 'G', 'O', 'S', 'S', 'E', 'G'};
+constexpr uint32_t kSegmentVersion = 1;
+constexpr size_t kSegmentHeaderSize = 4096;
+
+struct SegmentHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t index_capacity;
+  uint64_t data_offset;
+  // Wall clock time the segment was started, in microseconds since the epoch.
+  int64_t start_unix_us;
+};
+
+struct SegmentIndexEntry {
+  // Wall clock time the frame was received, in microseconds since the epoch.
+  int64_t received_unix_us;
+  // From the camera's X-Timestamp header. -1 if it didn't send one.
+  int64_t capture_timestamp_us;
+  uint64_t offset;
+  // 0 marks the end of the index.
+  uint32_t size;
+  uint32_t reserved;
+};
+
+// Appends frames to one segment file. Not threadsafe.
+class SegmentWriter {
+  public:
+    // Creates and preallocates a |segment_bytes| segment at |path| with room
+    // for |index_capacity| frames. Returns null on failure.
+    static std::unique_ptr<SegmentWriter> Create(const std::string &path,
+                                                 size_t segment_bytes,
+                                                 uint32_t index_capacity,
+                                                 int64_t start_unix_us);
+    ~SegmentWriter();
+
+    SegmentWriter(const SegmentWriter &rhs) = delete;
+
+    // Returns false without writing anything if the segment is full, or on an
+    // I/O error (check failed()).
+    bool Append(ByteSpan jpeg, int64_t received_unix_us,
+                int64_t capture_timestamp_us);
+
+    // Trims the unused tail of the preallocation and closes the file. Called by
+    // the destructor if need be.
+    void Close();
+
+    bool failed() const { return failed_; }
+    uint32_t num_frames() const { return num_frames_; }
+    const std::string &path() const { return path_; }
+
+  private:
+    SegmentWriter(int fd, std::string path, size_t segment_bytes,
+                  uint32_t index_capacity, uint64_t data_offset);
+
+    int fd_;
+    std::string path_;
+    size_t segment_bytes_;
+    uint32_t index_capacity_;
+    uint64_t data_end_;
+    uint32_t num_frames_ = 0;
+    bool failed_ = false;
+};
+
+// Random access to a segment's frames through a read-only mapping. Frames are
+// found by wall clock time with a binary search over the index.
+class SegmentReader {
+  public:
+    // Returns null if |path| can't be mapped or isn't a segment.
+    static std::unique_ptr<SegmentReader> Open(const std::string &path);
+    ~SegmentReader();
+
+    SegmentReader(const SegmentReader &rhs) = delete;
+
+    const SegmentHeader &header() const;
+    size_t num_frames() const { return num_frames_; }
+    const SegmentIndexEntry &entry(size_t frame) const;
+    // Points into the mapping, so it's valid as long as the reader is.
+    ByteSpan jpeg(size_t frame) const;
+
+    // Returns the first frame received at or after |unix_us|, or num_frames()
+    // if there isn't one.
+    size_t FindFrame(int64_t unix_us) const;
+
+  private:
+    SegmentReader(const uint8_t *data, size_t size);
+
+    const uint8_t *data_;
+    size_t size_;
+    size_t num_frames_ = 0;
+};
+
+}  // namespace cam
+
+#endif // SEGMENT_FILE_H
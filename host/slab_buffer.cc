@@ -0,0 +1,51 @@
+#include "host/slab_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace cam {
+
+ByteSpan ByteSpan::subspan(size_t offset, size_t len) const {
+  if (offset >= size) {
+    return {data + size, 0};
+  }
+  return {data + offset, std::min(len, size - offset)};
+}
+
+SlabBuffer::SlabBuffer(size_t capacity)
+    : data_(new uint8_t[capacity]), capacity_(capacity) {}
+
+MutableByteSpan SlabBuffer::PrepareWrite(size_t max_len) {
+  if (head_ == tail_) {
+    // Nothing unread, so we can rewind for free.
+    head_ = tail_ = 0;
+  } else if ((capacity_ - tail_ < max_len) && (head_ != 0)) {
+    // Slide the unread bytes back to the front of the slab.
+    std::memmove(data_.get(), data_.get() + head_, tail_ - head_);
+    tail_ -= head_;
+    head_ = 0;
+  }
+  return {data_.get() + tail_, std::min(max_len, capacity_ - tail_)};
+}
+
+void SlabBuffer::CommitWrite(size_t len) {
+  assert(tail_ + len <= capacity_);
+  tail_ += len;
+}
+
+size_t SlabBuffer::Write(const uint8_t *data, size_t len) {
+  MutableByteSpan region = PrepareWrite(len);
+  std::memcpy(region.data, data, region.size);
+  CommitWrite(region.size);
+  return region.size;
+}
+
+void SlabBuffer::Consume(size_t len) {
+  assert(len <= size());
+  // Deliberately doesn't rewind when the buffer empties -- a writer may be
+  // filling a region returned by PrepareWrite() right now.
+  head_ += len;
+}
+
+}  // namespace cam
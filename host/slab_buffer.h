@@ -0,0 +1,69 @@
+#ifndef SLAB_BUFFER_H
+#define SLAB_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace cam {
+
+// Non-owning view over a run of contiguous bytes. Stand-in for std::span until
+// we move to C++20.
+struct ByteSpan {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+
+  const uint8_t *begin() const { return data; }
+  const uint8_t *end() const { return data + size; }
+  bool empty() const { return size == 0; }
+
+  // Returns at most |len| bytes starting at |offset|.
+  ByteSpan subspan(size_t offset, size_t len) const;
+};
+
+struct MutableByteSpan {
+  uint8_t *data = nullptr;
+  size_t size = 0;
+};
+
+// Fixed-capacity contiguous byte buffer. Bytes are appended at the tail and
+// consumed from the head. Unlike a ring buffer, the readable region is always
+// contiguous, so parsers can run std::find/sscanf directly over it. When the
+// tail runs out of room, the unread bytes are slid back to the front of the
+// slab, which is amortized over all of the bytes consumed since the last slide.
+//
+// Not threadsafe on its own. Memory only ever moves inside PrepareWrite(), so a
+// single writer can fill the region PrepareWrite() returned without holding the
+// reader's lock, as long as PrepareWrite() and CommitWrite() themselves are
+// serialized with Readable() and Consume().
+class SlabBuffer {
+  public:
+    explicit SlabBuffer(size_t capacity);
+
+    SlabBuffer(const SlabBuffer &rhs) = delete;
+
+    // Returns a writable region of at most |max_len| bytes at the tail of the
+    // buffer. The region is empty if the buffer is full. Bytes written into it
+    // become readable after CommitWrite().
+    MutableByteSpan PrepareWrite(size_t max_len);
+    void CommitWrite(size_t len);
+
+    // Copies as much of |data| as fits. Returns the number of bytes copied.
+    size_t Write(const uint8_t *data, size_t len);
+
+    ByteSpan Readable() const { return {data_.get() + head_, tail_ - head_}; }
+    void Consume(size_t len);
+
+    size_t size() const { return tail_ - head_; }
+    size_t capacity() const { return capacity_; }
+
+  private:
+    std::unique_ptr<uint8_t[]> data_;
+    size_t capacity_;
+    size_t head_ = 0;
+    size_t tail_ = 0;
+};
+
+}  // namespace cam
+
+#endif // SLAB_BUFFER_H
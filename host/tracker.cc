@@ -0,0 +1,209 @@
+#include "host/tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+namespace cam {
+namespace {
+
+float Seconds(std::chrono::steady_clock::duration duration) {
+  return std::max(0.0f, std::chrono::duration<float>(duration).count());
+}
+
+// Center x, center y, width and height.
+void Measure(const bbox_t &box, float *measurements) {
+  measurements[0] = box.x + box.w / 2.0f;
+  measurements[1] = box.y + box.h / 2.0f;
+  measurements[2] = box.w;
+  measurements[3] = box.h;
+}
+
+}  // namespace
+
+bbox_t Extrapolate(const bbox_t &box, const BoxVelocity &velocity,
+                   float seconds) {
+  bbox_t moved = box;
+  moved.x = std::max(0.0f, std::round(box.x + velocity.x * seconds));
+  moved.y = std::max(0.0f, std::round(box.y + velocity.y * seconds));
+  moved.w = std::max(1.0f, std::round(box.w + velocity.w * seconds));
+  moved.h = std::max(1.0f, std::round(box.h + velocity.h * seconds));
+  return moved;
+}
+
+Tracker::Tracker(TrackIds *ids, const Options &options)
+    : ids_(ids), options_(options) {}
+
+void Tracker::Reserve(size_t max_tracks, size_t max_boxes) {
+  tracks_.reserve(max_tracks);
+  predicted_.reserve(max_tracks * 4);
+  // Every track could overlap every box of its class.
+  candidates_.reserve(max_tracks * max_boxes);
+  track_matched_.reserve(max_tracks);
+  box_matched_.reserve(max_boxes);
+}
+
+void Tracker::PredictAxis(float dt, float acceleration_noise, Axis *axis) {
+  // Constant velocity, with white noise acceleration of variance
+  // |acceleration_noise|.
+  const float q = acceleration_noise;
+  axis->position += axis->velocity * dt;
+  axis->p00 += dt * (2 * axis->p01 + dt * axis->p11) + q * dt * dt * dt / 3;
+  axis->p01 += dt * axis->p11 + q * dt * dt / 2;
+  axis->p11 += q * dt;
+}
+
+void Tracker::UpdateAxis(float measurement, float measurement_noise,
+                         Axis *axis) {
+  const float innovation = measurement - axis->position;
+  const float variance = axis->p00 + measurement_noise;
+  const float gain_position = axis->p00 / variance;
+  const float gain_velocity = axis->p01 / variance;
+  axis->position += gain_position * innovation;
+  axis->velocity += gain_velocity * innovation;
+  axis->p11 -= gain_velocity * axis->p01;
+  axis->p00 *= 1 - gain_position;
+  axis->p01 *= 1 - gain_position;
+}
+
+bbox_t Tracker::ToBox(const Track &track, const Axis *axes) {
+  bbox_t box = track.last;
+  const float w = std::max(1.0f, axes[2].position);
+  const float h = std::max(1.0f, axes[3].position);
+  box.x = std::max(0.0f, std::round(axes[0].position - w / 2));
+  box.y = std::max(0.0f, std::round(axes[1].position - h / 2));
+  box.w = std::round(w);
+  box.h = std::round(h);
+  return box;
+}
+
+void Tracker::PredictTrack(const Track &track, float dt, Axis *axes) const {
+  // Noise scales with the object's size, so that near and far objects are
+  // tracked alike.
+  const float scale =
+      options_.acceleration_noise * std::max(1.0f, track.axes[3].position);
+  for (int i = 0; i < 4; ++i) {
+    axes[i] = track.axes[i];
+    PredictAxis(dt, scale * scale, &axes[i]);
+  }
+}
+
+void Tracker::Update(Clock::time_point time, std::vector<bbox_t> *boxes) {
+  tracks_.erase(std::remove_if(tracks_.begin(), tracks_.end(),
+                               [&](const Track &track) {
+                                 return time - track.updated >
+                                        options_.max_coast;
+                               }),
+                tracks_.end());
+
+  std::vector<Axis> &predicted = predicted_;
+  predicted.resize(tracks_.size() * 4);
+  std::vector<std::tuple<float, size_t, size_t>> &candidates = candidates_;
+  candidates.clear();
+  for (size_t t = 0; t < tracks_.size(); ++t) {
+    PredictTrack(tracks_[t], Seconds(time - tracks_[t].updated),
+                 &predicted[t * 4]);
+    const bbox_t predicted_box = ToBox(tracks_[t], &predicted[t * 4]);
+    for (size_t b = 0; b < boxes->size(); ++b) {
+      if ((*boxes)[b].obj_id != tracks_[t].last.obj_id) {
+        continue;
+      }
+      const float iou = IntersectionOverUnion(predicted_box, (*boxes)[b]);
+      if (iou >= options_.min_iou) {
+        candidates.emplace_back(iou, t, b);
+      }
+    }
+  }
+  // Greedy matching, best overlap first. With the handful of objects in a
+  // scene, this nearly always agrees with an optimal assignment, for a
+  // fraction of the cost.
+  std::sort(candidates.begin(), candidates.end(),
+            [](const auto &a, const auto &b) {
+              return std::get<0>(a) > std::get<0>(b);
+            });
+  std::vector<bool> &track_matched = track_matched_;
+  track_matched.assign(tracks_.size(), false);
+  std::vector<bool> &box_matched = box_matched_;
+  box_matched.assign(boxes->size(), false);
+  float measurements[4];
+  for (const auto &[iou, t, b] : candidates) {
+    if (track_matched[t] || box_matched[b]) {
+      continue;
+    }
+    track_matched[t] = true;
+    box_matched[b] = true;
+    Track &track = tracks_[t];
+    bbox_t &box = (*boxes)[b];
+    Measure(box, measurements);
+    const float noise = options_.measurement_noise * std::max(1u, box.h);
+    for (int i = 0; i < 4; ++i) {
+      track.axes[i] = predicted[t * 4 + i];
+      UpdateAxis(measurements[i], noise * noise, &track.axes[i]);
+    }
+    track.updated = time;
+    track.hits++;
+    unsigned int track_id = track.last.track_id;
+    if ((track_id == 0) && (track.hits >= options_.min_hits)) {
+      track_id = ids_->Next();
+    }
+    box.track_id = track_id;
+    box.frames_counter = track.hits;
+    track.last = box;
+  }
+
+  // Everything else starts a new track.
+  for (size_t b = 0; b < boxes->size(); ++b) {
+    if (box_matched[b]) {
+      continue;
+    }
+    bbox_t &box = (*boxes)[b];
+    Measure(box, measurements);
+    const float h = std::max(1u, box.h);
+    const float noise = options_.measurement_noise * h;
+    Track track;
+    for (int i = 0; i < 4; ++i) {
+      // Nothing is known about the velocity yet, other than that it's
+      // probably within a box height or so per second.
+      track.axes[i] = {.position = measurements[i],
+                       .velocity = 0,
+                       .p00 = noise * noise,
+                       .p01 = 0,
+                       .p11 = h * h};
+    }
+    track.updated = time;
+    track.hits = 1;
+    box.track_id = (options_.min_hits <= 1) ? ids_->Next() : 0;
+    box.frames_counter = 1;
+    track.last = box;
+    tracks_.push_back(track);
+  }
+}
+
+bool Tracker::Velocity(unsigned int track_id, BoxVelocity *velocity) const {
+  if (track_id == 0) {
+    return false;
+  }
+  for (const Track &track : tracks_) {
+    if (track.last.track_id != track_id) {
+      continue;
+    }
+    // From center to corner.
+    velocity->x = track.axes[0].velocity - track.axes[2].velocity / 2;
+    velocity->y = track.axes[1].velocity - track.axes[3].velocity / 2;
+    velocity->w = track.axes[2].velocity;
+    velocity->h = track.axes[3].velocity;
+    return true;
+  }
+  return false;
+}
+
+void Tracker::LiveTrackIds(std::vector<unsigned int> *ids) const {
+  ids->clear();
+  for (const Track &track : tracks_) {
+    if (track.last.track_id != 0) {
+      ids->push_back(track.last.track_id);
+    }
+  }
+}
+
+}  // namespace cam
@@ -0,0 +1,128 @@
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include "host/object_detector.h"
+
+#include <atomic>
+#include <chrono>
+#include <tuple>
+#include <vector>
+
+namespace cam {
+
+// Hands out track IDs. Trackers which share one never reuse each other's IDs,
+// so that an ID names the same object across all cameras.
+//
+// This class is threadsafe.
+class TrackIds {
+  public:
+    unsigned int Next() { return next_++; }
+
+  private:
+    // 0 means untracked.
+    std::atomic<unsigned int> next_{1};
+};
+
+// Rate of change of a box, in pixels per second.
+struct BoxVelocity {
+  float x = 0;
+  float y = 0;
+  float w = 0;
+  float h = 0;
+};
+
+// Moves |box| along at |velocity| for |seconds|.
+bbox_t Extrapolate(const bbox_t &box, const BoxVelocity &velocity,
+                   float seconds);
+
+// Follows objects from one detection to the next, in the style of SORT: each
+// track's box (center and size) is a constant velocity Kalman filter, and each
+// new detection is matched to the track of the same class whose predicted box
+// it overlaps most. Detections matching no track start a new one, and tracks
+// which go unmatched for too long are dropped.
+//
+// Tracks only get an ID once they've been matched a few times, so that one-off
+// false positives don't use them up. Each track's velocity is known, so boxes
+// can be extrapolated to frames in between detections, which lets detection
+// run well below the frame rate. Updates take a few microseconds for a typical
+// scene.
+//
+// Not threadsafe. Each camera stream should get its own.
+class Tracker {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+      // Least IoU between a detection and a track's predicted box to match
+      // them.
+      float min_iou = 0.3f;
+      // Detections a track needs before it gets an ID.
+      unsigned int min_hits = 2;
+      // Tracks are dropped once they've gone this long without a detection.
+      std::chrono::milliseconds max_coast{1000};
+      // Standard deviations of the filter's noise, as fractions of the box's
+      // height: how far off a detection's edges may be, and how quickly an
+      // object may change speed (per second).
+      float measurement_noise = 0.05f;
+      float acceleration_noise = 1.0f;
+    };
+
+    explicit Tracker(TrackIds *ids) : Tracker(ids, Options()) {}
+    Tracker(TrackIds *ids, const Options &options);
+
+    // Makes room for |max_tracks| tracks at once, matched against up to
+    // |max_boxes| boxes per frame, so that Update() doesn't allocate until a
+    // scene gets busier than that.
+    void Reserve(size_t max_tracks, size_t max_boxes);
+
+    // Matches the boxes detected in a frame from |time| to tracks, and sets
+    // each one's track_id (0 for tracks without an ID yet) and frames_counter
+    // (detections in the track so far). Boxes are left where they were
+    // detected.
+    void Update(Clock::time_point time, std::vector<bbox_t> *boxes);
+
+    // Velocity of the track with |track_id|, as of its last detection.
+    bool Velocity(unsigned int track_id, BoxVelocity *velocity) const;
+
+    // Replaces |ids| with the ID of every track which has one and hasn't been
+    // dropped yet, including tracks coasting through missed detections.
+    void LiveTrackIds(std::vector<unsigned int> *ids) const;
+
+  private:
+    // Position and velocity of one of a box's coordinates, and their
+    // covariance.
+    struct Axis {
+      float position;
+      float velocity;
+      float p00, p01, p11;
+    };
+
+    struct Track {
+      // Center x, center y, width and height.
+      Axis axes[4];
+      Clock::time_point updated;
+      bbox_t last;
+      unsigned int hits = 0;
+    };
+
+    static void PredictAxis(float dt, float acceleration_noise, Axis *axis);
+    static void UpdateAxis(float measurement, float measurement_noise,
+                           Axis *axis);
+    static bbox_t ToBox(const Track &track, const Axis *axes);
+    // Predicts |track| |dt| seconds ahead into |axes|.
+    void PredictTrack(const Track &track, float dt, Axis *axes) const;
+
+    TrackIds *ids_;
+    Options options_;
+    std::vector<Track> tracks_;
+    // Scratch space for Update(), kept so that it doesn't allocate once the
+    // scene has been at its busiest.
+    std::vector<Axis> predicted_;
+    std::vector<std::tuple<float, size_t, size_t>> candidates_;
+    std::vector<bool> track_matched_;
+    std::vector<bool> box_matched_;
+};
+
+}  // namespace cam
+
+#endif // TRACKER_H
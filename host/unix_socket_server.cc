@@ -0,0 +1,235 @@
+#include "host/unix_socket_server.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+
+namespace cam {
+namespace {
+
+constexpr int kMaxEvents = 64;
+constexpr int kListenBacklog = 16;
+// Identifies the wake eventfd and the listening socket in epoll_event.data,
+// which otherwise holds a client's fd.
+constexpr uint64_t kWakeToken = ~0ull;
+constexpr uint64_t kListenToken = ~0ull - 1;
+
+}  // namespace
+
+std::unique_ptr<UnixSocketServer> UnixSocketServer::Create(
+    const std::string &socket_path, const std::string &name,
+    Handler *handler) {
+  std::unique_ptr<UnixSocketServer> server(
+      new UnixSocketServer(socket_path, name, handler));
+  if ((server->epoll_fd_ == -1) || (server->wake_fd_ == -1)) {
+    std::cerr << "Could not create " << name << " reactor: " << strerror(errno)
+              << std::endl;
+    return nullptr;
+  }
+  if (!socket_path.empty() && !server->Listen()) {
+    return nullptr;
+  }
+  return server;
+}
+
+UnixSocketServer::UnixSocketServer(const std::string &socket_path,
+                                   const std::string &name, Handler *handler)
+    : socket_path_(socket_path), name_(name), handler_(handler) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ((epoll_fd_ != -1) && (wake_fd_ != -1)) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = kWakeToken;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+  }
+}
+
+UnixSocketServer::~UnixSocketServer() {
+  for (const auto &[fd, watching] : clients_) {
+    close(fd);
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+  }
+  for (int fd : {wake_fd_, epoll_fd_}) {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+}
+
+bool UnixSocketServer::Listen() {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path_.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long: " << socket_path_ << std::endl;
+    return false;
+  }
+  strcpy(address.sun_path, socket_path_.c_str());
+  // A socket left behind by a previous run would make bind() fail.
+  unlink(address.sun_path);
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if ((listen_fd_ == -1) ||
+      (bind(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+            sizeof(address)) == -1) ||
+      (listen(listen_fd_, kListenBacklog) == -1)) {
+    std::cerr << "Could not listen on " << socket_path_ << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = kListenToken;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+  return true;
+}
+
+void UnixSocketServer::Run() {
+  epoll_event events[kMaxEvents];
+  while (true) {
+    const int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (num_events == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+      return;
+    }
+    for (int i = 0; i < num_events; ++i) {
+      const uint64_t token = events[i].data.u64;
+      if (token == kWakeToken) {
+        uint64_t count;
+        if (read(wake_fd_, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+          std::cerr << "Could not read " << name_
+                    << " wakeup: " << strerror(errno) << std::endl;
+        }
+        handler_->OnWake();
+        if (stopping_) {
+          return;
+        }
+      } else if (token == kListenToken) {
+        Accept();
+      } else {
+        const int fd = token;
+        // An earlier event in this batch may have disconnected it.
+        if (clients_.find(fd) == clients_.end()) {
+          continue;
+        }
+        if ((events[i].events & (EPOLLERR | EPOLLHUP)) ||
+            ((events[i].events & EPOLLIN) && !Receive(fd)) ||
+            !handler_->OnWritable(fd)) {
+          Disconnect(fd);
+        }
+      }
+    }
+  }
+}
+
+void UnixSocketServer::Stop() {
+  stopping_ = true;
+  const uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+    std::cerr << "Could not stop " << name_ << ": " << strerror(errno)
+              << std::endl;
+  }
+}
+
+void UnixSocketServer::Wake() {
+  const uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+    std::cerr << "Could not wake " << name_ << ": " << strerror(errno)
+              << std::endl;
+  }
+}
+
+void UnixSocketServer::Accept() {
+  while (true) {
+    const int fd =
+        accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        std::cerr << "Could not accept " << name_
+                  << " client: " << strerror(errno) << std::endl;
+      }
+      return;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    clients_[fd] = false;
+    if (!handler_->OnConnect(fd)) {
+      Disconnect(fd);
+    }
+  }
+}
+
+bool UnixSocketServer::Receive(int fd) {
+  char buffer[512];
+  while (true) {
+    const ssize_t result = recv(fd, buffer, sizeof(buffer), 0);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    }
+    if (result == 0) {
+      // Hung up.
+      return false;
+    }
+    if (!handler_->OnReceive(fd, buffer, result)) {
+      return false;
+    }
+  }
+}
+
+bool UnixSocketServer::Send(int fd, const char *data, size_t size,
+                            size_t *sent) {
+  *sent = 0;
+  while (*sent < size) {
+    const ssize_t result =
+        send(fd, data + *sent, size - *sent, MSG_NOSIGNAL);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    }
+    *sent += result;
+  }
+  return true;
+}
+
+void UnixSocketServer::WatchWritable(int fd, bool watch) {
+  auto it = clients_.find(fd);
+  if ((it == clients_.end()) || (it->second == watch)) {
+    return;
+  }
+  epoll_event event{};
+  event.events = watch ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+  event.data.u64 = fd;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+  it->second = watch;
+}
+
+void UnixSocketServer::Disconnect(int fd) {
+  auto it = clients_.find(fd);
+  if (it == clients_.end()) {
+    return;
+  }
+  handler_->OnDisconnect(fd);
+  // Closing the socket also removes it from the epoll set.
+  close(fd);
+  clients_.erase(it);
+}
+
+}  // namespace cam
@@ -0,0 +1,90 @@
+#ifndef UNIX_SOCKET_SERVER_H
+#define UNIX_SOCKET_SERVER_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace cam {
+
+// The reactor shared by the servers which stream to local clients over a Unix
+// domain socket (see FrameServer and SceneEventServer). It listens, accepts
+// clients, and runs one epoll loop over them, leaving what to send, and what
+// to make of what clients send, to a Handler. All client I/O happens on the
+// thread running Run(). Other threads hand it work by calling Wake(), after
+// which the handler picks the work up on that thread.
+//
+// Wake() and Stop() are threadsafe. Everything else may only be called from
+// the handler, on the thread running Run().
+class UnixSocketServer {
+  public:
+    // Clients are identified by their socket's fd, which stays open until
+    // OnDisconnect() returns.
+    class Handler {
+      public:
+        virtual ~Handler() = default;
+
+        // Returns false to hang up on the new client.
+        virtual bool OnConnect(int fd) = 0;
+        // The client sent |size| bytes. Returns false to hang up on it.
+        virtual bool OnReceive(int fd, const char *data, size_t size) = 0;
+        // Called after every event on the client, including room opening up
+        // in its socket. Returns false to hang up on it.
+        virtual bool OnWritable(int fd) = 0;
+        virtual void OnDisconnect(int fd) = 0;
+        // Wake() was called at least once since the last call.
+        virtual void OnWake() = 0;
+    };
+
+    // Listens on |socket_path|, replacing anything there, or not at all if
+    // it's empty. |name| is what log messages call the server. Returns nullptr
+    // (and logs why) if the socket can't be opened.
+    static std::unique_ptr<UnixSocketServer> Create(
+        const std::string &socket_path, const std::string &name,
+        Handler *handler);
+    ~UnixSocketServer();
+
+    UnixSocketServer(const UnixSocketServer &rhs) = delete;
+
+    // Accepts clients and handles their events until Stop() is called.
+    void Run();
+    void Stop();
+    // Has Run() call OnWake() soon.
+    void Wake();
+
+    // Writes as much of |data| as |fd|'s socket takes right now, and sets
+    // |*sent| to how much that was. Returns false if the client should be
+    // disconnected.
+    bool Send(int fd, const char *data, size_t size, size_t *sent);
+    // Whether OnWritable() should hear about room opening up in |fd|'s
+    // socket. Only worth asking for while there's something waiting for it.
+    void WatchWritable(int fd, bool watch);
+    void Disconnect(int fd);
+
+  private:
+    UnixSocketServer(const std::string &socket_path, const std::string &name,
+                     Handler *handler);
+    bool Listen();
+
+    void Accept();
+    // Hands whatever |fd| sent to the handler. Returns false if it hung up.
+    bool Receive(int fd);
+
+    std::string socket_path_;
+    std::string name_;
+    Handler *handler_;
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    // Written to by Wake() and Stop().
+    int wake_fd_ = -1;
+    std::atomic<bool> stopping_{false};
+
+    // Only touched by Run(). Whether each client's EPOLLOUT is armed, by fd.
+    std::unordered_map<int, bool> clients_;
+};
+
+}  // namespace cam
+
+#endif // UNIX_SOCKET_SERVER_H
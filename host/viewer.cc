@@ -0,0 +1,245 @@
+// Shows cameras from a running host_headless, in a grid, with their tracked
+// objects drawn on top. Frames come from the headless host's frame socket,
+// which only sends the cameras asked for, and objects from its scene events.
+//
+// Usage: viewer [--max_fps n] [camera...]
+//
+// Without any cameras, every one is shown.
+
+#include "host/frame_server.h"
+#include "host/frame_trace.h"
+#include "host/jpeg_decoder.h"
+#include "host/object_names.h"
+#include "host/render_thread.h"
+#include "host/scene_events.h"
+#include "linux_sdl/include/SDL.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Returns -1 (and logs why) if nothing's listening on |path|.
+int Connect(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ((fd == -1) || (connect(fd, reinterpret_cast<sockaddr *>(&address),
+                             sizeof(address)) == -1)) {
+    std::cerr << "Could not connect to " << path << ": " << strerror(errno)
+              << std::endl;
+    if (fd != -1) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+// Buffered reads from a blocking socket.
+class SocketReader {
+  public:
+    explicit SocketReader(int fd) : fd_(fd) {}
+
+    // Reads up to (and drops) the next newline. False once the socket closes.
+    bool ReadLine(std::string *line) {
+      size_t newline;
+      while ((newline = buffer_.find('\n')) == std::string::npos) {
+        if (!Fill()) {
+          return false;
+        }
+      }
+      line->assign(buffer_, 0, newline);
+      buffer_.erase(0, newline + 1);
+      return true;
+    }
+
+    bool ReadBytes(size_t size, std::vector<uint8_t> *bytes) {
+      while (buffer_.size() < size) {
+        if (!Fill()) {
+          return false;
+        }
+      }
+      bytes->assign(buffer_.begin(), buffer_.begin() + size);
+      buffer_.erase(0, size);
+      return true;
+    }
+
+  private:
+    bool Fill() {
+      char chunk[64 * 1024];
+      while (true) {
+        const ssize_t result = read(fd_, chunk, sizeof(chunk));
+        if (result == -1 && errno == EINTR) {
+          continue;
+        }
+        if (result <= 0) {
+          return false;
+        }
+        buffer_.append(chunk, result);
+        return true;
+      }
+    }
+
+    int fd_;
+    std::string buffer_;
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> class_names;
+  if (!cam::LoadObjectNames(cam::kObjectIdsFile, &class_names)) {
+    return -1;
+  }
+
+  const int frame_fd = Connect(cam::kFrameSocket);
+  if (frame_fd == -1) {
+    std::cerr << "Is host_headless running?" << std::endl;
+    return -1;
+  }
+  SocketReader frame_reader(frame_fd);
+  std::string greeting;
+  size_t num_cameras = 0;
+  if (!frame_reader.ReadLine(&greeting) ||
+      (sscanf(greeting.c_str(), "cameras %zu", &num_cameras) != 1)) {
+    std::cerr << "Unexpected greeting: " << greeting << std::endl;
+    return -1;
+  }
+  double max_fps = 0;
+  std::vector<size_t> cameras;
+  for (int i = 1; i < argc; ++i) {
+    if ((std::string(argv[i]) == "--max_fps") && (i + 1 < argc)) {
+      max_fps = strtod(argv[++i], nullptr);
+    } else {
+      cameras.push_back(strtoul(argv[i], nullptr, 10));
+    }
+  }
+  std::vector<bool> shown(num_cameras, cameras.empty());
+  for (size_t camera : cameras) {
+    if (camera >= num_cameras) {
+      std::cerr << "No camera " << camera << ", only " << num_cameras
+                << std::endl;
+      return -1;
+    }
+    shown[camera] = true;
+  }
+  std::string subscribe;
+  for (size_t camera = 0; camera < num_cameras; ++camera) {
+    if (shown[camera]) {
+      subscribe += "subscribe " + std::to_string(camera) + "\n";
+    }
+  }
+  if (write(frame_fd, subscribe.data(), subscribe.size()) !=
+      static_cast<ssize_t>(subscribe.size())) {
+    std::cerr << "Could not subscribe: " << strerror(errno) << std::endl;
+    return -1;
+  }
+  // Frames still show without objects if scene events are off.
+  const int scene_fd = Connect(cam::kSceneEventSocket);
+
+  SDL_LogSetAllPriority(SDL_LOG_PRIORITY_VERBOSE);
+
+  // Initial window size. Cameras of any resolution are letterboxed into it.
+  const int width = 800;
+  const int height = 600;
+
+  // Latency is only measured from when frames arrive here.
+  cam::LatencyStats latency_stats(num_cameras);
+  cam::RenderThread render_module(width, height, num_cameras, &latency_stats,
+                                  class_names, max_fps);
+  auto render_future = std::async(std::launch::async, [&render_module](){render_module();});
+
+  // Kept up to date from scene events, by camera and track ID.
+  std::mutex objects_lock;
+  std::vector<std::unordered_map<unsigned int, bbox_t>> objects(num_cameras);
+  std::thread scene_thread([&]() {
+    if (scene_fd == -1) {
+      return;
+    }
+    SocketReader reader(scene_fd);
+    std::string line;
+    cam::SceneEvent event;
+    while (reader.ReadLine(&line)) {
+      if (!cam::ParseSceneEvent(line, class_names, &event) ||
+          (event.camera >= num_cameras) || !shown[event.camera]) {
+        // Comments, and other cameras.
+        continue;
+      }
+      std::lock_guard<std::mutex> guard(objects_lock);
+      if (event.kind == '-') {
+        objects[event.camera].erase(event.box.track_id);
+      } else {
+        objects[event.camera][event.box.track_id] = event.box;
+      }
+    }
+  });
+
+  std::thread frame_thread([&]() {
+    cam::JpegDecoder decoder(cam::JpegDecoder::Options{});
+    std::string header;
+    std::vector<uint8_t> jpeg;
+    std::vector<bbox_t> targets;
+    while (frame_reader.ReadLine(&header)) {
+      size_t frame_camera, size;
+      if ((sscanf(header.c_str(), "frame %zu %zu", &frame_camera, &size) != 2) ||
+          (frame_camera >= num_cameras)) {
+        std::cerr << "Unexpected frame header: " << header << std::endl;
+        break;
+      }
+      cam::FrameTrace trace;
+      trace.socket_read = cam::FrameTrace::Clock::now();
+      if (!frame_reader.ReadBytes(size, &jpeg)) {
+        break;
+      }
+      trace.parsed = trace.decode_start = cam::FrameTrace::Clock::now();
+      cam::DecodedJpeg image = decoder.Decode(jpeg.data(), jpeg.size());
+      trace.decode_end = cam::FrameTrace::Clock::now();
+      if (image.data == nullptr) {
+        continue;
+      }
+      targets.clear();
+      {
+        std::lock_guard<std::mutex> guard(objects_lock);
+        for (const auto &[id, box] : objects[frame_camera]) {
+          targets.push_back(box);
+        }
+      }
+      render_module.SetObjectsDetected(frame_camera, targets);
+      render_module.SetBGImage(frame_camera, std::move(image.data),
+                               image.width, image.height, trace);
+    }
+    std::cerr << "Frame socket closed." << std::endl;
+  });
+
+  render_future.wait();
+  // Unblocks the reader threads.
+  shutdown(frame_fd, SHUT_RDWR);
+  if (scene_fd != -1) {
+    shutdown(scene_fd, SHUT_RDWR);
+  }
+  frame_thread.join();
+  scene_thread.join();
+  close(frame_fd);
+  if (scene_fd != -1) {
+    close(scene_fd);
+  }
+  render_module.Shutdown();
+  return 0;
+}